@@ -0,0 +1,186 @@
+/* Counts the heap calls (malloc, calloc, realloc and free) made per expression by
+ * the ways of evaluating one: get_solution, a stream created for every expression,
+ * the thread's default stream, which is only reset, compiling and freeing every
+ * expression, the expression cache when every lookup is a miss, and batch mode.
+ * The calls are counted by wrapping the allocation functions when linking (see
+ * the Makefile), and only after every test has been run once to warm up, so the
+ * counts are those of the steady state. get_solution, the streams, whose stacks
+ * live inside them, and the cache must not make any.
+ * Usage: ./allocation-benchmark [n]
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "batch.h"
+#include "expression-cache.h"
+#include "expression-stream.h"
+#include "expression.h"
+#include "two-stack.h"
+
+// The cache holds fewer expressions than there are, so that every lookup is a miss
+#define DISTINCT_EXPRESSIONS 1024
+#define CACHE_SIZE 64
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+void __real_free(void *pointer);
+
+static long heap_calls = 0;
+
+void *__wrap_malloc(size_t size)
+{
+    heap_calls++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    heap_calls++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *pointer, size_t size)
+{
+    heap_calls++;
+    return __real_realloc(pointer, size);
+}
+
+void __wrap_free(void *pointer)
+{
+    heap_calls++;
+    __real_free(pointer);
+}
+
+double seconds_since(struct timespec start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+// Different for every i below DISTINCT_EXPRESSIONS
+static char expressions[DISTINCT_EXPRESSIONS][64];
+static int lengths[DISTINCT_EXPRESSIONS];
+
+// Evaluate expression i with the given test, returning its value
+double evaluate(int test, int i, expression_cache *cache)
+{
+    char *buffer = expressions[i % DISTINCT_EXPRESSIONS];
+    int length = lengths[i % DISTINCT_EXPRESSIONS];
+    double value = 0.0;
+    if (test == 0)
+    {
+        value = get_solution(buffer);
+    }
+    else if (test == 1)
+    {
+        expression_stream stream;
+        expression_stream_init(&stream);
+        bool valid = expression_stream_calculate(&stream, buffer, length, &value);
+        assert(valid);
+        expression_stream_free(&stream);
+    }
+    else if (test == 2)
+    {
+        bool valid = expression_stream_calculate(expression_stream_default(), buffer, length, &value);
+        assert(valid);
+    }
+    else if (test == 3)
+    {
+        expression compiled;
+        bool valid = expression_compile(&compiled, buffer, NULL);
+        assert(valid);
+        value = expression_evaluate(&compiled, NULL);
+        expression_free(&compiled);
+    }
+    else
+    {
+        const expression_cache_entry *entry = expression_cache_get(cache, buffer, length);
+        assert(entry->constant);
+        value = entry->value;
+    }
+    return value;
+}
+
+int main(int argc, char *argv[])
+{
+    int n = 1000000;
+    if (argc > 1)
+    {
+        n = atoi(argv[1]);
+    }
+    if (n < 1)
+    {
+        printf("Usage: ./allocation-benchmark [n], with n >= 1\n");
+        return 1;
+    }
+
+    const char *names[] = {"get_solution", "new stream", "default", "compiled", "cached"};
+    const int expected_calls[] = {0, 0, 0, -1, 0};
+    int tests = sizeof(names) / sizeof(*names);
+    for (int i = 0; i < DISTINCT_EXPRESSIONS; i++)
+    {
+        lengths[i] = sprintf(expressions[i], "( ( %i.5 + ( 2 * %i ) ) / ( 3 - -%i.25 ) ) ^ 0.5", i % 97, i, i % 89);
+    }
+    expression_cache cache;
+    expression_cache_init(&cache, CACHE_SIZE);
+
+    printf("n = %i\n", n);
+    printf("%-14s %16s %16s\n", "test", "heap calls/expr", "ns/expression");
+    double reference = 0.0;
+    for (int test = 0; test < tests; test++)
+    {
+        // Warm up, filling the cache and growing the default stream
+        for (int i = 0; i < DISTINCT_EXPRESSIONS; i++)
+        {
+            evaluate(test, i, &cache);
+        }
+
+        double sum = 0.0;
+        long calls = heap_calls;
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < n; i++)
+        {
+            sum += evaluate(test, i, &cache);
+        }
+        double evaluated = seconds_since(start);
+        calls = heap_calls - calls;
+        assert(expected_calls[test] < 0 || calls == expected_calls[test]);
+        // Every way rounds every operation the same way
+        assert(test == 0 ? (reference = sum, true) : sum == reference);
+        printf("%-14s %16.2f %16.2f\n", names[test], (double)calls / n, evaluated * 1e9 / n);
+    }
+    assert(cache.misses == DISTINCT_EXPRESSIONS + n);
+    expression_cache_free(&cache);
+
+    // Batch mode on the same expressions, one per line, in one thread
+    char *text = malloc((size_t)n * 64);
+    assert(text);
+    size_t length = 0;
+    for (int i = 0; i < n; i++)
+    {
+        memcpy(text + length, expressions[i % DISTINCT_EXPRESSIONS], lengths[i % DISTINCT_EXPRESSIONS]);
+        length += lengths[i % DISTINCT_EXPRESSIONS];
+        text[length++] = '\n';
+    }
+    FILE *output = fopen("/dev/null", "w");
+    assert(output);
+    long calls = heap_calls;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long errors = batch_evaluate(text, length, 1, output, stderr);
+    double evaluated = seconds_since(start);
+    calls = heap_calls - calls;
+    assert(errors == 0);
+    printf("%-14s %16.2f %16.2f   (per line, with the set-up of every round)\n", "batch", (double)calls / n,
+           evaluated * 1e9 / n);
+    fclose(output);
+    free(text);
+    return 0;
+}
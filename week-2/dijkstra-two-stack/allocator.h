@@ -0,0 +1,360 @@
+/* Pluggable ALLOCATORS for the generic containers
+ * A container created with *_create_with(allocator) gets its header and storage
+ * array from that allocator instead of malloc. Two allocators are provided:
+ * - arena: bump allocator. Nothing is freed individually, arena_reset releases
+ *   everything at once and keeps the memory for the next round.
+ * - pool: size-class free lists carved out of large slabs. Freed blocks are
+ *   reused by the next allocation of the same class, pool_free releases all.
+ * The same file is used by stack.h, deque.h and rqueue.h.
+ */
+
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct allocator
+{
+    void *(*allocate)(void *context, size_t size);
+    void *(*reallocate)(void *context, void *pointer, size_t old_size, size_t new_size);
+    void (*release)(void *context, void *pointer, size_t size);
+    void *context;
+} allocator;
+
+// All allocations are aligned for any type
+#define ALLOCATOR_ALIGNMENT 16
+
+static inline size_t allocator_round_up(size_t size)
+{
+    return (size + ALLOCATOR_ALIGNMENT - 1) & ~(size_t)(ALLOCATOR_ALIGNMENT - 1);
+}
+
+/* Default allocator: malloc, realloc and free */
+static inline void *heap_allocate(void *context, size_t size)
+{
+    (void)context;
+    return malloc(size);
+}
+
+static inline void *heap_reallocate(void *context, void *pointer, size_t old_size, size_t new_size)
+{
+    (void)context;
+    (void)old_size;
+    return realloc(pointer, new_size);
+}
+
+static inline void heap_release(void *context, void *pointer, size_t size)
+{
+    (void)context;
+    (void)size;
+    free(pointer);
+}
+
+static const allocator HEAP_ALLOCATOR = {heap_allocate, heap_reallocate, heap_release, NULL};
+
+/* Arena (bump) allocator */
+typedef struct arena_chunk
+{
+    struct arena_chunk *next;
+    size_t capacity;
+    size_t used;
+    _Alignas(ALLOCATOR_ALIGNMENT) unsigned char data[];
+} arena_chunk;
+
+typedef struct arena
+{
+    arena_chunk *chunks;
+    arena_chunk *current;
+    size_t chunk_size;
+    allocator allocator;
+} arena;
+
+static inline void *arena_allocate(void *context, size_t size)
+{
+    arena *a = context;
+    size = allocator_round_up(size);
+
+    // Move on to the next chunk (left over from before a reset) until one fits
+    while (a->current && a->current->capacity - a->current->used < size && a->current->next)
+    {
+        a->current = a->current->next;
+        a->current->used = 0;
+    }
+
+    if (!a->current || a->current->capacity - a->current->used < size)
+    {
+        // Append a new chunk, chunks stay in the order they are used in
+        size_t capacity = size > a->chunk_size ? size : a->chunk_size;
+        arena_chunk *chunk = malloc(sizeof(*chunk) + capacity);
+        assert(chunk);
+        chunk->next = NULL;
+        chunk->capacity = capacity;
+        chunk->used = 0;
+        if (a->current)
+        {
+            a->current->next = chunk;
+        }
+        else
+        {
+            a->chunks = chunk;
+        }
+        a->current = chunk;
+    }
+
+    void *pointer = a->current->data + a->current->used;
+    a->current->used += size;
+    return pointer;
+}
+
+static inline void *arena_reallocate(void *context, void *pointer, size_t old_size, size_t new_size)
+{
+    arena *a = context;
+    old_size = allocator_round_up(old_size);
+    new_size = allocator_round_up(new_size);
+
+    // The most recent allocation can grow or shrink in place
+    arena_chunk *chunk = a->current;
+    if (chunk && (unsigned char *)pointer + old_size == chunk->data + chunk->used &&
+        chunk->used - old_size + new_size <= chunk->capacity)
+    {
+        chunk->used = chunk->used - old_size + new_size;
+        return pointer;
+    }
+    if (new_size <= old_size)
+    {
+        return pointer;
+    }
+
+    void *moved = arena_allocate(context, new_size);
+    memcpy(moved, pointer, old_size);
+    return moved;
+}
+
+static inline void arena_release(void *context, void *pointer, size_t size)
+{
+    arena *a = context;
+    size = allocator_round_up(size);
+
+    // Only the most recent allocation is given back, everything else waits for arena_reset
+    arena_chunk *chunk = a->current;
+    if (chunk && (unsigned char *)pointer + size == chunk->data + chunk->used)
+    {
+        chunk->used -= size;
+    }
+}
+
+/* Initialise arena that gets memory from malloc in chunks of chunk_size bytes */
+static inline void arena_init(arena *a, size_t chunk_size)
+{
+    assert(a);
+    a->chunks = NULL;
+    a->current = NULL;
+    a->chunk_size = chunk_size;
+    a->allocator = (allocator){arena_allocate, arena_reallocate, arena_release, a};
+}
+
+/* Release all allocations at once, keeping the chunks for reuse */
+static inline void arena_reset(arena *a)
+{
+    assert(a);
+    a->current = a->chunks;
+    if (a->current)
+    {
+        a->current->used = 0;
+    }
+}
+
+/* Give all chunks back to malloc */
+static inline void arena_free(arena *a)
+{
+    assert(a);
+    while (a->chunks)
+    {
+        arena_chunk *next = a->chunks->next;
+        free(a->chunks);
+        a->chunks = next;
+    }
+    a->current = NULL;
+}
+
+/* Size-class pool allocator */
+#define POOL_CLASS_COUNT 9
+#define POOL_MAX_CLASS_SIZE (ALLOCATOR_ALIGNMENT << (POOL_CLASS_COUNT - 1))
+
+static const size_t POOL_SLAB_SIZE = 64 * 1024;
+
+// Allocations too big for a size class, kept on a list so pool_free can release them
+typedef struct pool_large
+{
+    struct pool_large *previous;
+    struct pool_large *next;
+    _Alignas(ALLOCATOR_ALIGNMENT) unsigned char data[];
+} pool_large;
+
+typedef struct pool
+{
+    void *free_lists[POOL_CLASS_COUNT];
+    void *slabs;
+    unsigned char *slab_cursor;
+    unsigned char *slab_end;
+    pool_large *large;
+    allocator allocator;
+} pool;
+
+// Size class of an allocation, or POOL_CLASS_COUNT if it is too big
+static inline int pool_class(size_t size)
+{
+    int class = 0;
+    size_t class_size = ALLOCATOR_ALIGNMENT;
+    while (class < POOL_CLASS_COUNT && class_size < size)
+    {
+        class++;
+        class_size *= 2;
+    }
+    return class;
+}
+
+static inline void *pool_allocate(void *context, size_t size)
+{
+    pool *p = context;
+    int class = pool_class(size);
+
+    if (class == POOL_CLASS_COUNT)
+    {
+        pool_large *large = malloc(sizeof(*large) + size);
+        assert(large);
+        large->previous = NULL;
+        large->next = p->large;
+        if (p->large)
+        {
+            p->large->previous = large;
+        }
+        p->large = large;
+        return large->data;
+    }
+
+    void *block = p->free_lists[class];
+    if (block)
+    {
+        p->free_lists[class] = *(void **)block;
+        return block;
+    }
+
+    size_t class_size = (size_t)ALLOCATOR_ALIGNMENT << class;
+    if ((size_t)(p->slab_end - p->slab_cursor) < class_size)
+    {
+        // Start a new slab, the first block of it links the slabs together
+        unsigned char *slab = malloc(POOL_SLAB_SIZE);
+        assert(slab);
+        *(void **)slab = p->slabs;
+        p->slabs = slab;
+        p->slab_cursor = slab + ALLOCATOR_ALIGNMENT;
+        p->slab_end = slab + POOL_SLAB_SIZE;
+    }
+    block = p->slab_cursor;
+    p->slab_cursor += class_size;
+    return block;
+}
+
+static inline void pool_release(void *context, void *pointer, size_t size)
+{
+    pool *p = context;
+    int class = pool_class(size);
+
+    if (class == POOL_CLASS_COUNT)
+    {
+        pool_large *large = (pool_large *)((unsigned char *)pointer - offsetof(pool_large, data));
+        if (large->previous)
+        {
+            large->previous->next = large->next;
+        }
+        else
+        {
+            p->large = large->next;
+        }
+        if (large->next)
+        {
+            large->next->previous = large->previous;
+        }
+        free(large);
+        return;
+    }
+
+    *(void **)pointer = p->free_lists[class];
+    p->free_lists[class] = pointer;
+}
+
+static inline void *pool_reallocate(void *context, void *pointer, size_t old_size, size_t new_size)
+{
+    pool *p = context;
+    int old_class = pool_class(old_size);
+    int new_class = pool_class(new_size);
+
+    if (old_class == new_class && new_class < POOL_CLASS_COUNT)
+    {
+        return pointer;
+    }
+    if (old_class == POOL_CLASS_COUNT && new_class == POOL_CLASS_COUNT)
+    {
+        // Let realloc move the large allocation, then relink its neighbours
+        pool_large *large = (pool_large *)((unsigned char *)pointer - offsetof(pool_large, data));
+        large = realloc(large, sizeof(*large) + new_size);
+        assert(large);
+        if (large->previous)
+        {
+            large->previous->next = large;
+        }
+        else
+        {
+            p->large = large;
+        }
+        if (large->next)
+        {
+            large->next->previous = large;
+        }
+        return large->data;
+    }
+
+    void *moved = pool_allocate(context, new_size);
+    memcpy(moved, pointer, old_size < new_size ? old_size : new_size);
+    pool_release(context, pointer, old_size);
+    return moved;
+}
+
+/* Initialise empty pool */
+static inline void pool_init(pool *p)
+{
+    assert(p);
+    for (int i = 0; i < POOL_CLASS_COUNT; i++)
+    {
+        p->free_lists[i] = NULL;
+    }
+    p->slabs = NULL;
+    p->slab_cursor = NULL;
+    p->slab_end = NULL;
+    p->large = NULL;
+    p->allocator = (allocator){pool_allocate, pool_reallocate, pool_release, p};
+}
+
+/* Give all slabs and large allocations back to malloc */
+static inline void pool_free(pool *p)
+{
+    assert(p);
+    while (p->slabs)
+    {
+        void *next = *(void **)p->slabs;
+        free(p->slabs);
+        p->slabs = next;
+    }
+    while (p->large)
+    {
+        pool_large *next = p->large->next;
+        free(p->large);
+        p->large = next;
+    }
+    pool_init(p);
+}
+
+#endif
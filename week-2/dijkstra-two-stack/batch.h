@@ -0,0 +1,342 @@
+/* BATCH evaluation of expression files, one expression per line
+ * The input is mapped into memory when it is a regular file and read in large
+ * blocks otherwise. It is evaluated in rounds: each round, every thread compiles
+ * and evaluates the lines of its own range of about BATCH_RANGE_SIZE bytes into
+ * a private output buffer, and the buffers are then written out in input order,
+ * so the output holds one line per input line whatever the number of threads.
+ * A line that is not a valid expression gives "error" in the output and a
+ * message with its line and column on the error stream.
+ * Every thread keeps an expression cache (expression-cache.h), so a line that
+ * repeats an earlier one in the same thread is not compiled again.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "expression-cache.h"
+#include "expression.h"
+
+#define BATCH_MAX_THREADS 64
+// Bytes of input per thread per round, and per read when the input cannot be mapped
+#define BATCH_RANGE_SIZE (1 << 20)
+#define BATCH_READ_SIZE (1 << 20)
+// Distinct expressions each thread remembers
+#define BATCH_CACHE_SIZE 4096
+
+typedef struct batch_input
+{
+    char *text;
+    size_t length;
+    bool mapped;
+} batch_input;
+
+typedef struct batch_error
+{
+    // Line within the range of the thread, counted from 0, and column from 1
+    long line;
+    int column;
+    const char *message;
+} batch_error;
+
+DEFINE_STACK_TYPE(batch_error, batch_error);
+
+typedef struct batch_worker
+{
+    const char *begin;
+    const char *end;
+    long lines;
+    // Copy of the current line, with a '\0' for expression_compile
+    char *line;
+    size_t line_capacity;
+    char *output;
+    size_t output_length;
+    size_t output_capacity;
+    batch_error_stack *errors;
+    expression_cache cache;
+} batch_worker;
+
+/* Read all of path, or stdin if path is NULL or "-". Returns false if it cannot be read */
+static inline bool batch_input_open(batch_input *input, const char *path)
+{
+    bool from_stdin = !path || strcmp(path, "-") == 0;
+    int fd = from_stdin ? STDIN_FILENO : open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    input->text = NULL;
+    input->length = 0;
+    input->mapped = false;
+
+    struct stat file;
+    if (fstat(fd, &file) == 0 && S_ISREG(file.st_mode) && file.st_size > 0)
+    {
+        void *address = mmap(NULL, file.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address != MAP_FAILED)
+        {
+            madvise(address, file.st_size, MADV_SEQUENTIAL);
+            input->text = address;
+            input->length = file.st_size;
+            input->mapped = true;
+        }
+    }
+
+    // Pipes, terminals and files that cannot be mapped are read in large blocks
+    size_t capacity = 0;
+    ssize_t bytes = 0;
+    while (!input->mapped)
+    {
+        if (capacity - input->length < BATCH_READ_SIZE)
+        {
+            capacity = capacity ? capacity * 2 : 4 * BATCH_READ_SIZE;
+            input->text = realloc(input->text, capacity);
+            assert(input->text);
+        }
+        bytes = read(fd, input->text + input->length, capacity - input->length);
+        if (bytes <= 0)
+        {
+            break;
+        }
+        input->length += bytes;
+    }
+
+    if (!from_stdin)
+    {
+        close(fd);
+    }
+    if (bytes < 0)
+    {
+        free(input->text);
+        return false;
+    }
+    return true;
+}
+
+static inline void batch_input_close(batch_input *input)
+{
+    if (input->mapped)
+    {
+        munmap(input->text, input->length);
+    }
+    else
+    {
+        free(input->text);
+    }
+    input->text = NULL;
+    input->length = 0;
+}
+
+static inline void batch_worker_reserve(batch_worker *worker, size_t n)
+{
+    if (worker->output_capacity - worker->output_length < n)
+    {
+        while (worker->output_capacity - worker->output_length < n)
+        {
+            worker->output_capacity = worker->output_capacity ? worker->output_capacity * 2 : 4096;
+        }
+        worker->output = realloc(worker->output, worker->output_capacity);
+        assert(worker->output);
+    }
+}
+
+static inline void batch_worker_print(batch_worker *worker, double solution)
+{
+    // Enough for most numbers, the rest go round a second time
+    batch_worker_reserve(worker, 64);
+    size_t space = worker->output_capacity - worker->output_length;
+    int length = snprintf(worker->output + worker->output_length, space, "%.10lf\n", solution);
+    if ((size_t)length >= space)
+    {
+        batch_worker_reserve(worker, length + 1);
+        snprintf(worker->output + worker->output_length, length + 1, "%.10lf\n", solution);
+    }
+    worker->output_length += length;
+}
+
+static inline void batch_worker_write(batch_worker *worker, const char *text, size_t length)
+{
+    batch_worker_reserve(worker, length);
+    memcpy(worker->output + worker->output_length, text, length);
+    worker->output_length += length;
+}
+
+/* Offset of the first variable name in a valid expression */
+static inline int batch_first_name(const char *line)
+{
+    int length = strlen(line);
+    int position = 0;
+    while (true)
+    {
+        expression_token token = expression_next_token(line, length, &position);
+        if (token.type == EXPRESSION_TOKEN_END)
+        {
+            return token.position;
+        }
+        // A name followed by '(' is a function
+        int next = position;
+        if (token.type == EXPRESSION_TOKEN_NAME &&
+            expression_next_token(line, length, &next).type != EXPRESSION_TOKEN_OPEN)
+        {
+            return token.position;
+        }
+    }
+}
+
+/* Evaluate every line from begin up to end, which is just past a '\n' or the end of the input */
+static inline void *batch_worker_run(void *arg)
+{
+    batch_worker *worker = arg;
+    const char *line = worker->begin;
+    while (line < worker->end)
+    {
+        const char *newline = memchr(line, '\n', worker->end - line);
+        const char *next = newline ? newline + 1 : worker->end;
+        size_t length = (newline ? newline : worker->end) - line;
+        if (length > 0 && line[length - 1] == '\r')
+        {
+            length--;
+        }
+
+        // Blank lines stay blank
+        size_t blank = 0;
+        while (blank < length && (line[blank] == ' ' || line[blank] == '\t'))
+        {
+            blank++;
+        }
+        if (blank == length)
+        {
+            batch_worker_write(worker, "\n", 1);
+            worker->lines++;
+            line = next;
+            continue;
+        }
+
+        // Repeated expressions skip compiling and evaluating
+        const expression_cache_entry *entry = expression_cache_get(&worker->cache, line, length);
+        if (entry->constant)
+        {
+            batch_worker_print(worker, entry->value);
+            worker->lines++;
+            line = next;
+            continue;
+        }
+
+        // Errors are rare, so the line is compiled once more to find the column in its own text
+        if (length + 1 > worker->line_capacity)
+        {
+            worker->line_capacity = length + 1 > 2 * worker->line_capacity ? length + 1 : 2 * worker->line_capacity;
+            free(worker->line);
+            worker->line = malloc(worker->line_capacity);
+            assert(worker->line);
+        }
+        memcpy(worker->line, line, length);
+        worker->line[length] = '\0';
+
+        expression compiled;
+        expression_error error = {0, NULL};
+        if (expression_compile(&compiled, worker->line, &error))
+        {
+            // Nothing gives the variables a value, so point at the first one
+            error.position = batch_first_name(worker->line);
+            error.message = "variables have no value in batch mode";
+            expression_free(&compiled);
+        }
+        batch_worker_write(worker, "error\n", 6);
+        stack_batch_error_push(worker->errors, (batch_error){worker->lines, error.position + 1, error.message});
+
+        worker->lines++;
+        line = next;
+    }
+    return NULL;
+}
+
+/* Evaluate every line of text with the given number of threads, writing the results
+ * to output and the errors to errors. Returns the number of lines with errors */
+static inline long batch_evaluate(const char *text, size_t length, int threads, FILE *output, FILE *errors)
+{
+    assert(threads >= 1 && threads <= BATCH_MAX_THREADS);
+    batch_worker workers[BATCH_MAX_THREADS];
+    pthread_t ids[BATCH_MAX_THREADS];
+    memset(workers, 0, sizeof(workers));
+    for (int i = 0; i < threads; i++)
+    {
+        workers[i].errors = stack_batch_error_create();
+        expression_cache_init(&workers[i].cache, BATCH_CACHE_SIZE);
+    }
+
+    long lines = 0;
+    long error_count = 0;
+    const char *position = text;
+    const char *end = text + length;
+    while (position < end)
+    {
+        // Cut the next ranges just after a '\n', or at the end of the input
+        int used = 0;
+        for (; used < threads && position < end; used++)
+        {
+            batch_worker *worker = &workers[used];
+            const char *cut = end - position > BATCH_RANGE_SIZE ? position + BATCH_RANGE_SIZE : end;
+            if (cut < end)
+            {
+                const char *newline = memchr(cut, '\n', end - cut);
+                cut = newline ? newline + 1 : end;
+            }
+            worker->begin = position;
+            worker->end = cut;
+            worker->lines = 0;
+            worker->output_length = 0;
+            worker->errors->size = 0;
+            position = cut;
+        }
+
+        if (used == 1)
+        {
+            batch_worker_run(&workers[0]);
+        }
+        else
+        {
+            for (int i = 0; i < used; i++)
+            {
+                pthread_create(&ids[i], NULL, batch_worker_run, &workers[i]);
+            }
+            for (int i = 0; i < used; i++)
+            {
+                pthread_join(ids[i], NULL);
+            }
+        }
+
+        for (int i = 0; i < used; i++)
+        {
+            batch_worker *worker = &workers[i];
+            fwrite(worker->output, 1, worker->output_length, output);
+            for (int j = 0; j < worker->errors->size; j++)
+            {
+                batch_error error = worker->errors->storage_array[j];
+                fprintf(errors, "line %li, column %i: %s\n", lines + error.line + 1, error.column, error.message);
+            }
+            error_count += worker->errors->size;
+            lines += worker->lines;
+        }
+    }
+
+    for (int i = 0; i < threads; i++)
+    {
+        free(workers[i].line);
+        free(workers[i].output);
+        stack_batch_error_free(workers[i].errors);
+        expression_cache_free(&workers[i].cache);
+    }
+    return error_count;
+}
+
+#endif
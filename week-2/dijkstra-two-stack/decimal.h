@@ -0,0 +1,441 @@
+/* Fixed-point DECIMAL numbers in 128 bits
+ * A decimal is a signed 128-bit integer counting units of 10^-18, so it holds
+ * numbers up to about 1.7e20 with 18 exact decimals: 0.1 + 0.2 is exactly 0.3,
+ * and sums of amounts do not drift however long they get. Addition and
+ * subtraction are exact; multiplication and division round the 18th decimal half
+ * to even, the way decimal floating point does. A result that does not fit, and
+ * a division by zero, give DECIMAL_INVALID, which every operation passes on like
+ * a NaN.
+ * The kernels keep branches on the data to a minimum:
+ * - signs are taken off and put back with masks
+ * - a product is built from four 64-bit by 64-bit multiplications into 256 bits
+ * - dividing that by 10^18 takes two steps of Moller and Granlund's division by
+ *   a precomputed reciprocal, three multiplications each, instead of a divide
+ *   instruction
+ * - a quotient takes two steps of schoolbook division by the two 64-bit words of
+ *   the divisor, whose estimates are corrected against the whole divisor
+ */
+
+#ifndef DECIMAL_H
+#define DECIMAL_H
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define DECIMAL_DIGITS 18
+#define DECIMAL_SCALE 1000000000000000000ULL
+// Most decimal digits a 128-bit integer always holds, and the largest one that another digit can be added to
+#define DECIMAL_MAX_DIGITS 38
+#define DECIMAL_MAX_MANTISSA ((~(unsigned __int128)0 - 9) / 10)
+
+typedef __int128 decimal;
+
+// Result of an overflow or a division by zero
+#define DECIMAL_INVALID ((decimal)((unsigned __int128)1 << 127))
+
+// DECIMAL_SCALE shifted up until its top bit is set, and Moller and Granlund's reciprocal of it,
+// floor((2^128 - 1) / divisor) - 2^64
+#define DECIMAL_SCALE_SHIFT 4
+#define DECIMAL_SCALE_NORMALISED (DECIMAL_SCALE << DECIMAL_SCALE_SHIFT)
+#define DECIMAL_SCALE_RECIPROCAL ((uint64_t)(~(unsigned __int128)0 / DECIMAL_SCALE_NORMALISED))
+
+static const uint64_t decimal_powers_of_ten[] = {1ULL,
+                                                 10ULL,
+                                                 100ULL,
+                                                 1000ULL,
+                                                 10000ULL,
+                                                 100000ULL,
+                                                 1000000ULL,
+                                                 10000000ULL,
+                                                 100000000ULL,
+                                                 1000000000ULL,
+                                                 10000000000ULL,
+                                                 100000000000ULL,
+                                                 1000000000000ULL,
+                                                 10000000000000ULL,
+                                                 100000000000000ULL,
+                                                 1000000000000000ULL,
+                                                 10000000000000000ULL,
+                                                 100000000000000000ULL,
+                                                 1000000000000000000ULL,
+                                                 10000000000000000000ULL};
+
+/* 10^k for k up to DECIMAL_MAX_DIGITS */
+static inline unsigned __int128 decimal_power_of_ten(int k)
+{
+    int low = k < 19 ? k : 19;
+    return (unsigned __int128)decimal_powers_of_ten[low] * decimal_powers_of_ten[k - low];
+}
+
+/* |x| as an unsigned integer */
+static inline unsigned __int128 decimal_magnitude(decimal x)
+{
+    unsigned __int128 mask = (unsigned __int128)(x >> 127);
+    return ((unsigned __int128)x ^ mask) - mask;
+}
+
+/* The magnitude with a sign, or DECIMAL_INVALID if invalid is set or it does not fit */
+static inline decimal decimal_signed(unsigned __int128 magnitude, bool negative, bool invalid)
+{
+    unsigned __int128 mask = -(unsigned __int128)negative;
+    decimal result = (decimal)((magnitude ^ mask) - mask);
+    return invalid || magnitude >> 127 ? DECIMAL_INVALID : result;
+}
+
+/* Round a quotient half to even, given its remainder and twice the remainder's limit */
+static inline unsigned __int128 decimal_round(unsigned __int128 quotient, unsigned __int128 twice_remainder,
+                                              unsigned __int128 divisor)
+{
+    return quotient + ((twice_remainder > divisor) | ((twice_remainder == divisor) & (unsigned)quotient & 1));
+}
+
+static inline decimal decimal_from_integer(long n)
+{
+    return (decimal)n * (decimal)DECIMAL_SCALE;
+}
+
+/* The nearest decimal, or DECIMAL_INVALID for NaN, infinities and numbers that are too large */
+static inline decimal decimal_from_double(double x)
+{
+    double scaled = nearbyint(x * 1e18);
+    return fabs(scaled) < 1.7e38 ? (decimal)scaled : DECIMAL_INVALID;
+}
+
+static inline double decimal_to_double(decimal x)
+{
+    return x == DECIMAL_INVALID ? NAN : (double)x / 1e18;
+}
+
+static inline decimal decimal_add(decimal a, decimal b)
+{
+    decimal sum;
+    bool overflow = __builtin_add_overflow(a, b, &sum);
+    return overflow | (a == DECIMAL_INVALID) | (b == DECIMAL_INVALID) ? DECIMAL_INVALID : sum;
+}
+
+static inline decimal decimal_subtract(decimal a, decimal b)
+{
+    decimal difference;
+    bool overflow = __builtin_sub_overflow(a, b, &difference);
+    return overflow | (a == DECIMAL_INVALID) | (b == DECIMAL_INVALID) ? DECIMAL_INVALID : difference;
+}
+
+/* -x, which leaves DECIMAL_INVALID as it is */
+static inline decimal decimal_negate(decimal x)
+{
+    return (decimal)(0 - (unsigned __int128)x);
+}
+
+static inline decimal decimal_abs(decimal x)
+{
+    return decimal_signed(decimal_magnitude(x), false, x == DECIMAL_INVALID);
+}
+
+/* The 256-bit product of a and b, in two halves */
+static inline void decimal_multiply_wide(unsigned __int128 a, unsigned __int128 b, unsigned __int128 *high,
+                                         unsigned __int128 *low)
+{
+    uint64_t a0 = (uint64_t)a;
+    uint64_t a1 = (uint64_t)(a >> 64);
+    uint64_t b0 = (uint64_t)b;
+    uint64_t b1 = (uint64_t)(b >> 64);
+    unsigned __int128 p00 = (unsigned __int128)a0 * b0;
+    unsigned __int128 p01 = (unsigned __int128)a0 * b1;
+    unsigned __int128 p10 = (unsigned __int128)a1 * b0;
+    // Three numbers below 2^64, so the middle column cannot overflow
+    unsigned __int128 middle = (p00 >> 64) + (uint64_t)p01 + (uint64_t)p10;
+    *low = (middle << 64) | (uint64_t)p00;
+    *high = (unsigned __int128)a1 * b1 + (p01 >> 64) + (p10 >> 64) + (middle >> 64);
+}
+
+/* Quotient of the 128-bit number high:low by the normalised DECIMAL_SCALE, for high below it,
+ * by Moller and Granlund's division by a precomputed reciprocal */
+static inline uint64_t decimal_divide_scale_step(uint64_t high, uint64_t low, uint64_t *remainder)
+{
+    const uint64_t divisor = DECIMAL_SCALE_NORMALISED;
+    unsigned __int128 estimate = (unsigned __int128)DECIMAL_SCALE_RECIPROCAL * high;
+    estimate += ((unsigned __int128)high << 64) | low;
+    uint64_t quotient = (uint64_t)(estimate >> 64) + 1;
+    uint64_t rest = low - quotient * divisor;
+    // The estimate is one too large at most once, and one too small rarely
+    uint64_t mask = -(uint64_t)(rest > (uint64_t)estimate);
+    quotient += mask;
+    rest += mask & divisor;
+    if (rest >= divisor)
+    {
+        quotient++;
+        rest -= divisor;
+    }
+    *remainder = rest;
+    return quotient;
+}
+
+static inline decimal decimal_multiply(decimal a, decimal b)
+{
+    unsigned __int128 high;
+    unsigned __int128 low;
+    decimal_multiply_wide(decimal_magnitude(a), decimal_magnitude(b), &high, &low);
+    // The product in units is the 256-bit one over 10^18, which only fits in 128 bits if high is below 10^18
+    bool invalid = (a == DECIMAL_INVALID) | (b == DECIMAL_INVALID) | (high >= DECIMAL_SCALE);
+    high = invalid ? 0 : high;
+
+    // Shift numerator and divisor alike, so that the divisor is normalised
+    uint64_t word2 = (uint64_t)(high << DECIMAL_SCALE_SHIFT | low >> (128 - DECIMAL_SCALE_SHIFT));
+    uint64_t word1 = (uint64_t)(low >> (64 - DECIMAL_SCALE_SHIFT));
+    uint64_t word0 = (uint64_t)low << DECIMAL_SCALE_SHIFT;
+    uint64_t remainder;
+    uint64_t quotient1 = decimal_divide_scale_step(word2, word1, &remainder);
+    uint64_t quotient0 = decimal_divide_scale_step(remainder, word0, &remainder);
+    unsigned __int128 quotient = ((unsigned __int128)quotient1 << 64) | quotient0;
+    quotient = decimal_round(quotient, (unsigned __int128)remainder >> (DECIMAL_SCALE_SHIFT - 1), DECIMAL_SCALE);
+    return decimal_signed(quotient, (a < 0) != (b < 0), invalid);
+}
+
+/* One word of the quotient of u2:u1:u0 by the normalised d1:d0, for u2:u1 below d1:d0. The
+ * estimate from the top words is corrected against d0 as well, which makes it exact */
+static inline uint64_t decimal_divide_step(uint64_t u2, uint64_t u1, uint64_t u0, uint64_t d1, uint64_t d0,
+                                           unsigned __int128 *remainder)
+{
+    unsigned __int128 top = ((unsigned __int128)u2 << 64) | u1;
+    unsigned __int128 estimate = u2 >= d1 ? (unsigned __int128)UINT64_MAX : top / d1;
+    unsigned __int128 rest = top - estimate * d1;
+    while (!(rest >> 64) && estimate * d0 > ((rest << 64) | u0))
+    {
+        estimate--;
+        rest += d1;
+    }
+    // The remainder is below the divisor, so the low 128 bits of the difference are all of it
+    unsigned __int128 divisor = ((unsigned __int128)d1 << 64) | d0;
+    *remainder = (((unsigned __int128)u1 << 64) | u0) - estimate * divisor;
+    return (uint64_t)estimate;
+}
+
+static inline decimal decimal_divide(decimal a, decimal b)
+{
+    unsigned __int128 dividend = decimal_magnitude(a);
+    unsigned __int128 divisor = decimal_magnitude(b);
+    bool invalid = (a == DECIMAL_INVALID) | (b == DECIMAL_INVALID) | (divisor == 0);
+    divisor = invalid ? 1 : divisor;
+
+    // The dividend in units of 10^-36 takes 187 bits, as 64-bit words n2:n1:n0
+    unsigned __int128 low = (unsigned __int128)(uint64_t)dividend * DECIMAL_SCALE;
+    unsigned __int128 high = (dividend >> 64) * DECIMAL_SCALE + (low >> 64);
+    uint64_t n2 = (uint64_t)(high >> 64);
+    uint64_t n1 = (uint64_t)high;
+    uint64_t n0 = (uint64_t)low;
+
+    unsigned __int128 quotient;
+    unsigned __int128 remainder;
+    if (!(divisor >> 64))
+    {
+        // A one-word divisor goes word by word, and the quotient only fits if n2 is below it
+        uint64_t d = (uint64_t)divisor;
+        invalid |= n2 >= d;
+        unsigned __int128 part = ((unsigned __int128)(invalid ? 0 : n2) << 64) | n1;
+        uint64_t quotient1 = (uint64_t)(part / d);
+        part = ((part - (unsigned __int128)quotient1 * d) << 64) | n0;
+        uint64_t quotient0 = (uint64_t)(part / d);
+        remainder = part - (unsigned __int128)quotient0 * d;
+        quotient = ((unsigned __int128)quotient1 << 64) | quotient0;
+    }
+    else
+    {
+        // Shift both until the top bit of the divisor is set, so that the estimates are close
+        int shift = __builtin_clzll((uint64_t)(divisor >> 64));
+        unsigned __int128 d = divisor << shift;
+        uint64_t n3 = shift ? n2 >> (64 - shift) : 0;
+        n2 = shift ? n2 << shift | n1 >> (64 - shift) : n2;
+        n1 = shift ? n1 << shift | n0 >> (64 - shift) : n1;
+        n0 <<= shift;
+        unsigned __int128 rest;
+        uint64_t quotient1 = decimal_divide_step(n3, n2, n1, (uint64_t)(d >> 64), (uint64_t)d, &rest);
+        uint64_t quotient0 =
+            decimal_divide_step((uint64_t)(rest >> 64), (uint64_t)rest, n0, (uint64_t)(d >> 64), (uint64_t)d, &rest);
+        remainder = rest >> shift;
+        quotient = ((unsigned __int128)quotient1 << 64) | quotient0;
+    }
+    // The remainder is below a divisor of at most 2^127, so twice it still fits
+    quotient = decimal_round(quotient, remainder << 1, divisor);
+    return decimal_signed(quotient, (a < 0) != (b < 0), invalid);
+}
+
+/* a ^ n for an integer n, by squaring, each product rounded */
+static inline decimal decimal_power_integer(decimal a, long n)
+{
+    unsigned long count = n < 0 ? -(unsigned long)n : (unsigned long)n;
+    decimal result = decimal_from_integer(1);
+    decimal square = a;
+    while (count > 0)
+    {
+        if (count & 1)
+        {
+            result = decimal_multiply(result, square);
+        }
+        count >>= 1;
+        if (count > 0)
+        {
+            square = decimal_multiply(square, square);
+        }
+    }
+    return n < 0 ? decimal_divide(decimal_from_integer(1), result) : result;
+}
+
+/* Whether x is a whole number, which *n is set to if it fits in a long */
+static inline bool decimal_integer(decimal x, long *n)
+{
+    if (x == DECIMAL_INVALID || x % (decimal)DECIMAL_SCALE != 0)
+    {
+        return false;
+    }
+    decimal whole = x / (decimal)DECIMAL_SCALE;
+    *n = (long)whole;
+    return whole == *n;
+}
+
+static inline decimal decimal_floor(decimal x)
+{
+    decimal fraction = x % (decimal)DECIMAL_SCALE;
+    decimal floor = x - fraction - (fraction < 0 ? (decimal)DECIMAL_SCALE : 0);
+    return x == DECIMAL_INVALID ? DECIMAL_INVALID : floor;
+}
+
+static inline decimal decimal_ceil(decimal x)
+{
+    return decimal_negate(decimal_floor(decimal_negate(x)));
+}
+
+static inline decimal decimal_min(decimal a, decimal b)
+{
+    return (a == DECIMAL_INVALID) | (b == DECIMAL_INVALID) ? DECIMAL_INVALID : a < b ? a : b;
+}
+
+static inline decimal decimal_max(decimal a, decimal b)
+{
+    return (a == DECIMAL_INVALID) | (b == DECIMAL_INVALID) ? DECIMAL_INVALID : a > b ? a : b;
+}
+
+/* Parse the literal at the start of the first length characters of text into *value, with the
+ * syntax of literal_parse: digits, an optional '.' followed by digits, and an optional exponent.
+ * The value is rounded to 18 decimals half to even, or DECIMAL_INVALID if it is too large.
+ * Returns the number of characters it takes up, or 0 if text does not start with a digit or
+ * a '.' followed by a digit */
+static inline int decimal_parse(const char *text, int length, decimal *value)
+{
+    // As many digits as fit in 128 bits, times 10^exponent. Of the digits after those, only the
+    // first and whether any other is not 0 matter, for rounding
+    unsigned __int128 mantissa = 0;
+    int exponent = 0;
+    int first_dropped = -1;
+    bool dropped = false;
+    bool fraction = false;
+    int i = 0;
+    for (;; i++)
+    {
+        if (!fraction && i + 1 < length && text[i] == '.' && (unsigned char)(text[i + 1] - '0') < 10)
+        {
+            fraction = true;
+            continue;
+        }
+        if (i >= length || (unsigned char)(text[i] - '0') >= 10)
+        {
+            break;
+        }
+        int digit = text[i] - '0';
+        if (mantissa <= DECIMAL_MAX_MANTISSA)
+        {
+            mantissa = mantissa * 10 + digit;
+            exponent -= fraction;
+        }
+        else
+        {
+            dropped |= first_dropped >= 0 && digit != 0;
+            first_dropped = first_dropped >= 0 ? first_dropped : digit;
+            exponent += !fraction;
+        }
+    }
+    if (i == 0)
+    {
+        return 0;
+    }
+
+    // The exponent part only counts if there is at least one digit in it
+    if (i + 1 < length && (text[i] == 'e' || text[i] == 'E'))
+    {
+        int j = i + 1;
+        bool negative = text[j] == '-';
+        if (text[j] == '-' || text[j] == '+')
+        {
+            j++;
+        }
+        if (j < length && (unsigned char)(text[j] - '0') < 10)
+        {
+            int power = 0;
+            for (; j < length && (unsigned char)(text[j] - '0') < 10; j++)
+            {
+                // Anything this large overflows or underflows anyway
+                if (power < 100000)
+                {
+                    power = power * 10 + (text[j] - '0');
+                }
+            }
+            exponent += negative ? -power : power;
+            i = j;
+        }
+    }
+
+    // Units of 10^-18: the mantissa is scaled up, or divided and rounded. Dropped digits can only
+    // be right below the units when it is not scaled at all, and break a tie upwards otherwise
+    int shift = exponent + DECIMAL_DIGITS;
+    int rest = first_dropped > 0 || dropped;
+    unsigned __int128 units = 0;
+    bool invalid = false;
+    if (mantissa == 0)
+    {
+        units = 0;
+    }
+    else if (shift == 0)
+    {
+        units = decimal_round(mantissa, first_dropped < 0 ? 0 : 2 * first_dropped + dropped, 10);
+    }
+    else if (shift > 0)
+    {
+        invalid = shift > DECIMAL_MAX_DIGITS || __builtin_mul_overflow(mantissa, decimal_power_of_ten(shift), &units);
+    }
+    else if (shift >= -DECIMAL_MAX_DIGITS)
+    {
+        unsigned __int128 divisor = decimal_power_of_ten(-shift);
+        units = mantissa / divisor;
+        units = decimal_round(units, (mantissa - units * divisor) * 2 + rest, divisor);
+    }
+    *value = decimal_signed(units, false, invalid);
+    return i;
+}
+
+/* Write x rounded half to even to the given number of decimals (at most 18) into buffer, as
+ * snprintf does with "%.*f", and "nan" for DECIMAL_INVALID. Returns the length */
+static inline int decimal_format(char *buffer, int size, decimal x, int decimals)
+{
+    if (x == DECIMAL_INVALID)
+    {
+        return snprintf(buffer, size, "nan");
+    }
+    unsigned __int128 unit = decimal_power_of_ten(DECIMAL_DIGITS - decimals);
+    unsigned __int128 magnitude = decimal_magnitude(x);
+    unsigned __int128 shown = magnitude / unit;
+    shown = decimal_round(shown, (magnitude - shown * unit) * 2, unit);
+
+    // All digits, with at least one before the point
+    char digits[64];
+    uint64_t top = (uint64_t)(shown / decimal_powers_of_ten[19]);
+    uint64_t bottom = (uint64_t)(shown % decimal_powers_of_ten[19]);
+    int count = top ? snprintf(digits, sizeof(digits), "%llu%019llu", (unsigned long long)top,
+                               (unsigned long long)bottom)
+                    : snprintf(digits, sizeof(digits), "%0*llu", decimals + 1, (unsigned long long)bottom);
+    int whole = count - decimals;
+    return snprintf(buffer, size, "%s%.*s%s%s", x < 0 ? "-" : "", whole, digits, decimals > 0 ? "." : "",
+                    digits + whole);
+}
+
+#endif
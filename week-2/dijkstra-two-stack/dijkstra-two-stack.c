@@ -1,24 +1,83 @@
-/* Dijkstra's two stack algorithm using a generic stack macro 
- * Allows for multiplication, division, addition, and subtraction of floats
+/* Calculator for mathematical expressions, named after Dijkstra's two stack algorithm it started out with
+ * Allows for multiplication, division, addition, subtraction, powers (^) and unary minus of floats,
+ * and calls of functions such as sqrt(x) and max(a, b)
+ * Usage: ./dijkstra-two-stack for interactive use, or
+ *        ./dijkstra-two-stack --batch [file] [threads] to evaluate a file (or stdin) with one expression per line
+ *        ./dijkstra-two-stack --stream [file] to do the same while reading, for pipes and expressions of any length
+ * --stream and interactive use evaluate in exact decimal when built with -DNUMBER_DECIMAL, and with double-double
+ * precision when built with -DNUMBER_DOUBLE_DOUBLE (see number.h and the Makefile). --batch only evaluates in double,
+ * so those builds refuse it
  */
 
-#include <assert.h>
-#include <ctype.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
-#include "stack.h"
+#include "batch.h"
+#include "expression-stream.h"
+#include "two-stack.h"
 
-DEFINE_STACK_TYPE(double, numeric);
-DEFINE_STACK_TYPE(char, character);
+int run_batch(const char *path, int threads)
+{
+#if defined(NUMBER_DECIMAL) || defined(NUMBER_DOUBLE_DOUBLE)
+    (void)path;
+    (void)threads;
+    fprintf(stderr, "--batch only evaluates in double, use --stream with this build\n");
+    return 1;
+#else
+    batch_input input;
+    if (!batch_input_open(&input, path))
+    {
+        fprintf(stderr, "Cannot read %s\n", path ? path : "stdin");
+        return 1;
+    }
 
-double get_solution(char *operation);
-double do_operation(double a, double b, char operator);
-// void evaluate_previous(int n, numeric_stack *value_stack, character_stack *operator_stack, bool includes_last);
+    long errors = batch_evaluate(input.text, input.length, threads, stdout, stderr);
+    batch_input_close(&input);
+    return errors > 0 ? 1 : 0;
+#endif
+}
 
-int main(void)
+int run_stream(const char *path)
 {
+    bool from_stdin = !path || strcmp(path, "-") == 0;
+    int fd = from_stdin ? STDIN_FILENO : open(path, O_RDONLY);
+    long errors = fd < 0 ? -1 : expression_stream_evaluate_lines(fd, stdout, stderr);
+    if (fd >= 0 && !from_stdin)
+    {
+        close(fd);
+    }
+    if (errors < 0)
+    {
+        fprintf(stderr, "Cannot read %s\n", path ? path : "stdin");
+        return 1;
+    }
+    return errors > 0 ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "--batch") == 0)
+    {
+        int threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (argc > 3)
+        {
+            threads = atoi(argv[3]);
+        }
+        if (threads < 1 || threads > BATCH_MAX_THREADS)
+        {
+            threads = threads < 1 ? 1 : BATCH_MAX_THREADS;
+        }
+        return run_batch(argc > 2 ? argv[2] : NULL, threads);
+    }
+    if (argc > 1 && strcmp(argv[1], "--stream") == 0)
+    {
+        return run_stream(argc > 2 ? argv[2] : NULL);
+    }
+
     // Input buffer
     char buffer[1024];
 
@@ -38,229 +97,19 @@ int main(void)
             break;
         }
 
-        // Get solution
-        double solution = get_solution(buffer);
-        printf("Solution: %.10lf\n", solution);
-    }
-
-    return 0;
-}
-
-double get_solution(char *operation)
-{
-    // Character parsing variables
-    int length = strlen(operation);
-    int bracket_depth = 0;
-    double current_value = 0.0;
-    bool previous_is_digit = false;
-    bool previous_is_dot = false;
-    int decimal_divider = 0;
-
-    // Math operation variables
-    double p;
-    double q;
-    double r;
-    char operator;
-    char next_operator;
-    double sub_solution;
-
-    // Create value and operator stacks
-    numeric_stack *value_stack = stack_numeric_create();
-    character_stack *operator_stack = stack_character_create();
-
-    char c;
-
-    for (int i = 0; i < length; i++)
-    {
-        c = operation[i];
-
-        if (c == ' ')
+        // Get solution, as a number of number.h
+        expression_stream *stream = expression_stream_default();
+        number solution;
+        if (!expression_stream_calculate(stream, buffer, strlen(buffer), &solution))
         {
-            assert(!previous_is_dot);
-            previous_is_digit = false;
-            previous_is_dot = false;
-            decimal_divider = 0;
+            printf("Warning: invalid input at column %li (%s), results not reliable\n", stream->error_position + 1,
+                   stream->message);
+            solution = number_from_double(0.0);
         }
-        else if (c == '(')
-        {
-            assert(!previous_is_dot);
-            stack_character_push(operator_stack, c);
-            bracket_depth++;
-            previous_is_digit = false;
-            previous_is_dot = false;
-            decimal_divider = 0;
-        }
-        else if (c == ')')
-        {
-            assert(!(bracket_depth == 0));
-            assert(!previous_is_dot);
-            bracket_depth--;
-
-            while (true)
-            {
-                operator= stack_character_pop(operator_stack);
-
-                // if (operator== '^')
-                // {
-                //     p = stack_numeric_pop(value_stack);
-                //     q = stack_numeric_pop(value_stack);
-                //     sub_solution = do_operation(q, p, operator);
-                //     stack_numeric_push(value_stack, sub_solution);
-                // }
-                if (operator== '*' || operator== '/')
-                {
-                    p = stack_numeric_pop(value_stack);
-                    q = stack_numeric_pop(value_stack);
-                    sub_solution = do_operation(q, p, operator);
-                    stack_numeric_push(value_stack, sub_solution);
-                }
-                else if (operator== '+' || operator== '-')
-                {
-                    p = stack_numeric_pop(value_stack);
-                    q = stack_numeric_pop(value_stack);
-                    next_operator = stack_character_pop(operator_stack);
-                    if (next_operator == '*' || next_operator == '/')
-                    {
-                        r = stack_numeric_pop(value_stack);
-                        sub_solution = do_operation(r, q, next_operator);
-                        stack_numeric_push(value_stack, sub_solution);
-                        stack_numeric_push(value_stack, p);
-                        stack_character_push(operator_stack, operator);
-                    }
-                    else if (next_operator == '+' || next_operator == '-' || next_operator == '(')
-                    {
-                        stack_character_push(operator_stack, next_operator);
-                        sub_solution = do_operation(q, p, operator);
-                        stack_numeric_push(value_stack, sub_solution);
-                    }
-                }
-                else if (operator== '(')
-                {
-                    break;
-                }
-
-                previous_is_digit = false;
-                previous_is_dot = false;
-                decimal_divider = 0;
-            }
-        }
-        else if (c == '+' || c == '-' || c == '*' || c == '/')
-        {
-            assert(!previous_is_dot);
-            stack_character_push(operator_stack, c);
-            previous_is_digit = false;
-        }
-        else if (isdigit(c))
-        {
-            if (previous_is_dot || decimal_divider > 0)
-            {
-                current_value += ((double)(c - '0')) / decimal_divider;
-                decimal_divider *= 10;
-            }
-            else
-            {
-                if (previous_is_digit)
-                {
-                    current_value *= 10;
-                }
-                current_value += (double)(c - '0');
-            }
-
-            if ((i + 1 == length) || (!isdigit(operation[i + 1]) && !(operation[i + 1] == '.')))
-            {
-                stack_numeric_push(value_stack, current_value);
-                current_value = 0.0;
-                decimal_divider = 0;
-            }
-
-            previous_is_digit = true;
-            previous_is_dot = false;
-        }
-        else if (c == '.')
-        {
-            assert(decimal_divider == 0);
-            assert(isdigit(operation[i + 1]));
-
-            previous_is_digit = false;
-            previous_is_dot = true;
-            decimal_divider = 10;
-        }
-        else
-        {
-            printf("Warning: invalid input, results not reliable\n");
-            return 0;
-        }
-    }
-
-    assert(bracket_depth == 0);
-
-    while (operator_stack->size != 0 && value_stack->size != 1)
-    {
-        operator= stack_character_pop(operator_stack);
-
-        if (operator== '*' || operator== '/' || operator_stack->size == 0)
-        {
-            p = stack_numeric_pop(value_stack);
-            q = stack_numeric_pop(value_stack);
-            sub_solution = do_operation(q, p, operator);
-            stack_numeric_push(value_stack, sub_solution);
-        }
-        else if (operator== '+' || operator== '-')
-        {
-            p = stack_numeric_pop(value_stack);
-            q = stack_numeric_pop(value_stack);
-            next_operator = stack_character_pop(operator_stack);
-            if (next_operator == '*' || next_operator == '/')
-            {
-                r = stack_numeric_pop(value_stack);
-                sub_solution = do_operation(r, q, next_operator);
-                stack_numeric_push(value_stack, sub_solution);
-                stack_numeric_push(value_stack, p);
-                stack_character_push(operator_stack, operator);
-            }
-            else if (next_operator == '+' || next_operator == '-')
-            {
-                stack_character_push(operator_stack, next_operator);
-                sub_solution = do_operation(q, p, operator);
-                stack_numeric_push(value_stack, sub_solution);
-            }
-        }
-    }
-    double solution = stack_numeric_pop(value_stack);
-    stack_numeric_free(value_stack);
-    stack_character_free(operator_stack);
-
-    return solution;
-}
-
-double do_operation(double a, double b, char operator)
-{
-    double solution = 0.0;
-
-    if (operator== '+')
-    {
-        solution = a + b;
+        char text[NUMBER_MAX_FORMAT];
+        number_format(text, sizeof(text), solution);
+        printf("Solution: %s\n", text);
     }
-    else if (operator== '-')
-    {
-        solution = a - b;
-    }
-    else if (operator== '*')
-    {
-        solution = a * b;
-    }
-    else if (operator== '/')
-    {
-        solution = a / b;
-    }
-    // else if (operator== '^')
-    // {
-    //     solution == a;
-    //     for (int i = 0; i < (b - 1); i++)
-    //     {
-    //         solution *= a;
-    //     }
-    // }
 
-    return solution;
+    return 0;
 }
\ No newline at end of file
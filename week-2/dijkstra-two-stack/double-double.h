@@ -0,0 +1,410 @@
+/* DOUBLE-DOUBLE numbers, with about 106 bits of precision
+ * A double_double is the unevaluated sum hi + lo of two doubles, with lo at most
+ * half an ulp of hi, so it carries about 32 significant decimal digits instead of
+ * 16, over the range of a double. Everything is built on two error-free
+ * transformations, neither of which branches:
+ * - two_sum gives the rounding error of an addition exactly, in 6 flops
+ * - two_prod gives that of a multiplication, in one fused multiply-add on
+ *   machines with fast FMA (__FP_FAST_FMA, e.g. with -march=native), and with
+ *   Dekker's splitting in 17 flops otherwise
+ * Addition, multiplication, division and square roots are the accurate versions
+ * of Hida, Li and Bailey's QD library, with a relative error of a few units of
+ * 2^-106. A result that overflows keeps its infinite hi, with a lo of 0.
+ */
+
+#ifndef DOUBLE_DOUBLE_H
+#define DOUBLE_DOUBLE_H
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// 10^k for k up to this is exactly a double_double
+#define DOUBLE_DOUBLE_MAX_EXACT_POWER 45
+// Digits gathered into one 64-bit integer when parsing
+#define DOUBLE_DOUBLE_CHUNK_DIGITS 19
+
+// Powers of ten that are exactly doubles
+static const double double_double_powers_of_ten[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                                     1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                                     1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+typedef struct double_double
+{
+    double hi;
+    double lo;
+} double_double;
+
+static inline double_double double_double_from_double(double x)
+{
+    return (double_double){x, 0.0};
+}
+
+static inline double double_double_to_double(double_double x)
+{
+    return x.hi + x.lo;
+}
+
+/* a + b and its rounding error, for |a| >= |b| */
+static inline double_double double_double_quick_two_sum(double a, double b)
+{
+    double sum = a + b;
+    return (double_double){sum, b - (sum - a)};
+}
+
+/* a + b and its rounding error, whatever their sizes */
+static inline double_double double_double_two_sum(double a, double b)
+{
+    double sum = a + b;
+    double b_part = sum - a;
+    return (double_double){sum, (a - (sum - b_part)) + (b - b_part)};
+}
+
+#ifndef __FP_FAST_FMA
+/* Split a into a high and a low half of 26 bits each. Past 2^996 the splitter would overflow,
+ * so a is split scaled down by 2^28, which is exact */
+static inline void double_double_split(double a, double *high, double *low)
+{
+    const double splitter = 134217729.0;
+    double scale = fabs(a) > 0x1p996 ? 0x1p-28 : 1.0;
+    double scaled = a * scale;
+    double product = splitter * scaled;
+    *high = (product - (product - scaled)) / scale;
+    *low = a - *high;
+}
+#endif
+
+/* a * b and its rounding error */
+static inline double_double double_double_two_prod(double a, double b)
+{
+    double product = a * b;
+#ifdef __FP_FAST_FMA
+    return (double_double){product, fma(a, b, -product)};
+#else
+    // Dekker: split both into halves of 26 bits, whose products are exact
+    double a_high;
+    double a_low;
+    double b_high;
+    double b_low;
+    double_double_split(a, &a_high, &a_low);
+    double_double_split(b, &b_high, &b_low);
+    return (double_double){product, ((a_high * b_high - product) + a_high * b_low + a_low * b_high) + a_low * b_low};
+#endif
+}
+
+/* hi + lo normalised, with lo dropped if hi overflowed. An infinite hi has to be caught before
+ * normalising, since its rounding error comes out as an infinity of the other sign */
+static inline double_double double_double_finish(double hi, double lo)
+{
+    if (!isfinite(hi))
+    {
+        return double_double_from_double(hi);
+    }
+    double_double result = double_double_quick_two_sum(hi, lo);
+    result.lo = isfinite(result.hi) ? result.lo : 0.0;
+    return result;
+}
+
+static inline double_double double_double_add(double_double a, double_double b)
+{
+    double_double high = double_double_two_sum(a.hi, b.hi);
+    if (!isfinite(high.hi))
+    {
+        return double_double_from_double(high.hi);
+    }
+    double_double low = double_double_two_sum(a.lo, b.lo);
+    high = double_double_quick_two_sum(high.hi, high.lo + low.hi);
+    return double_double_finish(high.hi, high.lo + low.lo);
+}
+
+static inline double_double double_double_add_double(double_double a, double b)
+{
+    double_double sum = double_double_two_sum(a.hi, b);
+    if (!isfinite(sum.hi))
+    {
+        return double_double_from_double(sum.hi);
+    }
+    return double_double_finish(sum.hi, sum.lo + a.lo);
+}
+
+static inline double_double double_double_negate(double_double x)
+{
+    return (double_double){-x.hi, -x.lo};
+}
+
+static inline double_double double_double_subtract(double_double a, double_double b)
+{
+    return double_double_add(a, double_double_negate(b));
+}
+
+static inline double_double double_double_multiply(double_double a, double_double b)
+{
+    double_double product = double_double_two_prod(a.hi, b.hi);
+    return double_double_finish(product.hi, product.lo + (a.hi * b.lo + a.lo * b.hi));
+}
+
+static inline double_double double_double_multiply_double(double_double a, double b)
+{
+    double_double product = double_double_two_prod(a.hi, b);
+    return double_double_finish(product.hi, product.lo + a.lo * b);
+}
+
+/* Three quotients of doubles, each of what the ones before left over */
+static inline double_double double_double_divide(double_double a, double_double b)
+{
+    double first = a.hi / b.hi;
+    if (!isfinite(first) || first == 0.0)
+    {
+        return double_double_from_double(first);
+    }
+    double_double rest = double_double_subtract(a, double_double_multiply_double(b, first));
+    double second = rest.hi / b.hi;
+    rest = double_double_subtract(rest, double_double_multiply_double(b, second));
+    double third = rest.hi / b.hi;
+    double_double quotient = double_double_quick_two_sum(first, second);
+    return double_double_add_double(quotient, third);
+}
+
+/* Karp and Markstein: one Newton step from the square root of hi */
+static inline double_double double_double_sqrt(double_double x)
+{
+    if (x.hi <= 0.0 || !isfinite(x.hi))
+    {
+        return double_double_from_double(sqrt(x.hi));
+    }
+    double inverse = 1.0 / sqrt(x.hi);
+    double root = x.hi * inverse;
+    double_double square = double_double_two_prod(root, root);
+    double correction = double_double_subtract(x, square).hi * (inverse * 0.5);
+    return double_double_two_sum(root, correction);
+}
+
+static inline double_double double_double_abs(double_double x)
+{
+    return x.hi < 0.0 ? double_double_negate(x) : x;
+}
+
+static inline double_double double_double_floor(double_double x)
+{
+    double hi = floor(x.hi);
+    // Only a whole, finite hi leaves anything to lo
+    return hi == x.hi && isfinite(hi) ? double_double_quick_two_sum(hi, floor(x.lo)) : double_double_from_double(hi);
+}
+
+static inline double_double double_double_ceil(double_double x)
+{
+    return double_double_negate(double_double_floor(double_double_negate(x)));
+}
+
+static inline double_double double_double_min(double_double a, double_double b)
+{
+    return a.hi < b.hi || (a.hi == b.hi && a.lo < b.lo) ? a : b;
+}
+
+static inline double_double double_double_max(double_double a, double_double b)
+{
+    return a.hi > b.hi || (a.hi == b.hi && a.lo > b.lo) ? a : b;
+}
+
+/* Whether x is a whole number, which *n is set to if it fits in a long */
+static inline bool double_double_integer(double_double x, long *n)
+{
+    if (!(fabs(x.hi) < 9e18) || floor(x.hi) != x.hi || floor(x.lo) != x.lo)
+    {
+        return false;
+    }
+    *n = (long)x.hi + (long)x.lo;
+    return true;
+}
+
+/* a ^ n for an integer n, by squaring */
+static inline double_double double_double_power_integer(double_double a, long n)
+{
+    unsigned long count = n < 0 ? -(unsigned long)n : (unsigned long)n;
+    double_double result = double_double_from_double(1.0);
+    double_double square = a;
+    while (count > 0)
+    {
+        if (count & 1)
+        {
+            result = double_double_multiply(result, square);
+        }
+        count >>= 1;
+        if (count > 0)
+        {
+            square = double_double_multiply(square, square);
+        }
+    }
+    return n < 0 ? double_double_divide(double_double_from_double(1.0), result) : result;
+}
+
+/* An integer below 2^106, exactly: hi takes the top 53 bits and lo the rest */
+static inline double_double double_double_from_integer(unsigned __int128 n)
+{
+    double hi = (double)n;
+    __int128 rest = (__int128)(n - (unsigned __int128)hi);
+    return (double_double){hi, (double)rest};
+}
+
+/* A 64-bit integer exactly, without going through 128 bits */
+static inline double_double double_double_from_uint64(uint64_t n)
+{
+    double hi = (double)n;
+    // hi may be rounded up to 2^64, which does not fit back, and then n falls short of it by -n
+    int64_t rest = hi < 18446744073709551616.0 ? (int64_t)(n - (uint64_t)hi) : -(int64_t)(0 - n);
+    return (double_double){hi, (double)rest};
+}
+
+/* 10^k, exact for k up to DOUBLE_DOUBLE_MAX_EXACT_POWER, where 5^k has at most 105 bits */
+static inline double_double double_double_power_of_ten(int k)
+{
+    if (k <= 22)
+    {
+        return double_double_from_double(double_double_powers_of_ten[k]);
+    }
+    static const uint64_t five_to_the_27 = 7450580596923828125ULL;
+    double_double power = double_double_from_double(1.0);
+    for (; k > DOUBLE_DOUBLE_MAX_EXACT_POWER; k -= DOUBLE_DOUBLE_MAX_EXACT_POWER)
+    {
+        power = double_double_multiply(power, double_double_power_of_ten(DOUBLE_DOUBLE_MAX_EXACT_POWER));
+    }
+    unsigned __int128 five = k >= 27 ? five_to_the_27 : 1;
+    for (int i = 0; i < k % 27; i++)
+    {
+        five *= 5;
+    }
+    double_double exact = double_double_from_integer(five);
+    exact.hi = ldexp(exact.hi, k);
+    exact.lo = ldexp(exact.lo, k);
+    return double_double_multiply(power, exact);
+}
+
+/* Parse the literal at the start of the first length characters of text into *value, with the
+ * syntax of literal_parse: digits, an optional '.' followed by digits, and an optional exponent.
+ * Up to 19 significant digits are exact; longer ones are put together 19 at a time. Returns the
+ * number of characters it takes up, or 0 if text does not start with a digit or a '.' followed
+ * by a digit */
+static inline int double_double_parse(const char *text, int length, double_double *value)
+{
+    // The value is (whole * 10^digits + chunk) * 10^exponent
+    double_double whole = double_double_from_double(0.0);
+    uint64_t chunk = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool fraction = false;
+    int i = 0;
+    for (;; i++)
+    {
+        if (!fraction && i + 1 < length && text[i] == '.' && (unsigned char)(text[i + 1] - '0') < 10)
+        {
+            fraction = true;
+            continue;
+        }
+        if (i >= length || (unsigned char)(text[i] - '0') >= 10)
+        {
+            break;
+        }
+        if (digits == DOUBLE_DOUBLE_CHUNK_DIGITS)
+        {
+            whole = double_double_add(double_double_multiply(whole, double_double_power_of_ten(digits)),
+                                      double_double_from_uint64(chunk));
+            chunk = 0;
+            digits = 0;
+        }
+        chunk = chunk * 10 + (text[i] - '0');
+        // Leading zeros are not significant
+        digits += chunk != 0 || whole.hi != 0.0;
+        exponent -= fraction;
+    }
+    if (i == 0)
+    {
+        return 0;
+    }
+
+    // The exponent part only counts if there is at least one digit in it
+    if (i + 1 < length && (text[i] == 'e' || text[i] == 'E'))
+    {
+        int j = i + 1;
+        bool negative = text[j] == '-';
+        if (text[j] == '-' || text[j] == '+')
+        {
+            j++;
+        }
+        if (j < length && (unsigned char)(text[j] - '0') < 10)
+        {
+            int power = 0;
+            for (; j < length && (unsigned char)(text[j] - '0') < 10; j++)
+            {
+                // Anything this large overflows or underflows anyway
+                if (power < 100000)
+                {
+                    power = power * 10 + (text[j] - '0');
+                }
+            }
+            exponent += negative ? -power : power;
+            i = j;
+        }
+    }
+
+    double_double mantissa = double_double_add(double_double_multiply(whole, double_double_power_of_ten(digits)),
+                                               double_double_from_uint64(chunk));
+    if (exponent > 0)
+    {
+        *value = double_double_multiply(mantissa, double_double_power_of_ten(exponent > 400 ? 400 : exponent));
+    }
+    else if (exponent < 0)
+    {
+        // Past 10^300 the power itself would overflow, so it is divided by in two steps
+        int first = -exponent > 300 ? 300 : -exponent;
+        int second = -exponent - first > 400 ? 400 : -exponent - first;
+        mantissa = double_double_divide(mantissa, double_double_power_of_ten(first));
+        *value = second > 0 ? double_double_divide(mantissa, double_double_power_of_ten(second)) : mantissa;
+    }
+    else
+    {
+        *value = mantissa;
+    }
+    return i;
+}
+
+/* Write x rounded to the given number of decimals (at most 15) into buffer, as snprintf does
+ * with "%.*f", but with every digit right up to 10^30. Returns the length */
+static inline int double_double_format(char *buffer, int size, double_double x, int decimals)
+{
+    if (!(fabs(x.hi) < 1e30))
+    {
+        return snprintf(buffer, size, "%.*f", decimals, double_double_to_double(x));
+    }
+    bool negative = signbit(x.hi);
+    x = negative ? double_double_negate(x) : x;
+
+    // hi less its whole part is exact, and so is adding lo to that as a double_double
+    double whole_high = floor(x.hi);
+    double_double fraction = double_double_two_sum(x.hi - whole_high, x.lo);
+    double carry = floor(fraction.hi);
+    fraction = double_double_add_double(fraction, -carry);
+    double scale = pow(10, decimals);
+    double shown = nearbyint(double_double_to_double(double_double_multiply_double(fraction, scale)));
+    carry += shown >= scale;
+    shown = shown >= scale ? shown - scale : shown;
+    unsigned __int128 whole = (unsigned __int128)whole_high + (__int128)carry;
+
+    char digits[64];
+    uint64_t top = (uint64_t)(whole / 10000000000000000000ULL);
+    uint64_t bottom = (uint64_t)(whole % 10000000000000000000ULL);
+    if (top)
+    {
+        snprintf(digits, sizeof(digits), "%llu%019llu", (unsigned long long)top, (unsigned long long)bottom);
+    }
+    else
+    {
+        snprintf(digits, sizeof(digits), "%llu", (unsigned long long)bottom);
+    }
+    if (decimals == 0)
+    {
+        return snprintf(buffer, size, "%s%s", negative ? "-" : "", digits);
+    }
+    return snprintf(buffer, size, "%s%s.%0*.0f", negative ? "-" : "", digits, decimals, shown);
+}
+
+#endif
@@ -0,0 +1,288 @@
+/* Compares evaluating expressions with get_solution, which parses the text every
+ * time, against compiling them once with expression_compile and running the
+ * bytecode. The first test evaluates constant expressions, the second a formula
+ * with variables, which get_solution only sees after the values have been
+ * printed into its text. The third evaluates that formula over columns of values,
+ * row by row and with expression_evaluate_columns, which must agree bit for bit
+ * unless built with -DEXPRESSION_FAST_COLUMNS. The last compares a formula with
+ * constant and repeated parts before and after expression_optimize, which must
+ * also agree bit for bit. The cached test looks the constant expressions up in an
+ * expression cache, written with and without spaces, so after the first few
+ * lookups every one is a hit. The streamed test feeds them to expression_stream_feed
+ * in pieces of a few characters, and must agree with get_solution bit for bit.
+ * Every other result is checked against get_solution.
+ * Usage: ./expression-benchmark [n]
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "expression-cache.h"
+#include "expression-columns.h"
+#include "expression-optimize.h"
+#include "expression-stream.h"
+#include "expression.h"
+#include "two-stack.h"
+
+static const char *constant_expressions[] = {
+    "( 1 + ( 2 * 3 ) )",
+    "( ( 1.5 + 2.25 ) * ( 3 - 4.75 ) )",
+    "( ( ( 10 / 4 ) - 0.5 ) * ( 7 + ( 8 / 16 ) ) )",
+    "( 123.456 * ( 789 - ( 12.5 / ( 3 + 0.25 ) ) ) )",
+    "2 ^ 3 ^ 0.5 - -1.5 * sqrt( 16 ) / max( 2, 4 ) + 1",
+};
+// The same expressions as a client might send them, to be found in the cache
+static const char *respaced_expressions[] = {
+    "(1+(2*3))",
+    "((1.5 + 2.25) * (3 - 4.75))",
+    " ( ( ( 10/4 ) - 0.5 )*( 7+( 8/16 ) ) ) ",
+    "(123.456*(789-(12.5/(3+0.25))))",
+    "2^3^0.5--1.5*sqrt(16)/max(2,4)+1",
+};
+
+// The same formula with the variables in place, and with their values printed in
+static const char *formula = "( ( ( x * x ) + ( 3 * y ) ) / ( z - 1.5 ) )";
+static const char *formula_format = "( ( ( %.6f * %.6f ) + ( 3 * %.6f ) ) / ( %.6f - 1.5 ) )";
+// As written by a generator: a constant part, a repeated part and a division by a power of two
+static const char *generated = "(x * 2.5 + 1) / (x * 2.5 - 1) + (2 * 3 - 1) * y / 4 - z / (x * 2.5 + 1)";
+
+double seconds_since(struct timespec start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+// The formula's values are printed into get_solution's text with 6 decimals, so they differ in the last bits
+bool close_enough(double a, double b)
+{
+    return fabs(a - b) <= 1e-9 * fmax(1.0, fabs(b));
+}
+
+int main(int argc, char *argv[])
+{
+    int n = 1000000;
+    if (argc > 1)
+    {
+        n = atoi(argv[1]);
+    }
+    if (n < 1)
+    {
+        printf("Usage: ./expression-benchmark [n], with n >= 1\n");
+        return 1;
+    }
+
+    int count = sizeof(constant_expressions) / sizeof(*constant_expressions);
+    expression compiled[sizeof(constant_expressions) / sizeof(*constant_expressions)];
+    double expected[sizeof(constant_expressions) / sizeof(*constant_expressions)];
+    char buffer[1024];
+    for (int i = 0; i < count; i++)
+    {
+        expression_error error;
+        bool valid = expression_compile(&compiled[i], constant_expressions[i], &error);
+        assert(valid);
+        strcpy(buffer, constant_expressions[i]);
+        expected[i] = get_solution(buffer);
+        assert(close_enough(expression_evaluate(&compiled[i], NULL), expected[i]));
+    }
+
+    printf("n = %i, ns/evaluation\n", n);
+    printf("%-10s %14s %14s\n", "test", "get_solution", "compiled");
+
+    struct timespec start;
+    double sum = 0.0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < n; i++)
+    {
+        strcpy(buffer, constant_expressions[i % count]);
+        sum += get_solution(buffer);
+    }
+    double parsed = seconds_since(start);
+
+    double compiled_sum = 0.0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < n; i++)
+    {
+        compiled_sum += expression_evaluate(&compiled[i % count], NULL);
+    }
+    double evaluated = seconds_since(start);
+    assert(close_enough(compiled_sum, sum));
+    printf("%-10s %14.2f %14.2f\n", "constants", parsed * 1e9 / n, evaluated * 1e9 / n);
+
+    expression_cache cache;
+    expression_cache_init(&cache, 64);
+    compiled_sum = 0.0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < n; i++)
+    {
+        const char *text = i % 2 ? respaced_expressions[i / 2 % count] : constant_expressions[i / 2 % count];
+        const expression_cache_entry *entry = expression_cache_get(&cache, text, strlen(text));
+        assert(entry->constant);
+        compiled_sum += entry->value;
+    }
+    evaluated = seconds_since(start);
+    // Both lists are visited half of the time each, in the same order as before
+    assert(n % (2 * count) != 0 || close_enough(compiled_sum, sum));
+    assert(cache.misses == count);
+    printf("%-10s %14.2f %14.2f   (%li hits, %li misses)\n", "cached", parsed * 1e9 / n, evaluated * 1e9 / n,
+           cache.hits, cache.misses);
+    expression_cache_free(&cache);
+
+    // Fed in pieces that cut numbers in two, as a pipe may
+    const int piece = 5;
+    expression_stream stream;
+    expression_stream_init(&stream);
+    compiled_sum = 0.0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < n; i++)
+    {
+        const char *text = constant_expressions[i % count];
+        int length = strlen(text);
+        int used = 0;
+        for (int end = piece; used < length; end += piece)
+        {
+            end = end < length ? end : length;
+            used += expression_stream_feed(&stream, text + used, end - used, end == length);
+        }
+        double value;
+        bool valid = expression_stream_finish(&stream, &value);
+        assert(valid && memcmp(&value, &expected[i % count], sizeof(value)) == 0);
+        compiled_sum += value;
+        expression_stream_reset(&stream);
+    }
+    evaluated = seconds_since(start);
+    assert(close_enough(compiled_sum, sum));
+    printf("%-10s %14.2f %14.2f   (pieces of %i characters)\n", "streamed", parsed * 1e9 / n, evaluated * 1e9 / n,
+           piece);
+    expression_stream_free(&stream);
+
+    expression compiled_formula;
+    bool valid = expression_compile(&compiled_formula, formula, NULL);
+    assert(valid);
+    int x = expression_variable(&compiled_formula, "x");
+    int y = expression_variable(&compiled_formula, "y");
+    int z = expression_variable(&compiled_formula, "z");
+    assert(x >= 0 && y >= 0 && z >= 0 && compiled_formula.variable_count == 3);
+
+    // Values with 6 decimals, so both sides see exactly the same numbers
+    double *values = malloc(3 * n * sizeof(*values));
+    assert(values);
+    srand(time(NULL));
+    for (int i = 0; i < 3 * n; i++)
+    {
+        values[i] = (rand() % 10000000) / 1e6;
+    }
+
+    sum = 0.0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < n; i++)
+    {
+        snprintf(buffer, sizeof(buffer), formula_format, values[3 * i], values[3 * i], values[3 * i + 1],
+                 values[3 * i + 2]);
+        double solution = get_solution(buffer);
+        // z - 1.5 can come out as zero
+        sum += isfinite(solution) ? solution : 0.0;
+    }
+    parsed = seconds_since(start);
+
+    compiled_sum = 0.0;
+    double variables[3];
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < n; i++)
+    {
+        variables[x] = values[3 * i];
+        variables[y] = values[3 * i + 1];
+        variables[z] = values[3 * i + 2];
+        double solution = expression_evaluate(&compiled_formula, variables);
+        compiled_sum += isfinite(solution) ? solution : 0.0;
+    }
+    evaluated = seconds_since(start);
+    assert(close_enough(compiled_sum, sum));
+    printf("%-10s %14.2f %14.2f\n", "variables", parsed * 1e9 / n, evaluated * 1e9 / n);
+
+    // Row by row against whole columns
+    double *columns[3];
+    for (int j = 0; j < 3; j++)
+    {
+        columns[j] = malloc(n * sizeof(*columns[j]));
+        assert(columns[j]);
+    }
+    for (int i = 0; i < n; i++)
+    {
+        columns[x][i] = values[3 * i];
+        columns[y][i] = values[3 * i + 1];
+        columns[z][i] = values[3 * i + 2];
+    }
+    double *row_results = malloc(n * sizeof(*row_results));
+    double *column_results = malloc(n * sizeof(*column_results));
+    assert(row_results && column_results);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < n; i++)
+    {
+        variables[0] = columns[0][i];
+        variables[1] = columns[1][i];
+        variables[2] = columns[2][i];
+        row_results[i] = expression_evaluate(&compiled_formula, variables);
+    }
+    double rows = seconds_since(start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    expression_evaluate_columns(&compiled_formula, (const double *const *)columns, column_results, n);
+    evaluated = seconds_since(start);
+#ifndef EXPRESSION_FAST_COLUMNS
+    assert(memcmp(row_results, column_results, n * sizeof(*row_results)) == 0);
+#endif
+    printf("%-10s %14.2f %14.2f   (rows against columns)\n", "columns", rows * 1e9 / n, evaluated * 1e9 / n);
+
+    expression plain;
+    expression optimised;
+    valid = expression_compile(&plain, generated, NULL) && expression_compile(&optimised, generated, NULL);
+    assert(valid);
+    expression_optimize(&optimised);
+    // Both were compiled from the same text, so the variables have the same indices
+    int before = expression_operation_count(&plain);
+    int after = expression_operation_count(&optimised);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < n; i++)
+    {
+        variables[0] = columns[0][i];
+        variables[1] = columns[1][i];
+        variables[2] = columns[2][i];
+        row_results[i] = expression_evaluate(&plain, variables);
+    }
+    rows = seconds_since(start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < n; i++)
+    {
+        variables[0] = columns[0][i];
+        variables[1] = columns[1][i];
+        variables[2] = columns[2][i];
+        column_results[i] = expression_evaluate(&optimised, variables);
+    }
+    evaluated = seconds_since(start);
+    assert(memcmp(row_results, column_results, n * sizeof(*row_results)) == 0);
+    printf("%-10s %14.2f %14.2f   (%i operations against %i)\n", "optimised", rows * 1e9 / n, evaluated * 1e9 / n,
+           before, after);
+
+    expression_free(&plain);
+    expression_free(&optimised);
+    for (int j = 0; j < 3; j++)
+    {
+        free(columns[j]);
+    }
+    free(row_results);
+    free(column_results);
+    for (int i = 0; i < count; i++)
+    {
+        expression_free(&compiled[i]);
+    }
+    expression_free(&compiled_formula);
+    free(values);
+    return 0;
+}
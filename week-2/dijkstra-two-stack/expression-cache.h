@@ -0,0 +1,222 @@
+/* Memoising CACHE of compiled expressions, keyed by their text
+ * expression_cache_get normalises the whitespace of an expression, hashes the
+ * result while writing it, and looks it up in a hash map (hashmap.h). On a hit
+ * nothing is tokenised or compiled again: a constant expression comes with its
+ * value, and one with variables with its compiled and optimised form. Text that
+ * is not a valid expression is cached as such too. A constant expression is
+ * evaluated by expression_calculate without being compiled, so once the cache is
+ * full and the entries' text buffers are large enough, a miss on one makes no heap
+ * calls.
+ * The cache holds at most capacity expressions. When it is full, the one to go
+ * is chosen with the CLOCK algorithm, which approximates least recently used: a
+ * hand sweeps over the entries, clearing the referenced bit that every hit sets,
+ * and evicts the first entry whose bit is already clear.
+ * Whitespace is only kept, as a single space, between two characters that would
+ * otherwise run together into one number or name, so "( 1 + 2 )" and "(1+2)"
+ * share an entry while "1 2" stays invalid.
+ */
+
+#ifndef EXPRESSION_CACHE_H
+#define EXPRESSION_CACHE_H
+#include <assert.h>
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "expression-optimize.h"
+#include "expression.h"
+#include "hashmap.h"
+
+DEFINE_HASHMAP_TYPE(const char *, int, expression_cache, hashmap_string_hash, hashmap_string_equal);
+
+typedef struct expression_cache_entry
+{
+    // Normalised text, owned by the entry and reused by the next expression in its place
+    char *text;
+    int text_capacity;
+    uint64_t hash;
+    bool valid;
+    bool constant;
+    // Value of a constant expression, compiled form of any other valid one
+    double value;
+    expression compiled;
+    bool referenced;
+} expression_cache_entry;
+
+typedef struct expression_cache
+{
+    expression_cache_entry *entries;
+    int capacity;
+    int size;
+    int hand;
+    // Normalised text to entry index
+    expression_cache_hashmap *index;
+    char *buffer;
+    int buffer_capacity;
+    long hits;
+    long misses;
+    long evictions;
+} expression_cache;
+
+static inline void expression_cache_init(expression_cache *cache, int capacity)
+{
+    assert(cache);
+    assert(capacity >= 1);
+    cache->entries = malloc(capacity * sizeof(*cache->entries));
+    assert(cache->entries);
+    cache->capacity = capacity;
+    cache->size = 0;
+    cache->hand = 0;
+    cache->index = hashmap_expression_cache_create();
+    hashmap_expression_cache_reserve(cache->index, capacity);
+    cache->buffer = NULL;
+    cache->buffer_capacity = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->evictions = 0;
+}
+
+static inline void expression_cache_release(expression_cache_entry *entry)
+{
+    if (entry->valid && !entry->constant)
+    {
+        expression_free(&entry->compiled);
+    }
+}
+
+static inline void expression_cache_free(expression_cache *cache)
+{
+    assert(cache);
+    for (int i = 0; i < cache->size; i++)
+    {
+        expression_cache_release(&cache->entries[i]);
+        free(cache->entries[i].text);
+    }
+    free(cache->entries);
+    free(cache->buffer);
+    hashmap_expression_cache_free(cache->index);
+    cache->entries = NULL;
+    cache->buffer = NULL;
+    cache->size = 0;
+}
+
+static inline bool expression_cache_joins(char c)
+{
+    return isalnum((unsigned char)c) || c == '_' || c == '.';
+}
+
+/* Write the normalised form of the first length characters of text into the buffer, returning
+ * its length, and its hash in *hash */
+static inline int expression_cache_normalise(expression_cache *cache, const char *text, int length, uint64_t *hash)
+{
+    if (length + 1 > cache->buffer_capacity)
+    {
+        cache->buffer_capacity = length + 1 > 2 * cache->buffer_capacity ? length + 1 : 2 * cache->buffer_capacity;
+        free(cache->buffer);
+        cache->buffer = malloc(cache->buffer_capacity);
+        assert(cache->buffer);
+    }
+
+    uint64_t state = HASHMAP_STRING_SEED;
+    int size = 0;
+    bool space = false;
+    for (int i = 0; i < length; i++)
+    {
+        char c = text[i];
+        if (isspace((unsigned char)c))
+        {
+            space = true;
+            continue;
+        }
+        // "1e -5" must not turn into the number 1e-5 either
+        char previous = size > 0 ? cache->buffer[size - 1] : ' ';
+        bool joins = expression_cache_joins(previous) && expression_cache_joins(c);
+        bool exponent = (previous == 'e' || previous == 'E') && (c == '+' || c == '-');
+        if (space && (joins || exponent))
+        {
+            cache->buffer[size++] = ' ';
+            state = hashmap_string_step(state, ' ');
+        }
+        space = false;
+        cache->buffer[size++] = c;
+        state = hashmap_string_step(state, c);
+    }
+    cache->buffer[size] = '\0';
+    *hash = hashmap_string_finish(state);
+    return size;
+}
+
+/* Index of the entry to fill, evicting one if the cache is full */
+static inline int expression_cache_claim(expression_cache *cache)
+{
+    if (cache->size < cache->capacity)
+    {
+        cache->entries[cache->size].text = NULL;
+        cache->entries[cache->size].text_capacity = 0;
+        return cache->size++;
+    }
+
+    while (cache->entries[cache->hand].referenced)
+    {
+        cache->entries[cache->hand].referenced = false;
+        cache->hand = (cache->hand + 1) % cache->capacity;
+    }
+    int victim = cache->hand;
+    cache->hand = (cache->hand + 1) % cache->capacity;
+
+    expression_cache_entry *entry = &cache->entries[victim];
+    hashmap_expression_cache_remove_hashed(cache->index, entry->text, entry->hash, NULL);
+    expression_cache_release(entry);
+    cache->evictions++;
+    return victim;
+}
+
+/* Entry for the first length characters of text, compiling them on a miss. The entry
+ * stays valid until the next call */
+static inline const expression_cache_entry *expression_cache_get(expression_cache *cache, const char *text,
+                                                                 int length)
+{
+    assert(cache);
+    assert(text);
+    uint64_t hash;
+    int size = expression_cache_normalise(cache, text, length, &hash);
+    bool inserted;
+    expression_cache_hashmap_entry *found =
+        hashmap_expression_cache_upsert_hashed(cache->index, cache->buffer, hash, -1, &inserted);
+    if (!inserted)
+    {
+        cache->hits++;
+        cache->entries[found->value].referenced = true;
+        return &cache->entries[found->value];
+    }
+
+    // Evicting only marks the slot of another key as free, so found stays in place
+    cache->misses++;
+    int index = expression_cache_claim(cache);
+    expression_cache_entry *entry = &cache->entries[index];
+    if (size + 1 > entry->text_capacity)
+    {
+        entry->text_capacity = size + 1 > 64 ? size + 1 : 64;
+        free(entry->text);
+        entry->text = malloc(entry->text_capacity);
+        assert(entry->text);
+    }
+    memcpy(entry->text, cache->buffer, size + 1);
+    entry->hash = hash;
+    entry->referenced = false;
+    // Only expressions with variables, or invalid ones, have to be compiled
+    entry->value = 0.0;
+    entry->constant = expression_calculate(entry->text, size, &entry->value, NULL);
+    entry->valid = entry->constant || expression_compile(&entry->compiled, entry->text, NULL);
+    if (!entry->constant && entry->valid)
+    {
+        expression_optimize(&entry->compiled);
+    }
+    // The key becomes the copy in the entry, which outlives the buffer
+    found->key = entry->text;
+    found->value = index;
+    return entry;
+}
+
+#endif
@@ -0,0 +1,208 @@
+/* Column evaluation of compiled EXPRESSIONS
+ * expression_evaluate_columns applies one compiled expression to n rows of
+ * variables stored as columns (struct of arrays), EXPRESSION_BLOCK_SIZE rows at a
+ * time. Instead of running the bytecode once per row, every instruction is applied
+ * to a whole block: a variable is a pointer into its column, a constant a block
+ * filled once, and an operator one loop over the block, 4 doubles per instruction
+ * with AVX (any AVX or AVX2 build) and one at a time otherwise. ^ and function
+ * calls go through the C library one value at a time. A temporary of an optimised
+ * expression is a block of its own.
+ * Every operation is rounded exactly as in expression_evaluate, so the results
+ * are bit for bit the same. Defining EXPRESSION_FAST_COLUMNS before including this
+ * file gives up that guarantee: on machines with FMA, a multiplication followed by
+ * an addition or subtraction is then done as one fused multiply-add, which rounds
+ * once instead of twice.
+ */
+
+#ifndef EXPRESSION_COLUMNS_H
+#define EXPRESSION_COLUMNS_H
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__AVX__) || defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+#include "expression.h"
+
+#define EXPRESSION_BLOCK_SIZE 256
+
+/* out[i] = a[i] (op) b[i] for the first n items, ignoring b for operators taking one value; out may be a or b */
+static inline void expression_apply_block(expression_opcode opcode, int operand, double *out, const double *a,
+                                          const double *b, int n)
+{
+    int i = 0;
+#ifdef __AVX__
+#define EXPRESSION_VECTOR_LOOP(operation)                                                     \
+    for (; i + 4 <= n; i += 4)                                                                \
+    {                                                                                         \
+        _mm256_storeu_pd(out + i, operation(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i))); \
+    }
+    switch (opcode)
+    {
+    case EXPRESSION_ADD:
+        EXPRESSION_VECTOR_LOOP(_mm256_add_pd);
+        break;
+    case EXPRESSION_SUBTRACT:
+        EXPRESSION_VECTOR_LOOP(_mm256_sub_pd);
+        break;
+    case EXPRESSION_MULTIPLY:
+        EXPRESSION_VECTOR_LOOP(_mm256_mul_pd);
+        break;
+    case EXPRESSION_DIVIDE:
+        EXPRESSION_VECTOR_LOOP(_mm256_div_pd);
+        break;
+    default:
+        break;
+    }
+#undef EXPRESSION_VECTOR_LOOP
+#endif
+
+    // Whatever is left after the vector loop, or everything without AVX
+    switch (opcode)
+    {
+    case EXPRESSION_ADD:
+        for (; i < n; i++)
+        {
+            out[i] = a[i] + b[i];
+        }
+        break;
+    case EXPRESSION_SUBTRACT:
+        for (; i < n; i++)
+        {
+            out[i] = a[i] - b[i];
+        }
+        break;
+    case EXPRESSION_MULTIPLY:
+        for (; i < n; i++)
+        {
+            out[i] = a[i] * b[i];
+        }
+        break;
+    case EXPRESSION_DIVIDE:
+        for (; i < n; i++)
+        {
+            out[i] = a[i] / b[i];
+        }
+        break;
+    case EXPRESSION_NEGATE:
+        for (; i < n; i++)
+        {
+            out[i] = -a[i];
+        }
+        break;
+    default:
+        for (; i < n; i++)
+        {
+            out[i] = expression_apply(opcode, operand, a[i], b[i]);
+        }
+        break;
+    }
+}
+
+#if defined(EXPRESSION_FAST_COLUMNS) && defined(__FMA__)
+/* out[i] = c[i] + a[i] * b[i], or c[i] - a[i] * b[i] when subtract is true, rounded once */
+static inline void expression_fused_block(bool subtract, double *out, const double *a, const double *b,
+                                          const double *c, int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256d x = _mm256_loadu_pd(a + i);
+        __m256d y = _mm256_loadu_pd(b + i);
+        __m256d z = _mm256_loadu_pd(c + i);
+        _mm256_storeu_pd(out + i, subtract ? _mm256_fnmadd_pd(x, y, z) : _mm256_fmadd_pd(x, y, z));
+    }
+    for (; i < n; i++)
+    {
+        out[i] = subtract ? __builtin_fma(-a[i], b[i], c[i]) : __builtin_fma(a[i], b[i], c[i]);
+    }
+}
+#endif
+
+/* Evaluate compiled for n rows: variable i of row r is columns[i][r], and its value goes to results[r] */
+static inline void expression_evaluate_columns(const expression *compiled, const double *const *columns,
+                                               double *results, long n)
+{
+    assert(compiled);
+    assert(compiled->variable_count == 0 || columns);
+    const expression_instruction *code = compiled->code->storage_array;
+    int length = compiled->code->size;
+    int constant_count = compiled->constants->size;
+
+    // A scratch block per stack slot and temporary, and a block per constant that is filled only once
+    int blocks = compiled->depth + compiled->temporary_count + constant_count;
+    double *scratch = malloc(blocks * EXPRESSION_BLOCK_SIZE * sizeof(*scratch));
+    assert(scratch);
+    double *temporary_blocks = scratch + compiled->depth * EXPRESSION_BLOCK_SIZE;
+    double *constant_blocks = temporary_blocks + compiled->temporary_count * EXPRESSION_BLOCK_SIZE;
+    for (int i = 0; i < constant_count; i++)
+    {
+        for (int j = 0; j < EXPRESSION_BLOCK_SIZE; j++)
+        {
+            constant_blocks[i * EXPRESSION_BLOCK_SIZE + j] = compiled->constants->storage_array[i];
+        }
+    }
+
+    const double *values[EXPRESSION_MAX_DEPTH];
+    for (long offset = 0; offset < n; offset += EXPRESSION_BLOCK_SIZE)
+    {
+        int count = n - offset < EXPRESSION_BLOCK_SIZE ? n - offset : EXPRESSION_BLOCK_SIZE;
+        int size = 0;
+        for (int i = 0; i < length; i++)
+        {
+            expression_opcode opcode = code[i].opcode;
+            if (opcode == EXPRESSION_CONSTANT)
+            {
+                values[size++] = constant_blocks + code[i].operand * EXPRESSION_BLOCK_SIZE;
+                continue;
+            }
+            if (opcode == EXPRESSION_VARIABLE)
+            {
+                values[size++] = columns[code[i].operand] + offset;
+                continue;
+            }
+            if (opcode == EXPRESSION_LOAD)
+            {
+                values[size++] = temporary_blocks + code[i].operand * EXPRESSION_BLOCK_SIZE;
+                continue;
+            }
+            if (opcode == EXPRESSION_STORE)
+            {
+                memcpy(temporary_blocks + code[i].operand * EXPRESSION_BLOCK_SIZE, values[size - 1],
+                       count * sizeof(*scratch));
+                continue;
+            }
+
+#if defined(EXPRESSION_FAST_COLUMNS) && defined(__FMA__)
+            if (opcode == EXPRESSION_MULTIPLY && i + 1 < length &&
+                (code[i + 1].opcode == EXPRESSION_ADD || code[i + 1].opcode == EXPRESSION_SUBTRACT))
+            {
+                // The last instruction writes straight into the results
+                i++;
+                double *out = i == length - 1 ? results + offset : scratch + (size - 3) * EXPRESSION_BLOCK_SIZE;
+                expression_fused_block(code[i].opcode == EXPRESSION_SUBTRACT, out, values[size - 2],
+                                       values[size - 1], values[size - 3], count);
+                size -= 2;
+                values[size - 1] = out;
+                continue;
+            }
+#endif
+
+            int arity = expression_arity(opcode, code[i].operand);
+            double *out = i == length - 1 ? results + offset : scratch + (size - arity) * EXPRESSION_BLOCK_SIZE;
+            expression_apply_block(opcode, code[i].operand, out, values[size - arity], values[size - 1], count);
+            size -= arity - 1;
+            values[size - 1] = out;
+        }
+
+        // An expression without operators is a single constant or variable
+        if (code[length - 1].opcode == EXPRESSION_CONSTANT || code[length - 1].opcode == EXPRESSION_VARIABLE)
+        {
+            memcpy(results + offset, values[0], count * sizeof(*results));
+        }
+    }
+    free(scratch);
+}
+
+#endif
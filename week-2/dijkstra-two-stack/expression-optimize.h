@@ -0,0 +1,301 @@
+/* Optimisation of compiled EXPRESSIONS
+ * expression_optimize rewrites the bytecode of a compiled expression so it does
+ * fewer operations, without changing any result by even one bit:
+ * - operations on constants only are done once, at optimisation time (folding),
+ *   calls of functions such as sqrt(2) included
+ * - identical subexpressions, such as both a * 2.5 in (a * 2.5 + 1) / (a * 2.5 - 1),
+ *   are computed once and kept in a temporary (common subexpression elimination)
+ * - x / c becomes x * (1 / c) when 1 / c is exact, i.e. when c is a power of two,
+ *   and x * 1, x / 1 and x - 0 become x (strength reduction)
+ * Other divisions by a constant are left alone, since multiplying by a rounded
+ * reciprocal can change the last bit of the result. For the same reason nothing is
+ * reordered: (x + 1) + 2 is not folded into x + 3.
+ * The bytecode is first turned into a graph of nodes, where equal nodes are shared
+ * through a hash map (hashmap.h), and then written out again from the result node.
+ * Both walks over the graph keep their own stack, so a long chain such as
+ * a + a + ... + a cannot overflow the call stack.
+ */
+
+#ifndef EXPRESSION_OPTIMIZE_H
+#define EXPRESSION_OPTIMIZE_H
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "expression.h"
+#include "hashmap.h"
+
+typedef struct expression_node
+{
+    expression_opcode opcode;
+    // Variable or function index, and operand nodes of an operator (right is -1 if it takes one)
+    int operand;
+    int left;
+    int right;
+    double value;
+    // Number of operators using the node, and once written out the index of its constant
+    // or temporary (-1 before, or if it has none)
+    int uses;
+    int index;
+    bool reachable;
+} expression_node;
+
+DEFINE_STACK_TYPE(expression_node, expression_node);
+
+// What makes two nodes equal, with the constant bit for bit so 0.0 and -0.0 stay apart
+typedef struct expression_node_key
+{
+    expression_opcode opcode;
+    int operand;
+    int left;
+    int right;
+    uint64_t value;
+} expression_node_key;
+
+static inline uint64_t expression_node_key_hash(expression_node_key key)
+{
+    uint64_t hash = hashmap_string_finish(key.value ^ ((uint64_t)(uint32_t)key.left << 32 | (uint32_t)key.right));
+    return hashmap_string_finish(hash ^ ((uint64_t)key.opcode << 32 | (uint32_t)key.operand));
+}
+
+static inline bool expression_node_key_equal(expression_node_key a, expression_node_key b)
+{
+    return a.opcode == b.opcode && a.operand == b.operand && a.left == b.left && a.right == b.right &&
+           a.value == b.value;
+}
+
+DEFINE_HASHMAP_TYPE(expression_node_key, int, expression_node, expression_node_key_hash, expression_node_key_equal);
+
+// A node on the stack of a walk over the graph, and how many of its operands are done
+typedef struct expression_node_visit
+{
+    int node;
+    int operands_done;
+} expression_node_visit;
+
+DEFINE_STACK_TYPE(expression_node_visit, expression_node_visit);
+
+/* Number of operations and function calls the expression does per evaluation */
+static inline int expression_operation_count(const expression *compiled)
+{
+    int count = 0;
+    for (int i = 0; i < compiled->code->size; i++)
+    {
+        expression_opcode opcode = compiled->code->storage_array[i].opcode;
+        count += opcode >= EXPRESSION_ADD && opcode <= EXPRESSION_CALL;
+    }
+    return count;
+}
+
+/* Index of a node equal to this one, which is added to nodes and to their index if there is none yet */
+static inline int expression_node_intern(expression_node_stack *nodes, expression_node_hashmap *index,
+                                         expression_node node)
+{
+    expression_node_key key = {node.opcode, node.operand, node.left, node.right, 0};
+    memcpy(&key.value, &node.value, sizeof(key.value));
+    bool inserted;
+    expression_node_hashmap_entry *entry = hashmap_expression_node_upsert(index, key, nodes->size, &inserted);
+    if (inserted)
+    {
+        stack_expression_node_push(nodes, node);
+    }
+    return entry->value;
+}
+
+static inline bool expression_node_is_constant(const expression_node_stack *nodes, int index, double value)
+{
+    const expression_node *node = &nodes->storage_array[index];
+    return node->opcode == EXPRESSION_CONSTANT && node->value == value && !signbit(node->value) == !signbit(value);
+}
+
+/* Node for left (op) right, or (op) left if right is -1, after folding and strength reduction */
+static inline int expression_node_operator(expression_node_stack *nodes, expression_node_hashmap *index,
+                                           expression_opcode opcode, int operand, int left, int right)
+{
+    expression_node *a = &nodes->storage_array[left];
+    expression_node node = {opcode, operand, left, right, 0.0, 0, -1, false};
+    if (right < 0)
+    {
+        if (a->opcode != EXPRESSION_CONSTANT)
+        {
+            return expression_node_intern(nodes, index, node);
+        }
+        double value = expression_apply(opcode, operand, a->value, 0.0);
+        expression_node constant = {EXPRESSION_CONSTANT, 0, -1, -1, value, 0, -1, false};
+        return expression_node_intern(nodes, index, constant);
+    }
+
+    expression_node *b = &nodes->storage_array[right];
+    if (a->opcode == EXPRESSION_CONSTANT && b->opcode == EXPRESSION_CONSTANT)
+    {
+        double value = expression_apply(opcode, operand, a->value, b->value);
+        expression_node constant = {EXPRESSION_CONSTANT, 0, -1, -1, value, 0, -1, false};
+        return expression_node_intern(nodes, index, constant);
+    }
+
+    bool scales = opcode == EXPRESSION_MULTIPLY || opcode == EXPRESSION_DIVIDE;
+    if ((scales && expression_node_is_constant(nodes, right, 1.0)) ||
+        (opcode == EXPRESSION_SUBTRACT && expression_node_is_constant(nodes, right, 0.0)))
+    {
+        return left;
+    }
+
+    int exponent;
+    if (opcode == EXPRESSION_DIVIDE && b->opcode == EXPRESSION_CONSTANT && frexp(b->value, &exponent) == 0.5)
+    {
+        // 1 / 2^k is exact as long as it does not overflow or drop below the subnormals
+        double reciprocal = 1.0 / b->value;
+        if (isfinite(reciprocal) && reciprocal != 0.0 && fabs(frexp(reciprocal, &exponent)) == 0.5)
+        {
+            expression_node constant = {EXPRESSION_CONSTANT, 0, -1, -1, reciprocal, 0, -1, false};
+            node.opcode = EXPRESSION_MULTIPLY;
+            node.right = expression_node_intern(nodes, index, constant);
+        }
+    }
+    return expression_node_intern(nodes, index, node);
+}
+
+/* Mark every node the root depends on as reachable, counting the operators that use each */
+static inline void expression_node_mark(expression_node_stack *nodes, expression_node_visit_stack *visits, int root)
+{
+    nodes->storage_array[root].reachable = true;
+    stack_expression_node_visit_push(visits, (expression_node_visit){root, 0});
+    while (!stack_expression_node_visit_is_empty(visits))
+    {
+        expression_node *node = &nodes->storage_array[stack_expression_node_visit_pop(visits).node];
+        int operands[2] = {node->left, node->right};
+        for (int i = 0; i < 2 && operands[i] >= 0; i++)
+        {
+            expression_node *operand = &nodes->storage_array[operands[i]];
+            operand->uses++;
+            if (!operand->reachable)
+            {
+                operand->reachable = true;
+                stack_expression_node_visit_push(visits, (expression_node_visit){operands[i], 0});
+            }
+        }
+    }
+}
+
+/* Write out the bytecode of a node that has none written yet, or its value if it has: a variable, a
+ * constant or a temporary. Returns false if it is an operator whose operands come first */
+static inline bool expression_node_emit_value(expression *compiled, expression_node *node, int *depth)
+{
+    if (node->opcode == EXPRESSION_VARIABLE)
+    {
+        expression_emit(compiled, EXPRESSION_VARIABLE, node->operand, depth);
+        return true;
+    }
+    if (node->opcode == EXPRESSION_CONSTANT)
+    {
+        // Equal constants share a node, so each value is added once
+        if (node->index < 0)
+        {
+            stack_expression_constant_push(compiled->constants, node->value);
+            node->index = compiled->constants->size - 1;
+        }
+        expression_emit(compiled, EXPRESSION_CONSTANT, node->index, depth);
+        return true;
+    }
+    if (node->index >= 0)
+    {
+        expression_emit(compiled, EXPRESSION_LOAD, node->index, depth);
+        return true;
+    }
+    return false;
+}
+
+/* Write out the bytecode of the root, operands before their operator, storing an operator used more
+ * than once in a temporary */
+static inline void expression_node_emit(expression *compiled, expression_node_stack *nodes,
+                                        expression_node_visit_stack *visits, int root, int *depth)
+{
+    stack_expression_node_visit_push(visits, (expression_node_visit){root, 0});
+    while (!stack_expression_node_visit_is_empty(visits))
+    {
+        expression_node_visit *visit = &visits->storage_array[visits->size - 1];
+        expression_node *node = &nodes->storage_array[visit->node];
+        if (visit->operands_done == 0 && expression_node_emit_value(compiled, node, depth))
+        {
+            stack_expression_node_visit_pop(visits);
+            continue;
+        }
+        int operand = visit->operands_done == 0 ? node->left : visit->operands_done == 1 ? node->right : -1;
+        if (operand >= 0)
+        {
+            visit->operands_done++;
+            stack_expression_node_visit_push(visits, (expression_node_visit){operand, 0});
+            continue;
+        }
+
+        stack_expression_node_visit_pop(visits);
+        expression_emit(compiled, node->opcode, node->operand, depth);
+        if (node->uses > 1 && compiled->temporary_count < EXPRESSION_MAX_TEMPORARIES)
+        {
+            node->index = compiled->temporary_count++;
+            expression_emit(compiled, EXPRESSION_STORE, node->index, depth);
+        }
+    }
+}
+
+/* Optimise a compiled expression in place; it keeps its variables and their indices */
+static inline void expression_optimize(expression *compiled)
+{
+    assert(compiled);
+    assert(compiled->code);
+    const expression_instruction *code = compiled->code->storage_array;
+    const double *constants = compiled->constants->storage_array;
+    expression_node_stack *nodes = stack_expression_node_create();
+    expression_node_hashmap *index = hashmap_expression_node_create();
+    expression_node_visit_stack *visits = stack_expression_node_visit_create();
+
+    // Run the bytecode on nodes instead of values
+    int stack[EXPRESSION_MAX_DEPTH];
+    int size = 0;
+    for (int i = 0; i < compiled->code->size; i++)
+    {
+        expression_opcode opcode = code[i].opcode;
+        if (opcode == EXPRESSION_CONSTANT)
+        {
+            expression_node node = {EXPRESSION_CONSTANT, 0, -1, -1, constants[code[i].operand], 0, -1, false};
+            stack[size++] = expression_node_intern(nodes, index, node);
+        }
+        else if (opcode == EXPRESSION_VARIABLE)
+        {
+            expression_node node = {EXPRESSION_VARIABLE, code[i].operand, -1, -1, 0.0, 0, -1, false};
+            stack[size++] = expression_node_intern(nodes, index, node);
+        }
+        else
+        {
+            // Only freshly compiled expressions have no temporaries
+            assert(opcode != EXPRESSION_LOAD && opcode != EXPRESSION_STORE);
+            if (expression_arity(opcode, code[i].operand) == 1)
+            {
+                stack[size - 1] =
+                    expression_node_operator(nodes, index, opcode, code[i].operand, stack[size - 1], -1);
+                continue;
+            }
+            size--;
+            stack[size - 1] =
+                expression_node_operator(nodes, index, opcode, code[i].operand, stack[size - 1], stack[size]);
+        }
+    }
+
+    int root = stack[0];
+    expression_node_mark(nodes, visits, root);
+    stack_expression_code_free(compiled->code);
+    stack_expression_constant_free(compiled->constants);
+    compiled->code = stack_expression_code_create();
+    compiled->constants = stack_expression_constant_create();
+    compiled->temporary_count = 0;
+    compiled->depth = 0;
+    int depth = 0;
+    expression_node_emit(compiled, nodes, visits, root, &depth);
+    stack_expression_node_free(nodes);
+    hashmap_expression_node_free(index);
+    stack_expression_node_visit_free(visits);
+}
+
+#endif
@@ -0,0 +1,516 @@
+/* STREAMING evaluation of expressions of any length
+ * expression_stream_feed takes the text of an expression in pieces, as they come
+ * in from a pipe, and evaluates it on the way with Dijkstra's two stacks: a value
+ * waits on the value stack, and an operator on the operator stack, only until an
+ * operator that binds no more strongly comes in. Both stacks grow as needed and
+ * shrink again, so the memory used depends on how deeply the expression nests,
+ * not on its length. A number or name cut off at the end of a piece is left for
+ * the caller to pass again, in front of the next piece.
+ * The grammar and the order of the operations are those of expression_calculate,
+ * so the results are bit for bit the same and so are the error messages, but
+ * brackets may nest as deeply as memory allows. That holds for the default number
+ * type of number.h, double; built with one of the others, the stream evaluates in
+ * exact decimal or with double-double precision instead.
+ * expression_stream_evaluate_lines evaluates a file or pipe with one expression
+ * per line this way, writing each result as soon as its line has been read.
+ * The stacks are small stacks (stack.h) inside the stream itself, so a stream on
+ * the caller's stack makes no heap calls for expressions that nest less than
+ * EXPRESSION_STREAM_INLINE_DEPTH deep. A stream is reset rather than freed between
+ * expressions, so its stacks are used again. expression_stream_default gives each
+ * thread one whose stacks never shrink either, so that evaluating with it makes no
+ * heap calls once it has seen an expression as deep as the current one.
+ */
+
+#ifndef EXPRESSION_STREAM_H
+#define EXPRESSION_STREAM_H
+#include <assert.h>
+#include <ctype.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "expression.h"
+#include "literal.h"
+#include "number.h"
+#include "stack.h"
+
+// Bytes per read, and the size the buffer starts at. It only grows for a single number or name longer than that
+#define EXPRESSION_STREAM_READ_SIZE (1 << 16)
+
+// Values and operators each stack holds inside the stream, before it goes to the heap
+#define EXPRESSION_STREAM_INLINE_DEPTH 32
+
+// Symbols on the operator stack besides + - * / ^
+#define EXPRESSION_STREAM_BRACKET '('
+#define EXPRESSION_STREAM_CALL 'f'
+#define EXPRESSION_STREAM_NEGATE '~'
+
+typedef struct expression_stream_operator
+{
+    char symbol;
+    // For a call, the index of the function and the number of arguments that are complete
+    int function;
+    int arguments;
+} expression_stream_operator;
+
+DEFINE_SMALL_STACK_TYPE(number, expression_stream_value, EXPRESSION_STREAM_INLINE_DEPTH);
+DEFINE_SMALL_STACK_TYPE(expression_stream_operator, expression_stream_operator, EXPRESSION_STREAM_INLINE_DEPTH);
+
+/* A stream must not be copied or moved while in use, since its stacks may point into it */
+
+typedef struct expression_stream
+{
+    expression_stream_value_small_stack values;
+    expression_stream_operator_small_stack operators;
+    // Whether a number, name, '(' or unary minus comes next, rather than an operator, ',' or ')'
+    bool operand;
+    // Characters of the expression used so far
+    long offset;
+    // First error, if any, and where it was found, counted from 0
+    const char *message;
+    long error_position;
+} expression_stream;
+
+/* Get ready for the next expression, keeping the memory of the stacks */
+static inline void expression_stream_reset(expression_stream *stream)
+{
+    assert(stream);
+    stream->values.size = 0;
+    stream->operators.size = 0;
+    stream->operand = true;
+    stream->offset = 0;
+    stream->message = NULL;
+    stream->error_position = 0;
+}
+
+static inline void expression_stream_init(expression_stream *stream)
+{
+    assert(stream);
+    small_stack_expression_stream_value_init(&stream->values);
+    small_stack_expression_stream_operator_init(&stream->operators);
+    expression_stream_reset(stream);
+}
+
+static inline void expression_stream_free(expression_stream *stream)
+{
+    assert(stream);
+    small_stack_expression_stream_value_deinit(&stream->values);
+    small_stack_expression_stream_operator_deinit(&stream->operators);
+}
+
+/* The stream of the calling thread, for expressions evaluated one at a time with
+ * expression_stream_calculate. Its memory is not given back when the thread ends, so it
+ * is meant for threads that evaluate for as long as the program runs */
+static inline expression_stream *expression_stream_default(void)
+{
+    static _Thread_local expression_stream stream;
+    static _Thread_local bool ready = false;
+    if (!ready)
+    {
+        expression_stream_init(&stream);
+        small_stack_expression_stream_value_set_shrink_factor(&stream.values, 0);
+        small_stack_expression_stream_operator_set_shrink_factor(&stream.operators, 0);
+        ready = true;
+    }
+    return &stream;
+}
+
+static inline void expression_stream_fail(expression_stream *stream, long position, const char *message)
+{
+    if (!stream->message)
+    {
+        stream->message = message;
+        stream->error_position = position;
+    }
+}
+
+/* Fail at text[i], where message says what was expected, unless the text there is not a
+ * valid token at all */
+static inline void expression_stream_unexpected(expression_stream *stream, const char *text, int length, int i,
+                                                const char *message)
+{
+    int position = i;
+    expression_token token = expression_next_token(text, length, &position);
+    expression_stream_fail(stream, stream->offset + token.position,
+                           token.type == EXPRESSION_TOKEN_INVALID ? "invalid character or number" : message);
+}
+
+/* How strongly the operator binds, 0 for brackets and calls, which only ')' and ',' take off */
+static inline int expression_stream_binding(char symbol)
+{
+    // -2 ^ 2 is -(2 ^ 2), but -2 * 3 is (-2) * 3
+    return symbol == EXPRESSION_STREAM_NEGATE ? expression_precedence('^') : expression_precedence(symbol);
+}
+
+/* Apply the operator on top of the operator stack to the values on top of the value stack */
+static inline void expression_stream_reduce(expression_stream *stream)
+{
+    expression_stream_operator top = small_stack_expression_stream_operator_pop(&stream->operators);
+    number *values = stream->values.storage_array;
+    int size = stream->values.size;
+    if (top.symbol == EXPRESSION_STREAM_NEGATE)
+    {
+        values[size - 1] = number_apply(EXPRESSION_NEGATE, 0, values[size - 1], values[size - 1]);
+    }
+    else if (top.symbol == EXPRESSION_STREAM_CALL)
+    {
+        int arity = expression_functions[top.function].arity;
+        values[size - arity] = number_apply(EXPRESSION_CALL, top.function, values[size - arity], values[size - 1]);
+        for (int i = 1; i < arity; i++)
+        {
+            small_stack_expression_stream_value_pop(&stream->values);
+        }
+    }
+    else
+    {
+        values[size - 2] =
+            number_apply(expression_operator_opcode(top.symbol), 0, values[size - 2], values[size - 1]);
+        small_stack_expression_stream_value_pop(&stream->values);
+    }
+}
+
+/* Apply the operators on top of the stack that bind at least as strongly as binding */
+static inline void expression_stream_reduce_while(expression_stream *stream, int binding)
+{
+    expression_stream_operator_small_stack *operators = &stream->operators;
+    while (operators->size > 0 &&
+           expression_stream_binding(operators->storage_array[operators->size - 1].symbol) >= binding)
+    {
+        expression_stream_reduce(stream);
+    }
+}
+
+/* Whether the number or name at text[i] might go on past the end of text, or a name might
+ * still turn out to be followed by the '(' of a call */
+static inline bool expression_stream_cut(const char *text, int length, int i)
+{
+    int end = i;
+    if (isalpha((unsigned char)text[i]) || text[i] == '_')
+    {
+        end += expression_scan_name(text, length, i);
+        while (end < length && expression_is_space(text[end]))
+        {
+            end++;
+        }
+        return end == length;
+    }
+    if ((unsigned char)(text[i] - '0') < 10 || text[i] == '.')
+    {
+        double value;
+        end += literal_parse(text + i, length - i, &value);
+        // 1. may still become 1.5, and 1e or 1e- may become 1e-5
+        if (end < length && text[end] == '.')
+        {
+            end++;
+        }
+        else if (end < length && (text[end] == 'e' || text[end] == 'E'))
+        {
+            end++;
+            if (end < length && (text[end] == '+' || text[end] == '-'))
+            {
+                end++;
+            }
+        }
+        return end == length;
+    }
+    return false;
+}
+
+/* Take the number, name, '(' or unary minus at text[i]. Returns the index just past it, or
+ * -1 if it is cut off by the end of text and last is false */
+static inline int expression_stream_take_operand(expression_stream *stream, const char *text, int length, int i,
+                                                 bool last)
+{
+    char c = text[i];
+    if ((unsigned char)(c - '0') < 10 || c == '.')
+    {
+        number value;
+        int end = i + number_parse(text + i, length - i, &value);
+        // Only a number within reach of the end can be cut off
+        if (!last && end + 2 >= length && expression_stream_cut(text, length, i))
+        {
+            return -1;
+        }
+        // A number running straight into a '.' is malformed, e.g. 1.2.3 or 1.
+        if (end == i || (end < length && text[end] == '.'))
+        {
+            expression_stream_fail(stream, stream->offset + i, "invalid character or number");
+            return length;
+        }
+        small_stack_expression_stream_value_push(&stream->values, value);
+        stream->operand = false;
+        return end;
+    }
+    if (c == '(')
+    {
+        small_stack_expression_stream_operator_push(&stream->operators,
+                                              (expression_stream_operator){EXPRESSION_STREAM_BRACKET, 0, 0});
+        return i + 1;
+    }
+    if (c == '-')
+    {
+        small_stack_expression_stream_operator_push(&stream->operators,
+                                              (expression_stream_operator){EXPRESSION_STREAM_NEGATE, 0, 0});
+        return i + 1;
+    }
+    if (isalpha((unsigned char)c) || c == '_')
+    {
+        int name = expression_scan_name(text, length, i);
+        int end = i + name;
+        while (end < length && expression_is_space(text[end]))
+        {
+            end++;
+        }
+        if (!last && end == length)
+        {
+            return -1;
+        }
+        if (name > EXPRESSION_MAX_NAME)
+        {
+            expression_stream_fail(stream, stream->offset + i, "invalid character or number");
+            return length;
+        }
+        if (end == length || text[end] != '(')
+        {
+            expression_stream_fail(stream, stream->offset + i, "variables need a compiled expression");
+            return length;
+        }
+        int function = expression_function_index(text + i, name);
+        if (function < 0)
+        {
+            expression_stream_fail(stream, stream->offset + i, "unknown function");
+            return length;
+        }
+        small_stack_expression_stream_operator_push(&stream->operators,
+                                              (expression_stream_operator){EXPRESSION_STREAM_CALL, function, 0});
+        return end + 1;
+    }
+    expression_stream_unexpected(stream, text, length, i, "expected a number, variable or '('");
+    return length;
+}
+
+/* Take the operator, ',' or ')' at text[i]. Returns the index just past it, or -1 if what is
+ * there instead is cut off by the end of text and last is false */
+static inline int expression_stream_take_operator(expression_stream *stream, const char *text, int length, int i,
+                                                  bool last)
+{
+    char c = text[i];
+    int binding = expression_precedence(c);
+    if (binding > 0)
+    {
+        // ^ goes right to left, so it waits for the ^ after it
+        expression_stream_reduce_while(stream, c == '^' ? binding + 1 : binding);
+        small_stack_expression_stream_operator_push(&stream->operators, (expression_stream_operator){c, 0, 0});
+        stream->operand = true;
+        return i + 1;
+    }
+
+    expression_stream_reduce_while(stream, 1);
+    expression_stream_operator_small_stack *operators = &stream->operators;
+    expression_stream_operator *top = operators->size > 0 ? &operators->storage_array[operators->size - 1] : NULL;
+    if (c == ')' && top && top->symbol == EXPRESSION_STREAM_BRACKET)
+    {
+        small_stack_expression_stream_operator_pop(operators);
+        return i + 1;
+    }
+    if ((c == ')' || c == ',') && top && top->symbol == EXPRESSION_STREAM_CALL)
+    {
+        int arity = expression_functions[top->function].arity;
+        top->arguments++;
+        if (c == ',' && top->arguments < arity)
+        {
+            stream->operand = true;
+            return i + 1;
+        }
+        if (c == ')' && top->arguments == arity)
+        {
+            expression_stream_reduce(stream);
+            return i + 1;
+        }
+        expression_stream_fail(stream, stream->offset + i, c == ')' ? "too few arguments" : "too many arguments");
+        return length;
+    }
+
+    // What is there decides the message, so it has to be all there
+    if (!last && expression_stream_cut(text, length, i))
+    {
+        return -1;
+    }
+    const char *message = "expected an operator or ')'";
+    if (!top && c == ')')
+    {
+        message = "unmatched ')'";
+    }
+    else if (top && top->symbol == EXPRESSION_STREAM_CALL)
+    {
+        message = "expected ',' or ')'";
+    }
+    expression_stream_unexpected(stream, text, length, i, message);
+    return length;
+}
+
+/* Evaluate as much of the first length characters of text as possible, given that more of
+ * the expression follows unless last is true. Returns the number of characters used; the
+ * rest is a cut-off number or name, to be passed again in front of the next piece */
+static inline int expression_stream_feed(expression_stream *stream, const char *text, int length, bool last)
+{
+    assert(stream);
+    assert(text || length == 0);
+    int i = 0;
+    while (!stream->message)
+    {
+        while (i < length && expression_is_space(text[i]))
+        {
+            i++;
+        }
+        if (i == length)
+        {
+            break;
+        }
+        int end = stream->operand ? expression_stream_take_operand(stream, text, length, i, last)
+                                  : expression_stream_take_operator(stream, text, length, i, last);
+        if (end < 0)
+        {
+            break;
+        }
+        i = end;
+    }
+    // The rest of an invalid expression is skipped
+    if (stream->message)
+    {
+        i = length;
+    }
+    stream->offset += i;
+    return i;
+}
+
+/* End the expression, putting its value in *value. Returns false if it is not valid, with
+ * stream->message and stream->error_position saying why and where */
+static inline bool expression_stream_finish(expression_stream *stream, number *value)
+{
+    assert(stream);
+    assert(value);
+    if (!stream->message && stream->operand)
+    {
+        expression_stream_fail(stream, stream->offset, "expected a number, variable or '('");
+    }
+    if (!stream->message)
+    {
+        expression_stream_reduce_while(stream, 1);
+        expression_stream_operator_small_stack *operators = &stream->operators;
+        if (operators->size > 0)
+        {
+            bool bracket = operators->storage_array[operators->size - 1].symbol == EXPRESSION_STREAM_BRACKET;
+            expression_stream_fail(stream, stream->offset, bracket ? "missing ')'" : "expected ',' or ')'");
+        }
+    }
+    *value = stream->message ? number_from_double(0.0) : stream->values.storage_array[0];
+    return !stream->message;
+}
+
+/* Reset stream and evaluate the first length characters of text in one piece. Returns false
+ * if they are not a valid expression, with stream->message and stream->error_position
+ * saying why and where */
+static inline bool expression_stream_calculate(expression_stream *stream, const char *text, int length,
+                                               number *value)
+{
+    expression_stream_reset(stream);
+    expression_stream_feed(stream, text, length, true);
+    return expression_stream_finish(stream, value);
+}
+
+/* Evaluate the expressions read from fd, one per line, writing a result or "error" per line
+ * to output and a message with line and column per invalid line to errors, like
+ * batch_evaluate, but without variables. Returns the number of invalid lines, or -1 if fd
+ * could not be read */
+static inline long expression_stream_evaluate_lines(int fd, FILE *output, FILE *errors)
+{
+    expression_stream stream;
+    expression_stream_init(&stream);
+    size_t capacity = EXPRESSION_STREAM_READ_SIZE;
+    char *buffer = malloc(capacity);
+    assert(buffer);
+    // Text read but not used yet is buffer[begin, end)
+    size_t begin = 0;
+    size_t end = 0;
+    bool finished = false;
+    long lines = 0;
+    long error_count = 0;
+
+    while (true)
+    {
+        const char *newline = memchr(buffer + begin, '\n', end - begin);
+        size_t stop = newline ? (size_t)(newline - buffer) : end;
+        int piece = stop - begin > INT_MAX ? INT_MAX : stop - begin;
+        bool whole = begin + piece == stop;
+        bool last = (newline || finished) && whole;
+        begin += expression_stream_feed(&stream, buffer + begin, piece, last);
+
+        // A last line without '\n' counts, but nothing after the last '\n' does
+        if (last && (newline || stream.offset > 0))
+        {
+            number value;
+            lines++;
+            // Blank lines stay blank
+            if (stream.values.size == 0 && stream.operators.size == 0 && !stream.message)
+            {
+                fprintf(output, "\n");
+            }
+            else if (expression_stream_finish(&stream, &value))
+            {
+                char result[NUMBER_MAX_FORMAT];
+                number_format(result, sizeof(result), value);
+                fprintf(output, "%s\n", result);
+            }
+            else
+            {
+                fprintf(output, "error\n");
+                fprintf(errors, "line %li, column %li: %s\n", lines, stream.error_position + 1, stream.message);
+                error_count++;
+            }
+            expression_stream_reset(&stream);
+            begin = newline ? stop + 1 : stop;
+            continue;
+        }
+        if (finished)
+        {
+            break;
+        }
+        if (!whole)
+        {
+            // A line of more than INT_MAX characters goes in several pieces
+            continue;
+        }
+
+        // Keep what is left at the front, and only grow for a number or name that fills the buffer
+        memmove(buffer, buffer + begin, end - begin);
+        end -= begin;
+        begin = 0;
+        if (end == capacity)
+        {
+            capacity *= 2;
+            buffer = realloc(buffer, capacity);
+            assert(buffer);
+        }
+        // Whoever is reading the output sees every result before this waits for more input
+        fflush(output);
+        ssize_t bytes = read(fd, buffer + end, capacity - end);
+        if (bytes < 0)
+        {
+            error_count = -1;
+            break;
+        }
+        finished = bytes == 0;
+        end += bytes;
+    }
+
+    fflush(output);
+    free(buffer);
+    expression_stream_free(&stream);
+    return error_count;
+}
+
+#endif
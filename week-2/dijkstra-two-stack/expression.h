@@ -0,0 +1,751 @@
+/* Compiled EXPRESSIONS
+ * expression_compile turns an expression with + - * / ^, unary minus, brackets,
+ * function calls such as sqrt(x) or max(a, b), numbers (with an optional exponent,
+ * read by literal.h) and named variables (letters, digits and '_', starting with a
+ * letter or '_') into postfix bytecode. The parser climbs precedences in one pass
+ * from left to right: ^ binds strongest and goes right to left, then unary minus
+ * (so -2 ^ 2 is -4), then * and /, then + and -, which both go left to right.
+ * expression_evaluate then runs the bytecode on a fixed-size array of values,
+ * without parsing or allocating, so one formula can be evaluated many times with
+ * different values for its variables. expression_calculate uses the same parser to
+ * evaluate an expression without variables right away, without any bytecode.
+ */
+
+#ifndef EXPRESSION_H
+#define EXPRESSION_H
+#include <assert.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "literal.h"
+#include "stack.h"
+
+// Values on the evaluation stack at once, e.g. 1 + (2 + (3 + ... needs one per bracket
+#define EXPRESSION_MAX_DEPTH 256
+#define EXPRESSION_MAX_VARIABLES 32
+#define EXPRESSION_MAX_NAME 31
+// Values kept aside by an optimised expression to be used again, see expression-optimize.h
+#define EXPRESSION_MAX_TEMPORARIES 64
+
+typedef enum expression_opcode
+{
+    EXPRESSION_CONSTANT,
+    EXPRESSION_VARIABLE,
+    EXPRESSION_ADD,
+    EXPRESSION_SUBTRACT,
+    EXPRESSION_MULTIPLY,
+    EXPRESSION_DIVIDE,
+    EXPRESSION_POWER,
+    EXPRESSION_NEGATE,
+    // Operand is the index of the function in expression_functions
+    EXPRESSION_CALL,
+    // Push a temporary, or copy the top of the stack into one
+    EXPRESSION_LOAD,
+    EXPRESSION_STORE
+} expression_opcode;
+
+// Operand is the index of the constant, variable, function or temporary, unused for other operators
+typedef struct expression_instruction
+{
+    int32_t opcode;
+    int32_t operand;
+} expression_instruction;
+
+DEFINE_STACK_TYPE(expression_instruction, expression_code);
+DEFINE_STACK_TYPE(double, expression_constant);
+
+typedef struct expression_function
+{
+    const char *name;
+    // Number of arguments, and the function taking that many
+    int arity;
+    double (*unary)(double);
+    double (*binary)(double, double);
+} expression_function;
+
+static const expression_function expression_functions[] = {
+    {"abs", 1, fabs, NULL},    {"sqrt", 1, sqrt, NULL},   {"exp", 1, exp, NULL}, {"log", 1, log, NULL},
+    {"sin", 1, sin, NULL},     {"cos", 1, cos, NULL},     {"tan", 1, tan, NULL}, {"floor", 1, floor, NULL},
+    {"ceil", 1, ceil, NULL},   {"min", 2, NULL, fmin},    {"max", 2, NULL, fmax}, {"atan2", 2, NULL, atan2},
+};
+#define EXPRESSION_FUNCTION_COUNT ((int)(sizeof(expression_functions) / sizeof(*expression_functions)))
+
+typedef struct expression
+{
+    expression_code_stack *code;
+    expression_constant_stack *constants;
+    char variables[EXPRESSION_MAX_VARIABLES][EXPRESSION_MAX_NAME + 1];
+    int variable_count;
+    int temporary_count;
+    // Largest number of values on the evaluation stack
+    int depth;
+} expression;
+
+// Where and why compiling failed
+typedef struct expression_error
+{
+    int position;
+    const char *message;
+} expression_error;
+
+typedef enum expression_token_type
+{
+    EXPRESSION_TOKEN_NUMBER,
+    EXPRESSION_TOKEN_NAME,
+    EXPRESSION_TOKEN_OPERATOR,
+    EXPRESSION_TOKEN_OPEN,
+    EXPRESSION_TOKEN_CLOSE,
+    EXPRESSION_TOKEN_COMMA,
+    EXPRESSION_TOKEN_END,
+    EXPRESSION_TOKEN_INVALID
+} expression_token_type;
+
+typedef struct expression_token
+{
+    expression_token_type type;
+    // Offset of the token in the text, and its number of characters
+    int position;
+    int length;
+    // Value of a number, character of an operator
+    double value;
+    char operator;
+} expression_token;
+
+// The same characters as isspace in the C locale, without a call per character
+static inline bool expression_is_space(char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+/* Length of the number at text[i] with its value in *value, or 0 if it is malformed. A
+ * number running straight into a '.' is malformed, e.g. 1.2.3 or 1. */
+static inline int expression_scan_number(const char *text, int length, int i, double *value)
+{
+    int number = literal_parse(text + i, length - i, value);
+    if (number == 0 || (i + number < length && text[i + number] == '.'))
+    {
+        return 0;
+    }
+    return number;
+}
+
+/* Length of the name at text[i] */
+static inline int expression_scan_name(const char *text, int length, int i)
+{
+    int end = i;
+    while (end < length && (isalnum((unsigned char)text[end]) || text[end] == '_'))
+    {
+        end++;
+    }
+    return end - i;
+}
+
+/* Read the token that starts at or after text[*position], and move *position past it.
+ * Only the first length characters of text are read */
+static inline expression_token expression_next_token(const char *text, int length, int *position)
+{
+    int i = *position;
+    while (i < length && expression_is_space(text[i]))
+    {
+        i++;
+    }
+
+    expression_token token = {EXPRESSION_TOKEN_INVALID, i, 1, 0.0, 0};
+    char c = i < length ? text[i] : '\0';
+    if (i == length)
+    {
+        token.type = EXPRESSION_TOKEN_END;
+        token.length = 0;
+    }
+    else if ((unsigned char)(c - '0') < 10 || c == '.')
+    {
+        int number = expression_scan_number(text, length, i, &token.value);
+        if (number > 0)
+        {
+            token.type = EXPRESSION_TOKEN_NUMBER;
+            token.length = number;
+        }
+    }
+    else if (c == '(' || c == ')')
+    {
+        token.type = c == '(' ? EXPRESSION_TOKEN_OPEN : EXPRESSION_TOKEN_CLOSE;
+    }
+    else if (c == ',')
+    {
+        token.type = EXPRESSION_TOKEN_COMMA;
+    }
+    else if (c == '+' || c == '-' || c == '*' || c == '/' || c == '^')
+    {
+        token.type = EXPRESSION_TOKEN_OPERATOR;
+        token.operator = c;
+    }
+    else if (isalpha((unsigned char)c) || c == '_')
+    {
+        token.length = expression_scan_name(text, length, i);
+        if (token.length <= EXPRESSION_MAX_NAME)
+        {
+            token.type = EXPRESSION_TOKEN_NAME;
+        }
+    }
+
+    *position = i + token.length;
+    return token;
+}
+
+// How strongly a binary operator binds, or 0 for any other character
+static inline int expression_precedence(char symbol)
+{
+    switch (symbol)
+    {
+    case '^':
+        return 3;
+    case '*':
+    case '/':
+        return 2;
+    case '+':
+    case '-':
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static inline expression_opcode expression_operator_opcode(char symbol)
+{
+    switch (symbol)
+    {
+    case '+':
+        return EXPRESSION_ADD;
+    case '-':
+        return EXPRESSION_SUBTRACT;
+    case '*':
+        return EXPRESSION_MULTIPLY;
+    case '/':
+        return EXPRESSION_DIVIDE;
+    default:
+        return EXPRESSION_POWER;
+    }
+}
+
+/* Number of values an operator takes from the stack */
+static inline int expression_arity(expression_opcode opcode, int operand)
+{
+    if (opcode == EXPRESSION_CALL)
+    {
+        return expression_functions[operand].arity;
+    }
+    return opcode == EXPRESSION_NEGATE ? 1 : 2;
+}
+
+/* a (op) b, rounded exactly as expression_evaluate does; b is ignored by operators taking one value */
+static inline double expression_apply(expression_opcode opcode, int operand, double a, double b)
+{
+    switch (opcode)
+    {
+    case EXPRESSION_ADD:
+        return a + b;
+    case EXPRESSION_SUBTRACT:
+        return a - b;
+    case EXPRESSION_MULTIPLY:
+        return a * b;
+    case EXPRESSION_DIVIDE:
+        return a / b;
+    case EXPRESSION_POWER:
+        return pow(a, b);
+    case EXPRESSION_NEGATE:
+        return -a;
+    default:
+        return expression_functions[operand].arity == 1 ? expression_functions[operand].unary(a)
+                                                          : expression_functions[operand].binary(a, b);
+    }
+}
+
+/* Index of the function with the given name of length characters, or -1 if there is none */
+static inline int expression_function_index(const char *name, int length)
+{
+    for (int i = 0; i < EXPRESSION_FUNCTION_COUNT; i++)
+    {
+        if (strncmp(expression_functions[i].name, name, length) == 0 && expression_functions[i].name[length] == '\0')
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Index of the variable with this name, or -1 if the expression does not use it */
+static inline int expression_variable(const expression *compiled, const char *name)
+{
+    assert(compiled);
+    for (int i = 0; i < compiled->variable_count; i++)
+    {
+        if (strcmp(compiled->variables[i], name) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Append an instruction, keeping track of how many values it leaves on the stack */
+static inline void expression_emit(expression *compiled, expression_opcode opcode, int operand, int *depth)
+{
+    stack_expression_code_push(compiled->code, (expression_instruction){opcode, operand});
+    if (opcode == EXPRESSION_CONSTANT || opcode == EXPRESSION_VARIABLE || opcode == EXPRESSION_LOAD)
+    {
+        *depth += 1;
+    }
+    else if (opcode != EXPRESSION_STORE)
+    {
+        *depth -= expression_arity(opcode, operand) - 1;
+    }
+    if (*depth > compiled->depth)
+    {
+        compiled->depth = *depth;
+    }
+}
+
+static inline void expression_free(expression *compiled)
+{
+    assert(compiled);
+    if (compiled->code)
+    {
+        stack_expression_code_free(compiled->code);
+        stack_expression_constant_free(compiled->constants);
+    }
+    compiled->code = NULL;
+    compiled->constants = NULL;
+}
+
+/* State of the precedence climbing parser. Every operand and operator it reads is
+ * emitted straight away in postfix order: as bytecode into compiled, or, without
+ * compiled, by doing the operation on values. It reads characters rather than
+ * tokens, so looking at the next operator costs no more than skipping spaces */
+typedef struct expression_parser
+{
+    const char *text;
+    int length;
+    // Offset of the next character to be parsed
+    int position;
+    expression *compiled;
+    // Values on the stack, in the bytecode when compiling
+    int depth;
+    double values[EXPRESSION_MAX_DEPTH];
+    // Brackets, unary minuses and function calls inside each other, limited so that they cannot
+    // overflow the C stack. Operators only recurse with a value on the stack, so depth limits those
+    int nesting;
+    // First error, if any
+    const char *message;
+    int error_position;
+} expression_parser;
+
+static inline void expression_parser_fail(expression_parser *parser, int position, const char *message)
+{
+    if (!parser->message)
+    {
+        parser->message = message;
+        parser->error_position = position;
+    }
+    // Every loop of the parser stops at the end, so it returns without reading further
+    parser->position = parser->length;
+}
+
+/* Fail at the current position, where message says what was expected, unless the text
+ * there is not a valid token at all. Errors are rare, so the tokenizer finds out */
+static inline void expression_parser_unexpected(expression_parser *parser, const char *message)
+{
+    int position = parser->position;
+    expression_token token = expression_next_token(parser->text, parser->length, &position);
+    expression_parser_fail(parser, token.position,
+                           token.type == EXPRESSION_TOKEN_INVALID ? "invalid character or number" : message);
+}
+
+/* Skip spaces and return the next character, or '\0' at the end of the text */
+static inline char expression_parser_peek(expression_parser *parser)
+{
+    while (parser->position < parser->length && expression_is_space(parser->text[parser->position]))
+    {
+        parser->position++;
+    }
+    return parser->position < parser->length ? parser->text[parser->position] : '\0';
+}
+
+/* Emit a constant or variable that starts at position */
+static inline void expression_parser_push(expression_parser *parser, int position, expression_opcode opcode,
+                                          int operand, double value)
+{
+    if (parser->depth == EXPRESSION_MAX_DEPTH)
+    {
+        expression_parser_fail(parser, position, "expression nested too deeply");
+        return;
+    }
+    if (!parser->compiled)
+    {
+        parser->values[parser->depth++] = value;
+        return;
+    }
+    if (opcode == EXPRESSION_CONSTANT)
+    {
+        stack_expression_constant_push(parser->compiled->constants, value);
+        operand = parser->compiled->constants->size - 1;
+    }
+    expression_emit(parser->compiled, opcode, operand, &parser->depth);
+}
+
+/* Emit an operator or function call, whose operands have been emitted */
+static inline void expression_parser_operate(expression_parser *parser, expression_opcode opcode, int operand)
+{
+    if (parser->message)
+    {
+        return;
+    }
+    if (parser->compiled)
+    {
+        expression_emit(parser->compiled, opcode, operand, &parser->depth);
+        return;
+    }
+    double *values = parser->values;
+    if (expression_arity(opcode, operand) == 1)
+    {
+        values[parser->depth - 1] = expression_apply(opcode, operand, values[parser->depth - 1], 0.0);
+    }
+    else
+    {
+        parser->depth--;
+        values[parser->depth - 1] = expression_apply(opcode, operand, values[parser->depth - 1], values[parser->depth]);
+    }
+}
+
+/* Emit the variable whose name of length characters starts at position */
+static inline void expression_parser_variable(expression_parser *parser, int position, int length)
+{
+    expression *compiled = parser->compiled;
+    if (!compiled)
+    {
+        expression_parser_fail(parser, position, "variables need a compiled expression");
+        return;
+    }
+    char name[EXPRESSION_MAX_NAME + 1];
+    memcpy(name, parser->text + position, length);
+    name[length] = '\0';
+    int index = expression_variable(compiled, name);
+    if (index < 0 && compiled->variable_count == EXPRESSION_MAX_VARIABLES)
+    {
+        expression_parser_fail(parser, position, "too many variables");
+        return;
+    }
+    if (index < 0)
+    {
+        index = compiled->variable_count++;
+        strcpy(compiled->variables[index], name);
+    }
+    expression_parser_push(parser, position, EXPRESSION_VARIABLE, index, 0.0);
+}
+
+static inline void expression_parse_unary(expression_parser *parser);
+static inline void expression_parse_operators(expression_parser *parser, int precedence);
+
+/* An operand followed by any operators that bind at least as strongly as precedence, with their operands */
+static inline void expression_parse_binary(expression_parser *parser, int precedence)
+{
+    if (++parser->nesting > EXPRESSION_MAX_DEPTH)
+    {
+        expression_parser_fail(parser, parser->position, "expression nested too deeply");
+    }
+    expression_parse_unary(parser);
+    expression_parse_operators(parser, precedence);
+    parser->nesting--;
+}
+
+/* Arguments of a call to the function whose name of length characters starts at position,
+ * from the '(' up to and including the ')' */
+static inline void expression_parse_call(expression_parser *parser, int position, int length)
+{
+    int function = expression_function_index(parser->text + position, length);
+    if (function < 0)
+    {
+        expression_parser_fail(parser, position, "unknown function");
+        return;
+    }
+    parser->position++;
+    for (int i = 0; i < expression_functions[function].arity; i++)
+    {
+        if (i > 0)
+        {
+            char c = expression_parser_peek(parser);
+            if (c != ',')
+            {
+                expression_parser_unexpected(parser, c == ')' ? "too few arguments" : "expected ',' or ')'");
+                return;
+            }
+            parser->position++;
+        }
+        expression_parse_binary(parser, 1);
+    }
+    char c = expression_parser_peek(parser);
+    if (c != ')')
+    {
+        expression_parser_unexpected(parser, c == ',' ? "too many arguments" : "expected ',' or ')'");
+        return;
+    }
+    parser->position++;
+    expression_parser_operate(parser, EXPRESSION_CALL, function);
+}
+
+/* The variable or function call starting at start */
+static inline void expression_parse_name(expression_parser *parser, int start)
+{
+    int length = expression_scan_name(parser->text, parser->length, start);
+    if (length > EXPRESSION_MAX_NAME)
+    {
+        expression_parser_fail(parser, start, "invalid character or number");
+        return;
+    }
+    parser->position += length;
+    if (expression_parser_peek(parser) == '(')
+    {
+        expression_parse_call(parser, start, length);
+    }
+    else
+    {
+        expression_parser_variable(parser, start, length);
+    }
+}
+
+/* The number at the current position */
+static inline void expression_parse_number(expression_parser *parser)
+{
+    int start = parser->position;
+    double value;
+    int length = expression_scan_number(parser->text, parser->length, start, &value);
+    if (length == 0)
+    {
+        expression_parser_fail(parser, start, "invalid character or number");
+        return;
+    }
+    expression_parser_push(parser, start, EXPRESSION_CONSTANT, 0, value);
+    parser->position += length;
+}
+
+/* A number, variable, call or bracketed expression, possibly after unary minuses */
+static inline void expression_parse_unary(expression_parser *parser)
+{
+    char c = expression_parser_peek(parser);
+    int start = parser->position;
+    if ((unsigned char)(c - '0') < 10 || c == '.')
+    {
+        expression_parse_number(parser);
+    }
+    else if (c == '(')
+    {
+        parser->position++;
+        expression_parse_binary(parser, 1);
+        c = expression_parser_peek(parser);
+        if (c != ')')
+        {
+            expression_parser_unexpected(parser, c == '\0' ? "missing ')'" : "expected an operator or ')'");
+            return;
+        }
+        parser->position++;
+    }
+    else if (c == '-')
+    {
+        // -2 ^ 2 is -(2 ^ 2), but -2 * 3 is (-2) * 3
+        parser->position++;
+        expression_parse_binary(parser, expression_precedence('^'));
+        expression_parser_operate(parser, EXPRESSION_NEGATE, 0);
+    }
+    else if (isalpha((unsigned char)c) || c == '_')
+    {
+        expression_parse_name(parser, start);
+    }
+    else
+    {
+        expression_parser_unexpected(parser, "expected a number, variable or '('");
+    }
+}
+
+/* Operators that bind at least as strongly as precedence, with their operands, after an
+ * operand that has already been emitted. A chain of operators of equal precedence is done
+ * in this loop, left to right, and it only recurses where an operator binds more strongly
+ * than the one before it, or for the right operand of ^, which takes in the rest of a ^
+ * chain. So 1 + 2 + 3 takes one call, and 1 + 2 * 3 ^ 4 three */
+static inline void expression_parse_operators(expression_parser *parser, int precedence)
+{
+    while (true)
+    {
+        char symbol = expression_parser_peek(parser);
+        int binding = expression_precedence(symbol);
+        if (binding == 0 || binding < precedence)
+        {
+            break;
+        }
+        parser->position++;
+        // Most operands are numbers, which need no call
+        char c = expression_parser_peek(parser);
+        if ((unsigned char)(c - '0') < 10 || c == '.')
+        {
+            expression_parse_number(parser);
+        }
+        else
+        {
+            expression_parse_unary(parser);
+        }
+        while (true)
+        {
+            int next = expression_precedence(expression_parser_peek(parser));
+            if (next > binding)
+            {
+                expression_parse_operators(parser, binding + 1);
+            }
+            else if (next == binding && symbol == '^')
+            {
+                expression_parse_operators(parser, binding);
+            }
+            else
+            {
+                break;
+            }
+        }
+        expression_parser_operate(parser, expression_operator_opcode(symbol), 0);
+    }
+}
+
+/* Parse the first length characters of text, emitting into compiled, or evaluating them if
+ * compiled is NULL. Returns false and fills in *error (may be NULL) on an invalid expression */
+static inline bool expression_parse(expression_parser *parser, const char *text, int length, expression *compiled,
+                                    expression_error *error)
+{
+    parser->text = text;
+    parser->length = length;
+    parser->position = 0;
+    parser->compiled = compiled;
+    parser->depth = 0;
+    parser->nesting = 0;
+    parser->message = NULL;
+    parser->error_position = 0;
+
+    expression_parse_binary(parser, 1);
+    char c = expression_parser_peek(parser);
+    if (parser->position < parser->length)
+    {
+        expression_parser_unexpected(parser, c == ')' ? "unmatched ')'" : "expected an operator or ')'");
+    }
+    if (parser->message && error)
+    {
+        error->position = parser->error_position;
+        error->message = parser->message;
+    }
+    return !parser->message;
+}
+
+/* Compile text into *compiled, which must later be released with expression_free.
+ * Returns false and fills in *error (may be NULL) if text is not a valid expression,
+ * in which case nothing needs to be released */
+static inline bool expression_compile(expression *compiled, const char *text, expression_error *error)
+{
+    assert(compiled);
+    assert(text);
+    compiled->code = stack_expression_code_create();
+    compiled->constants = stack_expression_constant_create();
+    compiled->variable_count = 0;
+    compiled->temporary_count = 0;
+    compiled->depth = 0;
+
+    expression_parser parser;
+    if (!expression_parse(&parser, text, strlen(text), compiled, error))
+    {
+        expression_free(compiled);
+        return false;
+    }
+    return true;
+}
+
+/* Evaluate the first length characters of text, an expression without variables, into
+ * *value while parsing it. Returns false and fills in *error (may be NULL) if it is not
+ * a valid expression */
+static inline bool expression_calculate(const char *text, int length, double *value, expression_error *error)
+{
+    assert(text);
+    assert(value);
+    expression_parser parser;
+    if (!expression_parse(&parser, text, length, NULL, error))
+    {
+        return false;
+    }
+    *value = parser.values[0];
+    return true;
+}
+
+/* Value of a compiled expression, with variables[i] the value of variable i */
+static inline double expression_evaluate(const expression *compiled, const double *variables)
+{
+    double values[EXPRESSION_MAX_DEPTH];
+    double temporaries[EXPRESSION_MAX_TEMPORARIES];
+    // A compiled expression has at least one instruction, but the compiler cannot see that
+    values[0] = 0.0;
+    int size = 0;
+    const expression_instruction *code = compiled->code->storage_array;
+    const double *constants = compiled->constants->storage_array;
+    int length = compiled->code->size;
+
+    for (int i = 0; i < length; i++)
+    {
+        switch (code[i].opcode)
+        {
+        case EXPRESSION_CONSTANT:
+            values[size++] = constants[code[i].operand];
+            break;
+        case EXPRESSION_VARIABLE:
+            values[size++] = variables[code[i].operand];
+            break;
+        case EXPRESSION_ADD:
+            size--;
+            values[size - 1] = values[size - 1] + values[size];
+            break;
+        case EXPRESSION_SUBTRACT:
+            size--;
+            values[size - 1] = values[size - 1] - values[size];
+            break;
+        case EXPRESSION_MULTIPLY:
+            size--;
+            values[size - 1] = values[size - 1] * values[size];
+            break;
+        case EXPRESSION_DIVIDE:
+            size--;
+            values[size - 1] = values[size - 1] / values[size];
+            break;
+        case EXPRESSION_POWER:
+            size--;
+            values[size - 1] = pow(values[size - 1], values[size]);
+            break;
+        case EXPRESSION_NEGATE:
+            values[size - 1] = -values[size - 1];
+            break;
+        case EXPRESSION_CALL:
+            if (expression_functions[code[i].operand].arity == 1)
+            {
+                values[size - 1] = expression_functions[code[i].operand].unary(values[size - 1]);
+            }
+            else
+            {
+                size--;
+                values[size - 1] = expression_functions[code[i].operand].binary(values[size - 1], values[size]);
+            }
+            break;
+        case EXPRESSION_LOAD:
+            values[size++] = temporaries[code[i].operand];
+            break;
+        case EXPRESSION_STORE:
+            temporaries[code[i].operand] = values[size - 1];
+            break;
+        }
+    }
+    return values[0];
+}
+
+#endif
@@ -0,0 +1,418 @@
+/* Generic HASH MAP datastructure (using macro's)
+ * Open addressing in the style of SwissTable: next to the array of entries there is
+ * one control byte per slot, holding EMPTY, DELETED or the low 7 bits of the hash of
+ * the key in that slot. Slots are probed a group of 16 control bytes at a time: with
+ * SSE2 a single compare finds every slot in the group whose 7 bits match, so the key
+ * itself is only compared for about 1 in 128 of the other slots.
+ * 'hash' takes a key and returns a uint64_t, 'eq' takes two keys and returns true if
+ * they are equal. Both are called directly, so they can be functions or macros.
+ * The *_hashed functions take a hash computed by the caller, for keys that are looked
+ * up more than once or whose hash comes for free while reading them.
+ *
+ * DEFINE_STRING_HASHMAP_TYPE(V, prefix) maps const char * keys to V; its
+ * hashmap_upsert_string copies a key into an arena the first time it is inserted, so
+ * the map never owns or frees individual strings.
+ */
+
+#ifndef HASHMAP_H
+#define HASHMAP_H
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "allocator.h"
+
+#define HASHMAP_GROUP_WIDTH 16
+
+// Keys shorter than this are terminated on the stack by upsert_string_hashed, longer ones on the heap
+#define HASHMAP_STRING_BUFFER 256
+
+// Control bytes: a full slot holds the low 7 bits of its hash, so its top bit is clear
+#define HASHMAP_EMPTY ((int8_t)-128)
+#define HASHMAP_DELETED ((int8_t)-2)
+
+/* Bit i is set when control byte i of the group equals byte */
+static inline uint32_t hashmap_match(const int8_t *group, int8_t byte)
+{
+#ifdef __SSE2__
+    __m128i control = _mm_loadu_si128((const __m128i *)group);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8(byte)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < HASHMAP_GROUP_WIDTH; i++)
+    {
+        mask |= (uint32_t)(group[i] == byte) << i;
+    }
+    return mask;
+#endif
+}
+
+/* Bit i is set when slot i of the group is EMPTY or DELETED */
+static inline uint32_t hashmap_match_free(const int8_t *group)
+{
+#ifdef __SSE2__
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < HASHMAP_GROUP_WIDTH; i++)
+    {
+        mask |= (uint32_t)(group[i] < 0) << i;
+    }
+    return mask;
+#endif
+}
+
+/* FNV-1a over the bytes of a string, one byte at a time so a tokenizer can hash a word
+ * while reading it: start from HASHMAP_STRING_SEED, add every byte with hashmap_string_step
+ * and finish with hashmap_string_finish, which mixes the bits so the top and bottom are usable */
+#define HASHMAP_STRING_SEED 0xcbf29ce484222325
+
+static inline uint64_t hashmap_string_step(uint64_t hash, char c)
+{
+    return (hash ^ (unsigned char)c) * 0x100000001b3;
+}
+
+static inline uint64_t hashmap_string_finish(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccd;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static inline uint64_t hashmap_string_hash(const char *key)
+{
+    uint64_t hash = HASHMAP_STRING_SEED;
+    for (; *key; key++)
+    {
+        hash = hashmap_string_step(hash, *key);
+    }
+    return hashmap_string_finish(hash);
+}
+
+static inline bool hashmap_string_equal(const char *a, const char *b)
+{
+    return strcmp(a, b) == 0;
+}
+
+/* Copy length bytes of key into the arena, followed by '\0' */
+static inline char *hashmap_arena_string(arena *key_arena, const char *key, size_t length)
+{
+    char *copy = arena_allocate(key_arena, length + 1);
+    memcpy(copy, key, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+/* The capacity is a power of two and at least one group. At most 7/8 of the slots
+ * are in use (full or DELETED), so every probe sequence ends at an EMPTY slot. */
+#define DEFINE_HASHMAP_TYPE(K, V, prefix, hash, eq)                                                                  \
+    typedef struct prefix##_hashmap_entry                                                                            \
+    {                                                                                                                \
+        K key;                                                                                                       \
+        V value;                                                                                                     \
+    } prefix##_hashmap_entry;                                                                                        \
+                                                                                                                     \
+    typedef struct prefix##_hashmap                                                                                  \
+    {                                                                                                                \
+        int capacity;                                                                                                \
+        int size;                                                                                                    \
+        int deleted;                                                                                                 \
+        int8_t *control;                                                                                             \
+        prefix##_hashmap_entry *entries;                                                                             \
+        const allocator *allocator;                                                                                  \
+        long allocations;                                                                                            \
+    } prefix##_hashmap;                                                                                              \
+                                                                                                                     \
+    /* Allocate control bytes (all EMPTY) and entries for capacity slots */                                          \
+    void hashmap_##prefix##_allocate(prefix##_hashmap *map, int capacity)                                            \
+    {                                                                                                                \
+        map->capacity = capacity;                                                                                    \
+        map->size = 0;                                                                                               \
+        map->deleted = 0;                                                                                            \
+        map->control = map->allocator->allocate(map->allocator->context, capacity);                                  \
+        map->entries = map->allocator->allocate(map->allocator->context, sizeof(*map->entries) * capacity);          \
+        assert(map->control && map->entries);                                                                        \
+        memset(map->control, HASHMAP_EMPTY, capacity);                                                               \
+        map->allocations += 2;                                                                                       \
+    }                                                                                                                \
+                                                                                                                     \
+    /* Return pointer to empty hash map whose memory comes from the given allocator */                               \
+    prefix##_hashmap *hashmap_##prefix##_create_with(const allocator *allocator)                                     \
+    {                                                                                                                \
+        prefix##_hashmap *map = allocator->allocate(allocator->context, sizeof(*map));                               \
+                                                                                                                     \
+        assert(map);                                                                                                 \
+        map->allocator = allocator;                                                                                  \
+        map->allocations = 1;                                                                                        \
+        hashmap_##prefix##_allocate(map, HASHMAP_GROUP_WIDTH);                                                       \
+        return map;                                                                                                  \
+    }                                                                                                                \
+                                                                                                                     \
+    /* Return pointer to empty hash map */                                                                           \
+    prefix##_hashmap *hashmap_##prefix##_create(void)                                                                \
+    {                                                                                                                \
+        return hashmap_##prefix##_create_with(&HEAP_ALLOCATOR);                                                      \
+    }                                                                                                                \
+                                                                                                                     \
+    void hashmap_##prefix##_free(prefix##_hashmap *map)                                                              \
+    {                                                                                                                \
+        assert(map);                                                                                                 \
+        const allocator *allocator = map->allocator;                                                                 \
+        allocator->release(allocator->context, map->control, map->capacity);                                         \
+        allocator->release(allocator->context, map->entries, sizeof(*map->entries) * map->capacity);                 \
+        map->control = NULL;                                                                                         \
+        map->entries = NULL;                                                                                         \
+        allocator->release(allocator->context, map, sizeof(*map));                                                   \
+        map = NULL;                                                                                                  \
+    }                                                                                                                \
+                                                                                                                     \
+    bool hashmap_##prefix##_is_empty(const prefix##_hashmap *map)                                                    \
+    {                                                                                                                \
+        assert(map);                                                                                                 \
+        return map->size == 0;                                                                                       \
+    }                                                                                                                \
+                                                                                                                     \
+    /* Index of the slot holding key, or -1 */                                                                       \
+    int hashmap_##prefix##_find_slot(const prefix##_hashmap *map, K key, uint64_t key_hash)                          \
+    {                                                                                                                \
+        int8_t fingerprint = key_hash & 0x7f;                                                                        \
+        int group_mask = map->capacity / HASHMAP_GROUP_WIDTH - 1;                                                    \
+        int group = (key_hash >> 7) & group_mask;                                                                    \
+                                                                                                                     \
+        /* Triangular probing over groups visits every group once */                                                 \
+        for (int step = 1;; step++)                                                                                  \
+        {                                                                                                            \
+            const int8_t *control = map->control + group * HASHMAP_GROUP_WIDTH;                                      \
+            for (uint32_t match = hashmap_match(control, fingerprint); match; match &= match - 1)                    \
+            {                                                                                                        \
+                int slot = group * HASHMAP_GROUP_WIDTH + __builtin_ctz(match);                                       \
+                if (eq(map->entries[slot].key, key))                                                                 \
+                {                                                                                                    \
+                    return slot;                                                                                     \
+                }                                                                                                    \
+            }                                                                                                        \
+            if (hashmap_match(control, HASHMAP_EMPTY))                                                               \
+            {                                                                                                        \
+                return -1;                                                                                           \
+            }                                                                                                        \
+            group = (group + step) & group_mask;                                                                     \
+        }                                                                                                            \
+    }                                                                                                                \
+                                                                                                                     \
+    /* Index of the first EMPTY or DELETED slot on the probe sequence of key_hash */                                 \
+    int hashmap_##prefix##_free_slot(const prefix##_hashmap *map, uint64_t key_hash)                                 \
+    {                                                                                                                \
+        int group_mask = map->capacity / HASHMAP_GROUP_WIDTH - 1;                                                    \
+        int group = (key_hash >> 7) & group_mask;                                                                    \
+                                                                                                                     \
+        for (int step = 1;; step++)                                                                                  \
+        {                                                                                                            \
+            uint32_t match = hashmap_match_free(map->control + group * HASHMAP_GROUP_WIDTH);                         \
+            if (match)                                                                                               \
+            {                                                                                                        \
+                return group * HASHMAP_GROUP_WIDTH + __builtin_ctz(match);                                           \
+            }                                                                                                        \
+            group = (group + step) & group_mask;                                                                     \
+        }                                                                                                            \
+    }                                                                                                                \
+                                                                                                                     \
+    /* Move all entries into a table of the given capacity, dropping DELETED slots */                                \
+    void hashmap_##prefix##_rehash(prefix##_hashmap *map, int capacity)                                              \
+    {                                                                                                                \
+        int8_t *old_control = map->control;                                                                          \
+        prefix##_hashmap_entry *old_entries = map->entries;                                                          \
+        int old_capacity = map->capacity;                                                                            \
+        int size = map->size;                                                                                        \
+                                                                                                                     \
+        hashmap_##prefix##_allocate(map, capacity);                                                                  \
+        for (int i = 0; i < old_capacity; i++)                                                                       \
+        {                                                                                                            \
+            if (old_control[i] >= 0)                                                                                 \
+            {                                                                                                        \
+                uint64_t key_hash = hash(old_entries[i].key);                                                        \
+                int slot = hashmap_##prefix##_free_slot(map, key_hash);                                              \
+                map->control[slot] = key_hash & 0x7f;                                                                \
+                map->entries[slot] = old_entries[i];                                                                 \
+            }                                                                                                        \
+        }                                                                                                            \
+        map->size = size;                                                                                            \
+        map->allocator->release(map->allocator->context, old_control, old_capacity);                                 \
+        map->allocator->release(map->allocator->context, old_entries, sizeof(*old_entries) * old_capacity);          \
+    }                                                                                                                \
+                                                                                                                     \
+    /* Make room for n entries in total without any further rehashing */                                             \
+    void hashmap_##prefix##_reserve(prefix##_hashmap *map, int n)                                                    \
+    {                                                                                                                \
+        assert(map);                                                                                                 \
+        assert(n >= 0);                                                                                              \
+        int capacity = map->capacity;                                                                                \
+        while (n > capacity / 8 * 7)                                                                                 \
+        {                                                                                                            \
+            capacity *= 2;                                                                                           \
+        }                                                                                                            \
+        if (capacity > map->capacity)                                                                                \
+        {                                                                                                            \
+            hashmap_##prefix##_rehash(map, capacity);                                                                \
+        }                                                                                                            \
+    }                                                                                                                \
+                                                                                                                     \
+    /* Return pointer to the value stored for key, or NULL if there is none */                                       \
+    V *hashmap_##prefix##_find_hashed(const prefix##_hashmap *map, K key, uint64_t key_hash)                         \
+    {                                                                                                                \
+        assert(map);                                                                                                 \
+        int slot = hashmap_##prefix##_find_slot(map, key, key_hash);                                                 \
+        return slot < 0 ? NULL : &map->entries[slot].value;                                                          \
+    }                                                                                                                \
+                                                                                                                     \
+    V *hashmap_##prefix##_find(const prefix##_hashmap *map, K key)                                                   \
+    {                                                                                                                \
+        return hashmap_##prefix##_find_hashed(map, key, hash(key));                                                  \
+    }                                                                                                                \
+                                                                                                                     \
+    /* Return the entry for key, inserting key with value if it is not there yet.                                    \
+     * *inserted tells which happened (may be NULL). A new entry's key may be replaced                               \
+     * by an equal key with the same hash, e.g. a copy that outlives the original. */                                \
+    prefix##_hashmap_entry *hashmap_##prefix##_upsert_hashed(prefix##_hashmap *map, K key, uint64_t key_hash,        \
+                                                             V value, bool *inserted)                                \
+    {                                                                                                                \
+        assert(map);                                                                                                 \
+        int slot = hashmap_##prefix##_find_slot(map, key, key_hash);                                                 \
+        if (inserted)                                                                                                \
+        {                                                                                                            \
+            *inserted = slot < 0;                                                                                    \
+        }                                                                                                            \
+        if (slot >= 0)                                                                                               \
+        {                                                                                                            \
+            return &map->entries[slot];                                                                              \
+        }                                                                                                            \
+                                                                                                                     \
+        if (map->size + map->deleted >= map->capacity / 8 * 7)                                                       \
+        {                                                                                                            \
+            /* Grow if mostly full, otherwise rehashing in place clears the DELETED slots */                         \
+            hashmap_##prefix##_rehash(map, map->size >= map->capacity / 16 * 7 ? map->capacity * 2 : map->capacity); \
+        }                                                                                                            \
+        slot = hashmap_##prefix##_free_slot(map, key_hash);                                                          \
+        if (map->control[slot] == HASHMAP_DELETED)                                                                   \
+        {                                                                                                            \
+            map->deleted--;                                                                                          \
+        }                                                                                                            \
+        map->control[slot] = key_hash & 0x7f;                                                                        \
+        map->entries[slot].key = key;                                                                                \
+        map->entries[slot].value = value;                                                                            \
+        map->size++;                                                                                                 \
+        return &map->entries[slot];                                                                                  \
+    }                                                                                                                \
+                                                                                                                     \
+    prefix##_hashmap_entry *hashmap_##prefix##_upsert(prefix##_hashmap *map, K key, V value, bool *inserted)         \
+    {                                                                                                                \
+        return hashmap_##prefix##_upsert_hashed(map, key, hash(key), value, inserted);                               \
+    }                                                                                                                \
+                                                                                                                     \
+    /* Store value for key, replacing the value it had */                                                            \
+    void hashmap_##prefix##_insert(prefix##_hashmap *map, K key, V value)                                            \
+    {                                                                                                                \
+        hashmap_##prefix##_upsert(map, key, value, NULL)->value = value;                                             \
+    }                                                                                                                \
+                                                                                                                     \
+    /* Remove key, storing its entry in *removed (may be NULL). Returns false if key was not there */                \
+    bool hashmap_##prefix##_remove_hashed(prefix##_hashmap *map, K key, uint64_t key_hash,                           \
+                                          prefix##_hashmap_entry *removed)                                           \
+    {                                                                                                                \
+        assert(map);                                                                                                 \
+        int slot = hashmap_##prefix##_find_slot(map, key, key_hash);                                                 \
+        if (slot < 0)                                                                                                \
+        {                                                                                                            \
+            return false;                                                                                            \
+        }                                                                                                            \
+        if (removed)                                                                                                 \
+        {                                                                                                            \
+            *removed = map->entries[slot];                                                                           \
+        }                                                                                                            \
+                                                                                                                     \
+        /* A probe only passes a group without EMPTY slots, so if this group has one                                 \
+         * no probe runs past it and the slot can be EMPTY instead of DELETED */                                     \
+        const int8_t *group = map->control + slot / HASHMAP_GROUP_WIDTH * HASHMAP_GROUP_WIDTH;                       \
+        if (hashmap_match(group, HASHMAP_EMPTY))                                                                     \
+        {                                                                                                            \
+            map->control[slot] = HASHMAP_EMPTY;                                                                      \
+        }                                                                                                            \
+        else                                                                                                         \
+        {                                                                                                            \
+            map->control[slot] = HASHMAP_DELETED;                                                                    \
+            map->deleted++;                                                                                          \
+        }                                                                                                            \
+        map->size--;                                                                                                 \
+        return true;                                                                                                 \
+    }                                                                                                                \
+                                                                                                                     \
+    bool hashmap_##prefix##_remove(prefix##_hashmap *map, K key, prefix##_hashmap_entry *removed)                    \
+    {                                                                                                                \
+        return hashmap_##prefix##_remove_hashed(map, key, hash(key), removed);                                       \
+    }                                                                                                                \
+                                                                                                                     \
+    /* Return the next entry after slot *index (start at -1), or NULL after the last one */                          \
+    prefix##_hashmap_entry *hashmap_##prefix##_next(const prefix##_hashmap *map, int *index)                         \
+    {                                                                                                                \
+        assert(map);                                                                                                 \
+        while (++*index < map->capacity)                                                                             \
+        {                                                                                                            \
+            if (map->control[*index] >= 0)                                                                           \
+            {                                                                                                        \
+                return &map->entries[*index];                                                                        \
+            }                                                                                                        \
+        }                                                                                                            \
+        return NULL;                                                                                                 \
+    }
+
+#define DEFINE_STRING_HASHMAP_TYPE(V, prefix)                                                                      \
+    DEFINE_HASHMAP_TYPE(const char *, V, prefix, hashmap_string_hash, hashmap_string_equal)                        \
+                                                                                                                   \
+    /* Like hashmap_upsert_hashed, but a newly inserted key is first copied into key_arena.                        \
+     * key does not need to be terminated, only its first length bytes are used */                                 \
+    prefix##_hashmap_entry *hashmap_##prefix##_upsert_string_hashed(prefix##_hashmap *map, arena *key_arena,       \
+                                                                    const char *key, size_t length,                \
+                                                                    uint64_t key_hash, V value, bool *inserted)    \
+    {                                                                                                              \
+        bool is_new;                                                                                               \
+        char stack_buffer[HASHMAP_STRING_BUFFER];                                                                  \
+        char *buffer = length < HASHMAP_STRING_BUFFER ? stack_buffer : malloc(length + 1);                         \
+        assert(buffer);                                                                                            \
+        memcpy(buffer, key, length);                                                                               \
+        buffer[length] = '\0';                                                                                     \
+        prefix##_hashmap_entry *entry = hashmap_##prefix##_upsert_hashed(map, buffer, key_hash, value, &is_new);   \
+        if (is_new)                                                                                                \
+        {                                                                                                          \
+            entry->key = hashmap_arena_string(key_arena, key, length);                                             \
+        }                                                                                                          \
+        if (buffer != stack_buffer)                                                                                \
+        {                                                                                                          \
+            free(buffer);                                                                                          \
+        }                                                                                                          \
+        if (inserted)                                                                                              \
+        {                                                                                                          \
+            *inserted = is_new;                                                                                    \
+        }                                                                                                          \
+        return entry;                                                                                              \
+    }                                                                                                              \
+                                                                                                                   \
+    prefix##_hashmap_entry *hashmap_##prefix##_upsert_string(prefix##_hashmap *map, arena *key_arena,              \
+                                                             const char *key, V value, bool *inserted)             \
+    {                                                                                                              \
+        return hashmap_##prefix##_upsert_string_hashed(map, key_arena, key, strlen(key), hashmap_string_hash(key), \
+                                                       value, inserted);                                           \
+    }
+
+/* Iterate over all entries of a hash map, in no particular order */
+#define HASHMAP_FOREACH(prefix, entry, map)                                                         \
+    for (int entry##_index = -1; entry##_index == -1; entry##_index = 0)                            \
+        for (prefix##_hashmap_entry *entry = hashmap_##prefix##_next((map), &entry##_index); entry; \
+             entry = hashmap_##prefix##_next((map), &entry##_index))
+
+#endif
@@ -0,0 +1,127 @@
+/* Compares three ways of reading n random decimal literals of up to 17 digits:
+ * the digit loop get_solution used to have (a multiplication or division per
+ * digit, with an int divider that overflows after 9 decimals), strtod, and
+ * literal_parse. literal_parse must agree with strtod bit for bit; the number of
+ * literals the old loop got wrong is printed.
+ * Usage: ./literal-benchmark [n]
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "literal.h"
+
+double seconds_since(struct timespec start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+// The former digit loop of get_solution, for a literal without exponent
+int digit_loop_parse(const char *text, double *value)
+{
+    double current_value = 0.0;
+    int decimal_divider = 0;
+    int i = 0;
+    for (; (text[i] >= '0' && text[i] <= '9') || text[i] == '.'; i++)
+    {
+        if (text[i] == '.')
+        {
+            decimal_divider = 10;
+        }
+        else if (decimal_divider > 0)
+        {
+            current_value += ((double)(text[i] - '0')) / decimal_divider;
+            // Wraps around like the int in get_solution did, without the undefined behaviour
+            decimal_divider = (int)((unsigned)decimal_divider * 10);
+        }
+        else
+        {
+            current_value = current_value * 10 + (text[i] - '0');
+        }
+    }
+    *value = current_value;
+    return i;
+}
+
+int main(int argc, char *argv[])
+{
+    int n = 1000000;
+    if (argc > 1)
+    {
+        n = atoi(argv[1]);
+    }
+    if (n < 1)
+    {
+        printf("Usage: ./literal-benchmark [n], with n >= 1\n");
+        return 1;
+    }
+
+    // Literals separated by '\0', like prices, coordinates and measurements
+    char *text = malloc(n * 20);
+    int *starts = malloc(n * sizeof(*starts));
+    double *expected = malloc(n * sizeof(*expected));
+    double *values = malloc(n * sizeof(*values));
+    assert(text && starts && expected && values);
+    srand(time(NULL));
+    int length = 0;
+    for (int i = 0; i < n; i++)
+    {
+        starts[i] = length;
+        int digits = 1 + rand() % 17;
+        int point = rand() % (digits + 1);
+        for (int j = 0; j < digits; j++)
+        {
+            if (j == point && j > 0)
+            {
+                text[length++] = '.';
+            }
+            text[length++] = '0' + rand() % 10;
+        }
+        text[length++] = '\0';
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < n; i++)
+    {
+        expected[i] = strtod(text + starts[i], NULL);
+    }
+    double parsed_strtod = seconds_since(start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < n; i++)
+    {
+        digit_loop_parse(text + starts[i], &values[i]);
+    }
+    double parsed_loop = seconds_since(start);
+    int wrong = 0;
+    for (int i = 0; i < n; i++)
+    {
+        wrong += memcmp(&values[i], &expected[i], sizeof(*values)) != 0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < n; i++)
+    {
+        // The '\0' stops the literal, and the next one is still readable memory
+        literal_parse(text + starts[i], length - starts[i], &values[i]);
+    }
+    double parsed_literal = seconds_since(start);
+    assert(memcmp(values, expected, n * sizeof(*values)) == 0);
+
+    printf("n = %i, ns/literal\n", n);
+    printf("%-14s %10.2f\n", "strtod", parsed_strtod * 1e9 / n);
+    printf("%-14s %10.2f   (%i of %i not correctly rounded)\n", "digit loop", parsed_loop * 1e9 / n, wrong, n);
+    printf("%-14s %10.2f\n", "literal_parse", parsed_literal * 1e9 / n);
+
+    free(text);
+    free(starts);
+    free(expected);
+    free(values);
+    return 0;
+}
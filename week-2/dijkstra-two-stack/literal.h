@@ -0,0 +1,243 @@
+/* Fast, correctly rounded parsing of decimal LITERALS
+ * literal_parse reads digits, an optional '.' followed by digits, and an optional
+ * exponent (e or E, an optional sign, digits), the way fast_float does:
+ * - the digits are gathered into one 64-bit integer mantissa, up to 8 at a time
+ *   (SWAR: one 64-bit load and three multiplications instead of 8 multiply-adds),
+ *   and the '.' and exponent only move a power of ten. A literal of at most 7
+ *   characters such as 12.34 or 7, the usual kind in expressions, is read with a
+ *   single load, with the '.' taken out of the word
+ * - when the mantissa fits in 53 bits and the power of ten is at most 22 either
+ *   way, both are exact doubles, so a single multiplication or division gives the
+ *   correctly rounded result (Clinger's fast path)
+ * - anything else (more than 19 significant digits, huge or tiny exponents, or
+ *   mantissas too wide for the fast path) goes to strtod, which is correctly
+ *   rounded but several times slower
+ * Eisel-Lemire's 128-bit step between the last two is left out, since it needs a
+ * table of about 650 128-bit powers of five, and literals in expressions almost
+ * always take the fast path anyway.
+ */
+
+#ifndef LITERAL_H
+#define LITERAL_H
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Literals longer than this are copied to the heap for strtod
+#define LITERAL_MAX_COPY 64
+
+static const double literal_powers_of_ten[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                               1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                               1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+/* Read 8 characters as a little-endian integer, whatever the byte order of the machine */
+static inline uint64_t literal_load_eight(const char *chars)
+{
+    uint64_t word;
+    memcpy(&word, chars, sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+/* High bit of every byte of word that is not a digit. The bytes are kept apart, so no carry
+ * from one reaches the next */
+static inline uint64_t literal_non_digits(uint64_t word)
+{
+    uint64_t x = word ^ 0x3030303030303030;
+    return (((x & 0x7f7f7f7f7f7f7f7f) + 0x7676767676767676) | x) & 0x8080808080808080;
+}
+
+/* Value of 8 digits, first digit in the lowest byte: pairs, then quadruples, then all 8 */
+static inline uint32_t literal_parse_eight_digits(uint64_t word)
+{
+    const uint64_t mask = 0x000000ff000000ff;
+    const uint64_t multiplier_low = 100 + (1000000ULL << 32);
+    const uint64_t multiplier_high = 1 + (10000ULL << 32);
+    word -= 0x3030303030303030;
+    word = word * 10 + (word >> 8);
+    word = ((word & mask) * multiplier_low + ((word >> 16) & mask) * multiplier_high) >> 32;
+    return (uint32_t)word;
+}
+
+/* Add the run of digits starting at text[i] to mantissa, returning the index just past it.
+ * Up to 8 digits are read with one load: the digits are shifted to the top of the
+ * word and the bytes below filled with '0' before converting all 8 */
+static inline int literal_parse_run(const char *text, int length, int i, uint64_t *mantissa)
+{
+    static const uint64_t scales[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000};
+    while (i + 8 <= length)
+    {
+        uint64_t word = literal_load_eight(text + i);
+        // The lowest set bit marks the first byte that is not a digit
+        uint64_t others = literal_non_digits(word);
+        if (!others)
+        {
+            *mantissa = *mantissa * 100000000 + literal_parse_eight_digits(word);
+            i += 8;
+            continue;
+        }
+        int count = __builtin_ctzll(others) / 8;
+        if (count > 0)
+        {
+            word = (word << (64 - 8 * count)) | (0x3030303030303030 >> (8 * count));
+            *mantissa = *mantissa * scales[count] + literal_parse_eight_digits(word);
+        }
+        return i + count;
+    }
+    while (i < length && (unsigned char)(text[i] - '0') < 10)
+    {
+        *mantissa = *mantissa * 10 + (text[i] - '0');
+        i++;
+    }
+    return i;
+}
+
+/* Parse a literal of at most 7 characters without exponent, like 12.34 or 7, from one load.
+ * Returns its length, or 0 if it has another form or too few characters can be read */
+static inline int literal_parse_short(const char *text, int length, double *value)
+{
+    if (length < 8)
+    {
+        return 0;
+    }
+    uint64_t word = literal_load_eight(text);
+    uint64_t others = literal_non_digits(word);
+    if (!others)
+    {
+        return 0;
+    }
+    int end = __builtin_ctzll(others) / 8;
+    int point = end;
+    if (end > 0 && (char)(word >> (8 * end)) == '.')
+    {
+        // The fraction runs up to the next byte that is not a digit
+        others &= others - 1;
+        if (!others)
+        {
+            return 0;
+        }
+        end = __builtin_ctzll(others) / 8;
+    }
+    char next = (char)(word >> (8 * end));
+    int decimals = point < end ? end - point - 1 : 0;
+    if (end == 0 || end == point + 1 || next == '.' || next == 'e' || next == 'E')
+    {
+        return 0;
+    }
+    if (point < end)
+    {
+        // Move the fraction down over the '.'
+        uint64_t below = (1ULL << (8 * point)) - 1;
+        word = (word & below) | ((word >> 8) & ~below);
+    }
+    int digits = point + decimals;
+    word = (word << (64 - 8 * digits)) | (0x3030303030303030 >> (8 * digits));
+    *value = (double)literal_parse_eight_digits(word) / literal_powers_of_ten[decimals];
+    return end;
+}
+
+/* Parse the literal at the start of the first length characters of text into *value.
+ * Returns the number of characters it takes up, or 0 if text does not start with a
+ * digit or a '.' followed by a digit */
+static inline int literal_parse(const char *text, int length, double *value)
+{
+    int short_length = literal_parse_short(text, length, value);
+    if (short_length > 0)
+    {
+        return short_length;
+    }
+
+    uint64_t mantissa = 0;
+    // Significant digits so far; those past the first 19 are only counted
+    int digits = 0;
+    int i = 0;
+    int exponent = 0;
+
+    // Leading zeros are not significant
+    while (i < length && text[i] == '0')
+    {
+        i++;
+    }
+    int integer_start = i;
+    i = literal_parse_run(text, length, i, &mantissa);
+    digits = i - integer_start;
+    bool has_integer = i > 0;
+
+    if (i + 1 < length && text[i] == '.' && (unsigned char)(text[i + 1] - '0') < 10)
+    {
+        i++;
+        int fraction_start = i;
+        // Zeros right after the point only count when there were digits before it
+        if (digits == 0)
+        {
+            while (i < length && text[i] == '0')
+            {
+                i++;
+            }
+        }
+        int significant_start = i;
+        i = literal_parse_run(text, length, i, &mantissa);
+        digits += i - significant_start;
+        exponent = -(i - fraction_start);
+    }
+    else if (!has_integer)
+    {
+        return 0;
+    }
+
+    // The exponent part only counts if there is at least one digit in it
+    if (i + 1 < length && (text[i] == 'e' || text[i] == 'E'))
+    {
+        int j = i + 1;
+        bool negative = text[j] == '-';
+        if (text[j] == '-' || text[j] == '+')
+        {
+            j++;
+        }
+        if (j < length && (unsigned char)(text[j] - '0') < 10)
+        {
+            int power = 0;
+            for (; j < length && (unsigned char)(text[j] - '0') < 10; j++)
+            {
+                // Anything this large overflows or underflows anyway
+                if (power < 100000)
+                {
+                    power = power * 10 + (text[j] - '0');
+                }
+            }
+            exponent += negative ? -power : power;
+            i = j;
+        }
+    }
+
+    // Past 19 digits the mantissa has wrapped around, so strtod has to see them all
+    if (digits == 0)
+    {
+        *value = 0.0;
+    }
+    else if (digits <= 19 && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22)
+    {
+        *value = exponent < 0 ? (double)mantissa / literal_powers_of_ten[-exponent]
+                              : (double)mantissa * literal_powers_of_ten[exponent];
+    }
+    else
+    {
+        char copy[LITERAL_MAX_COPY + 1];
+        char *chars = i <= LITERAL_MAX_COPY ? copy : malloc(i + 1);
+        assert(chars);
+        memcpy(chars, text, i);
+        chars[i] = '\0';
+        *value = strtod(chars, NULL);
+        if (chars != copy)
+        {
+            free(chars);
+        }
+    }
+    return i;
+}
+
+#endif
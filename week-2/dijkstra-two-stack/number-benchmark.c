@@ -0,0 +1,228 @@
+/* Compares the number types of number.h on n random amounts of money with two
+ * decimals, like 1234.56: adding them all up, and multiplying and dividing them
+ * in pairs. The decimal sum must come out exact, as must every product and the
+ * quotient of each product by one of its factors; how far the double and
+ * double-double sums are off is printed. Built with -march=native, double-double
+ * uses FMA where the machine has it.
+ * First, double-double must overflow, underflow and divide by zero just like
+ * double on numbers at and past its limits, and decimal must give
+ * DECIMAL_INVALID for overflows and divisions by zero.
+ * Usage: ./number-benchmark [n]
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "decimal.h"
+#include "double-double.h"
+#include "literal.h"
+
+#define NUMBER_TYPES 3
+
+// Literals at and past the limits of a double
+static const char *limit_literals[] = {"0", "1", "10", "1e-200", "1e200", "1e308", "1e-320", "1e400", "1e-400"};
+
+double seconds_since(struct timespec start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/* Whether x is what double gave, counting every NaN as the same. Down where a finite
+ * result runs into the subnormals, double-double has no more bits than double and may
+ * round the other way, so a finite result may be one place off */
+bool same_as_double(double_double x, double expected)
+{
+    double value = double_double_to_double(x);
+    if (isnan(expected) || isnan(x.lo))
+    {
+        return isnan(expected) && isnan(value);
+    }
+    return value == expected ||
+           (isfinite(expected) && (value == nextafter(expected, INFINITY) || value == nextafter(expected, -INFINITY)));
+}
+
+/* Every operation on every pair of limit literals, in double-double against double, and
+ * decimal's overflows, underflows and divisions by zero */
+void check_limits(void)
+{
+    int count = sizeof(limit_literals) / sizeof(*limit_literals);
+    for (int i = 0; i < count; i++)
+    {
+        int length = strlen(limit_literals[i]);
+        double a;
+        double_double parsed;
+        bool valid = literal_parse(limit_literals[i], length, &a) == length &&
+                     double_double_parse(limit_literals[i], length, &parsed) == length;
+        assert(valid);
+        assert(same_as_double(parsed, a));
+        // From the doubles themselves, so that the exact results round to what double gives
+        double_double x = double_double_from_double(a);
+        for (int j = 0; j < count; j++)
+        {
+            double b;
+            literal_parse(limit_literals[j], strlen(limit_literals[j]), &b);
+            for (int sign = -1; sign <= 1; sign += 2)
+            {
+                double_double y = double_double_from_double(sign * b);
+                assert(same_as_double(double_double_add(x, y), a + sign * b));
+                assert(same_as_double(double_double_subtract(x, y), a - sign * b));
+                assert(same_as_double(double_double_multiply(x, y), a * (sign * b)));
+                assert(same_as_double(double_double_divide(x, y), a / (sign * b)));
+                assert(same_as_double(double_double_sqrt(x), sqrt(a)));
+                assert(same_as_double(double_double_floor(y), floor(sign * b)));
+            }
+        }
+    }
+
+    decimal one;
+    decimal large;
+    decimal small;
+    decimal too_large;
+    decimal too_small;
+    bool valid = decimal_parse("1", 1, &one) == 1 && decimal_parse("1e19", 4, &large) == 4 &&
+                 decimal_parse("1e-10", 5, &small) == 5 && decimal_parse("1e400", 5, &too_large) == 5 &&
+                 decimal_parse("1e-400", 6, &too_small) == 6;
+    assert(valid);
+    assert(too_large == DECIMAL_INVALID && too_small == 0);
+    assert(decimal_multiply(large, large) == DECIMAL_INVALID);
+    assert(decimal_add(large, large) != DECIMAL_INVALID);
+    assert(decimal_multiply(decimal_add(large, large), large) == DECIMAL_INVALID);
+    assert(decimal_divide(one, 0) == DECIMAL_INVALID);
+    assert(decimal_divide(large, small) == DECIMAL_INVALID);
+    assert(decimal_multiply(small, small) == 0);
+    assert(decimal_add(DECIMAL_INVALID, one) == DECIMAL_INVALID);
+    assert(decimal_negate(DECIMAL_INVALID) == DECIMAL_INVALID);
+    assert(isnan(decimal_to_double(decimal_divide(one, 0))));
+}
+
+int main(int argc, char *argv[])
+{
+    int n = 1000000;
+    if (argc > 1)
+    {
+        n = atoi(argv[1]);
+    }
+    if (n < 2)
+    {
+        printf("Usage: ./number-benchmark [n], with n >= 2\n");
+        return 1;
+    }
+    check_limits();
+
+    // Each amount as text, in cents, and parsed as each type
+    long *cents = malloc(n * sizeof(*cents));
+    double *doubles = malloc(n * sizeof(*doubles));
+    double_double *double_doubles = malloc(n * sizeof(*double_doubles));
+    decimal *decimals = malloc(n * sizeof(*decimals));
+    assert(cents && doubles && double_doubles && decimals);
+    srand(time(NULL));
+    long total = 0;
+    for (int i = 0; i < n; i++)
+    {
+        char text[LITERAL_MAX_COPY + 1];
+        cents[i] = 1 + rand() % 10000000;
+        int length = sprintf(text, "%li.%02li", cents[i] / 100, cents[i] % 100);
+        total += cents[i];
+        bool valid = literal_parse(text, length, &doubles[i]) == length &&
+                     double_double_parse(text, length, &double_doubles[i]) == length &&
+                     decimal_parse(text, length, &decimals[i]) == length;
+        assert(valid);
+    }
+
+    const char *names[NUMBER_TYPES] = {"double", "double-double", "decimal"};
+    double times[NUMBER_TYPES][4];
+    struct timespec start;
+
+    // Sums
+    double double_sum = 0.0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < n; i++)
+    {
+        double_sum += doubles[i];
+    }
+    times[0][0] = seconds_since(start);
+    double_double double_double_sum = double_double_from_double(0.0);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < n; i++)
+    {
+        double_double_sum = double_double_add(double_double_sum, double_doubles[i]);
+    }
+    times[1][0] = seconds_since(start);
+    decimal decimal_sum = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < n; i++)
+    {
+        decimal_sum = decimal_add(decimal_sum, decimals[i]);
+    }
+    times[2][0] = seconds_since(start);
+    assert(decimal_sum == (decimal)total * (DECIMAL_SCALE / 100));
+
+    // Products of neighbours, then the quotients of the products by the first factor
+    double *double_results = malloc(n * sizeof(*double_results));
+    double_double *double_double_results = malloc(n * sizeof(*double_double_results));
+    decimal *decimal_results = malloc(n * sizeof(*decimal_results));
+    assert(double_results && double_double_results && decimal_results);
+    // Touched first, so that no type pays for the page faults
+    memset(double_results, 0, n * sizeof(*double_results));
+    memset(double_double_results, 0, n * sizeof(*double_double_results));
+    memset(decimal_results, 0, n * sizeof(*decimal_results));
+    double checksum = 0.0;
+    for (int operation = 1; operation <= 2; operation++)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i + 1 < n; i++)
+        {
+            double_results[i] = operation == 1 ? doubles[i] * doubles[i + 1] : double_results[i] / doubles[i];
+        }
+        times[0][operation] = seconds_since(start);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i + 1 < n; i++)
+        {
+            double_double_results[i] = operation == 1
+                                           ? double_double_multiply(double_doubles[i], double_doubles[i + 1])
+                                           : double_double_divide(double_double_results[i], double_doubles[i]);
+        }
+        times[1][operation] = seconds_since(start);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i + 1 < n; i++)
+        {
+            decimal_results[i] = operation == 1 ? decimal_multiply(decimals[i], decimals[i + 1])
+                                                : decimal_divide(decimal_results[i], decimals[i]);
+        }
+        times[2][operation] = seconds_since(start);
+        checksum += double_results[n / 2] + double_double_to_double(double_double_results[n / 2]);
+    }
+    for (int i = 0; i + 1 < n; i++)
+    {
+        assert(decimal_results[i] == decimals[i + 1]);
+    }
+
+    printf("n = %i, checksum %.2f\n", n, checksum);
+    printf("%-14s %12s %12s %12s %26s\n", "type", "ns/add", "ns/multiply", "ns/divide", "sum off by");
+    double exact = (double)total / 100;
+    double off[NUMBER_TYPES] = {double_sum - exact,
+                                double_double_to_double(double_double_subtract(
+                                    double_double_sum, double_double_divide(double_double_from_double((double)total),
+                                                                            double_double_from_double(100.0)))),
+                                0.0};
+    for (int type = 0; type < NUMBER_TYPES; type++)
+    {
+        printf("%-14s %12.2f %12.2f %12.2f %26.3e\n", names[type], times[type][0] * 1e9 / n,
+               times[type][1] * 1e9 / (n - 1), times[type][2] * 1e9 / (n - 1), off[type]);
+    }
+    free(cents);
+    free(doubles);
+    free(double_doubles);
+    free(decimals);
+    free(double_results);
+    free(double_double_results);
+    free(decimal_results);
+    return 0;
+}
@@ -0,0 +1,142 @@
+/* The NUMBER type of the streaming evaluator, chosen when compiling
+ * - double by default, with every operation exactly as in expression_calculate
+ * - the 128-bit fixed-point decimal of decimal.h with -DNUMBER_DECIMAL, for
+ *   amounts of money, which it adds up without any rounding
+ * - the double_double of double-double.h with -DNUMBER_DOUBLE_DOUBLE, with about
+ *   106 bits of precision where a double has 53
+ * The exact types keep + - * / and unary minus, abs, floor, ceil, min, max and ^
+ * with a whole exponent to themselves, and double-double sqrt too. Every other
+ * function, and ^ with any other exponent, goes through double, so its result is
+ * only as precise as a double.
+ */
+
+#ifndef NUMBER_H
+#define NUMBER_H
+#include <math.h>
+#include <stdio.h>
+
+#include "expression.h"
+#include "literal.h"
+#if defined(NUMBER_DECIMAL)
+#include "decimal.h"
+#elif defined(NUMBER_DOUBLE_DOUBLE)
+#include "double-double.h"
+#endif
+
+// Decimals written by number_format, as with "%.10lf", and room for any number it writes
+#define NUMBER_DECIMALS 10
+#define NUMBER_MAX_FORMAT 340
+
+#if defined(NUMBER_DECIMAL) || defined(NUMBER_DOUBLE_DOUBLE)
+#ifdef NUMBER_DECIMAL
+typedef decimal number;
+#define NUMBER_(name) decimal_##name
+#else
+typedef double_double number;
+#define NUMBER_(name) double_double_##name
+#endif
+
+static inline number number_from_double(double x)
+{
+    return NUMBER_(from_double)(x);
+}
+
+/* Parse a literal the way literal_parse does, returning its length */
+static inline int number_parse(const char *text, int length, number *value)
+{
+    return NUMBER_(parse)(text, length, value);
+}
+
+static inline int number_format(char *buffer, int size, number value)
+{
+    return NUMBER_(format)(buffer, size, value, NUMBER_DECIMALS);
+}
+
+/* A function of expression_functions, through double unless the type has it */
+static inline number number_call(int index, number a, number b)
+{
+    const expression_function *function = &expression_functions[index];
+    if (function->unary == fabs)
+    {
+        return NUMBER_(abs)(a);
+    }
+    if (function->unary == floor)
+    {
+        return NUMBER_(floor)(a);
+    }
+    if (function->unary == ceil)
+    {
+        return NUMBER_(ceil)(a);
+    }
+    if (function->binary == fmin)
+    {
+        return NUMBER_(min)(a, b);
+    }
+    if (function->binary == fmax)
+    {
+        return NUMBER_(max)(a, b);
+    }
+#ifdef NUMBER_DOUBLE_DOUBLE
+    if (function->unary == sqrt)
+    {
+        return double_double_sqrt(a);
+    }
+#endif
+    double x = NUMBER_(to_double)(a);
+    double y = NUMBER_(to_double)(b);
+    return NUMBER_(from_double)(function->arity == 1 ? function->unary(x) : function->binary(x, y));
+}
+
+/* As expression_apply, but on numbers */
+static inline number number_apply(expression_opcode opcode, int operand, number a, number b)
+{
+    long exponent;
+    switch (opcode)
+    {
+    case EXPRESSION_ADD:
+        return NUMBER_(add)(a, b);
+    case EXPRESSION_SUBTRACT:
+        return NUMBER_(subtract)(a, b);
+    case EXPRESSION_MULTIPLY:
+        return NUMBER_(multiply)(a, b);
+    case EXPRESSION_DIVIDE:
+        return NUMBER_(divide)(a, b);
+    case EXPRESSION_POWER:
+        if (NUMBER_(integer)(b, &exponent))
+        {
+            return NUMBER_(power_integer)(a, exponent);
+        }
+        return NUMBER_(from_double)(pow(NUMBER_(to_double)(a), NUMBER_(to_double)(b)));
+    case EXPRESSION_NEGATE:
+        return NUMBER_(negate)(a);
+    default:
+        return number_call(operand, a, b);
+    }
+}
+
+#undef NUMBER_
+#else
+typedef double number;
+
+static inline number number_from_double(double x)
+{
+    return x;
+}
+
+static inline int number_parse(const char *text, int length, number *value)
+{
+    return literal_parse(text, length, value);
+}
+
+static inline int number_format(char *buffer, int size, number value)
+{
+    return snprintf(buffer, size, "%.*lf", NUMBER_DECIMALS, value);
+}
+
+static inline number number_apply(expression_opcode opcode, int operand, number a, number b)
+{
+    return expression_apply(opcode, operand, a, b);
+}
+#endif
+
+#endif
@@ -8,106 +8,381 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "allocator.h"
+#include "snapshot.h"
+
+/* Shared with deque.h and rqueue.h. By default a container halves its capacity
+ * once it is at most a quarter full (DEFAULT_SHRINK_FACTOR) */
+#ifndef CONTAINER_DEFAULTS
+#define CONTAINER_DEFAULTS
 static const int MINIMUM_CAPACITY = 8;
+static const int DEFAULT_SHRINK_FACTOR = 4;
+#endif
+
+#define DEFINE_STACK_TYPE(T, prefix)                                                                           \
+    typedef struct prefix##_stack                                                                              \
+    {                                                                                                          \
+        int capacity;                                                                                          \
+        int size;                                                                                              \
+        T *storage_array;                                                                                      \
+        const allocator *allocator;                                                                            \
+        int minimum_capacity;                                                                                  \
+        int shrink_factor;                                                                                     \
+        long allocations;                                                                                      \
+        snapshot_mapping mapping;                                                                              \
+        bool reset_iterator;                                                                                   \
+        int next_item;                                                                                         \
+        bool has_next;                                                                                         \
+    } prefix##_stack;                                                                                          \
+                                                                                                               \
+    /* Item type, for STACK_FOREACH */                                                                         \
+    typedef T prefix##_stack_item;                                                                             \
+                                                                                                               \
+    /* Contiguous run of items, see stack_span */                                                              \
+    typedef struct prefix##_stack_span                                                                         \
+    {                                                                                                          \
+        T *items;                                                                                              \
+        int length;                                                                                            \
+    } prefix##_stack_span;                                                                                     \
+                                                                                                               \
+    /* Create stack whose memory comes from the given allocator */                                             \
+    prefix##_stack *stack_##prefix##_create_with(const allocator *allocator)                                   \
+    {                                                                                                          \
+        prefix##_stack *stack = allocator->allocate(allocator->context, sizeof(*stack));                       \
+                                                                                                               \
+        assert(stack);                                                                                         \
+        stack->capacity = MINIMUM_CAPACITY;                                                                    \
+        stack->size = 0;                                                                                       \
+        stack->allocator = allocator;                                                                          \
+        assert((stack->storage_array = allocator->allocate(allocator->context, sizeof(T) * stack->capacity))); \
+        stack->minimum_capacity = MINIMUM_CAPACITY;                                                            \
+        stack->shrink_factor = DEFAULT_SHRINK_FACTOR;                                                          \
+        stack->allocations = 1;                                                                                \
+        stack->mapping = (snapshot_mapping){NULL, 0};                                                          \
+        stack->reset_iterator = true;                                                                          \
+        stack->next_item = 0;                                                                                  \
+        stack->has_next = false;                                                                               \
+        return stack;                                                                                          \
+    }                                                                                                          \
+                                                                                                               \
+    prefix##_stack *stack_##prefix##_create(void)                                                              \
+    {                                                                                                          \
+        return stack_##prefix##_create_with(&HEAP_ALLOCATOR);                                                  \
+    }                                                                                                          \
+                                                                                                               \
+    void stack_##prefix##_free(prefix##_stack *stack)                                                          \
+    {                                                                                                          \
+        assert(stack);                                                                                         \
+        const allocator *allocator = stack->allocator;                                                         \
+        if (stack->mapping.address)                                                                            \
+        {                                                                                                      \
+            snapshot_unmap(&stack->mapping);                                                                   \
+        }                                                                                                      \
+        else                                                                                                   \
+        {                                                                                                      \
+            allocator->release(allocator->context, stack->storage_array, sizeof(T) * stack->capacity);         \
+        }                                                                                                      \
+        stack->storage_array = NULL;                                                                           \
+        allocator->release(allocator->context, stack, sizeof(*stack));                                         \
+        stack = NULL;                                                                                          \
+    }                                                                                                          \
+                                                                                                               \
+    /* Move the items into a storage array of the given capacity (at least size) */                            \
+    void stack_##prefix##_reallocate(prefix##_stack *stack, int capacity)                                      \
+    {                                                                                                          \
+        assert(capacity >= stack->size);                                                                       \
+        const allocator *allocator = stack->allocator;                                                         \
+        T *tmp;                                                                                                \
+        if (stack->mapping.address)                                                                            \
+        {                                                                                                      \
+            /* Loaded snapshot: copy the items out of the read-only mapping */                                 \
+            tmp = allocator->allocate(allocator->context, sizeof(T) * capacity);                               \
+            assert(tmp);                                                                                       \
+            memcpy(tmp, stack->storage_array, sizeof(T) * stack->size);                                        \
+            snapshot_unmap(&stack->mapping);                                                                   \
+        }                                                                                                      \
+        else                                                                                                   \
+        {                                                                                                      \
+            tmp = allocator->reallocate(allocator->context, stack->storage_array, sizeof(T) * stack->capacity, \
+                                        sizeof(T) * capacity);                                                 \
+            assert(tmp);                                                                                       \
+        }                                                                                                      \
+        stack->storage_array = tmp;                                                                            \
+        stack->capacity = capacity;                                                                            \
+        stack->allocations++;                                                                                  \
+    }                                                                                                          \
+                                                                                                               \
+    /* Copy the items of a loaded snapshot into storage that can be written,                                   \
+     * with room for one more item */                                                                          \
+    void stack_##prefix##_make_writable(prefix##_stack *stack)                                                 \
+    {                                                                                                          \
+        if (stack->mapping.address)                                                                            \
+        {                                                                                                      \
+            int capacity = stack->size == stack->capacity ? stack->capacity * 2 : stack->capacity;             \
+            stack_##prefix##_reallocate(stack, capacity);                                                      \
+        }                                                                                                      \
+    }                                                                                                          \
+                                                                                                               \
+    /* Make room for at least n items. Automatic shrinking will not go below                                   \
+     * this capacity until stack_shrink_to_fit is called */                                                    \
+    void stack_##prefix##_reserve(prefix##_stack *stack, int n)                                                \
+    {                                                                                                          \
+        assert(stack);                                                                                         \
+        assert(n >= 0);                                                                                        \
+        if (n > stack->minimum_capacity)                                                                       \
+        {                                                                                                      \
+            stack->minimum_capacity = n;                                                                       \
+        }                                                                                                      \
+        if (n > stack->capacity)                                                                               \
+        {                                                                                                      \
+            stack_##prefix##_reallocate(stack, n);                                                             \
+        }                                                                                                      \
+    }                                                                                                          \
+                                                                                                               \
+    /* Reduce capacity to the current size (or MINIMUM_CAPACITY) and drop any reservation */                   \
+    void stack_##prefix##_shrink_to_fit(prefix##_stack *stack)                                                 \
+    {                                                                                                          \
+        assert(stack);                                                                                         \
+        stack->minimum_capacity = MINIMUM_CAPACITY;                                                            \
+        int capacity = stack->size > MINIMUM_CAPACITY ? stack->size : MINIMUM_CAPACITY;                        \
+        if (capacity != stack->capacity)                                                                       \
+        {                                                                                                      \
+            stack_##prefix##_reallocate(stack, capacity);                                                      \
+        }                                                                                                      \
+    }                                                                                                          \
+                                                                                                               \
+    /* Shrink when at most 1 / factor of the capacity is in use (factor > 2),                                  \
+     * or never if factor is 0 */                                                                              \
+    void stack_##prefix##_set_shrink_factor(prefix##_stack *stack, int factor)                                 \
+    {                                                                                                          \
+        assert(stack);                                                                                         \
+        assert(factor == 0 || factor > 2);                                                                     \
+        stack->shrink_factor = factor;                                                                         \
+    }                                                                                                          \
+                                                                                                               \
+    bool stack_##prefix##_is_empty(prefix##_stack *stack)                                                      \
+    {                                                                                                          \
+        assert(stack);                                                                                         \
+        return stack->size == 0;                                                                               \
+    }                                                                                                          \
+                                                                                                               \
+    void stack_##prefix##_push(prefix##_stack *stack, T item)                                                  \
+    {                                                                                                          \
+        assert(stack);                                                                                         \
+        stack_##prefix##_make_writable(stack);                                                                 \
+        if (stack->size == stack->capacity)                                                                    \
+        {                                                                                                      \
+            stack_##prefix##_reallocate(stack, stack->capacity * 2);                                           \
+        }                                                                                                      \
+        stack->storage_array[stack->size] = item;                                                              \
+        stack->size++;                                                                                         \
+        stack->reset_iterator = true;                                                                          \
+    }                                                                                                          \
+                                                                                                               \
+    T stack_##prefix##_pop(prefix##_stack *stack)                                                              \
+    {                                                                                                          \
+        assert(stack);                                                                                         \
+        assert(stack->size > 0);                                                                               \
+        if (stack->shrink_factor > 0 && stack->size <= (stack->capacity / stack->shrink_factor) &&             \
+            stack->capacity / 2 >= stack->minimum_capacity)                                                    \
+        {                                                                                                      \
+            stack_##prefix##_reallocate(stack, stack->capacity / 2);                                           \
+        }                                                                                                      \
+        stack->size--;                                                                                         \
+        T item = stack->storage_array[stack->size];                                                            \
+        stack->reset_iterator = true;                                                                          \
+        return item;                                                                                           \
+    }                                                                                                          \
+                                                                                                               \
+    T stack_##prefix##_iterator_next(prefix##_stack *stack)                                                    \
+    {                                                                                                          \
+        assert(stack);                                                                                         \
+        assert(stack->size > 0);                                                                               \
+        if (stack->reset_iterator)                                                                             \
+        {                                                                                                      \
+            stack->next_item = stack->size - 1;                                                                \
+            if (stack->size == 1)                                                                              \
+            {                                                                                                  \
+                stack->has_next = false;                                                                       \
+            }                                                                                                  \
+            else                                                                                               \
+            {                                                                                                  \
+                stack->has_next = true;                                                                        \
+            }                                                                                                  \
+            stack->reset_iterator = false;                                                                     \
+        }                                                                                                      \
+                                                                                                               \
+        T item = stack->storage_array[stack->next_item];                                                       \
+        stack->next_item--;                                                                                    \
+        if (stack->next_item <= 0)                                                                             \
+        {                                                                                                      \
+            stack->has_next = false;                                                                           \
+        }                                                                                                      \
+        return item;                                                                                           \
+    }                                                                                                          \
+                                                                                                               \
+    /* All items as one array, bottom of the stack first. Valid until the next push or pop */                  \
+    prefix##_stack_span stack_##prefix##_span(const prefix##_stack *stack)                                     \
+    {                                                                                                          \
+        assert(stack);                                                                                         \
+        return (prefix##_stack_span){stack->storage_array, stack->size};                                       \
+    }                                                                                                          \
+                                                                                                               \
+    /* Write the items bottom to top to fd as a snapshot (see snapshot.h). T must not                          \
+     * contain pointers. Returns false if writing failed */                                                    \
+    bool stack_##prefix##_save(const prefix##_stack *stack, int fd)                                            \
+    {                                                                                                          \
+        assert(stack);                                                                                         \
+        return snapshot_write_header(fd, sizeof(T), stack->size) &&                                            \
+               snapshot_write(fd, stack->storage_array, stack->size * sizeof(T));                              \
+    }                                                                                                          \
+                                                                                                               \
+    /* Return stack holding the items of the snapshot at path, or NULL if it cannot be                         \
+     * read or does not hold items of type T. The items are read from the mapped file                          \
+     * until the first push; the stack will not shrink below its loaded size until                             \
+     * stack_shrink_to_fit. Do not write through stack_span or STACK_FOREACH before that */                    \
+    prefix##_stack *stack_##prefix##_load_mmap(const char *path)                                               \
+    {                                                                                                          \
+        snapshot_mapping mapping;                                                                              \
+        const void *items;                                                                                     \
+        int count;                                                                                             \
+        if (!snapshot_map(path, sizeof(T), &mapping, &items, &count))                                          \
+        {                                                                                                      \
+            return NULL;                                                                                       \
+        }                                                                                                      \
+        prefix##_stack *stack = stack_##prefix##_create();                                                     \
+        if (count > 0)                                                                                         \
+        {                                                                                                      \
+            const allocator *allocator = stack->allocator;                                                     \
+            allocator->release(allocator->context, stack->storage_array, sizeof(T) * stack->capacity);         \
+            stack->storage_array = (T *)items;                                                                 \
+            stack->mapping = mapping;                                                                          \
+            stack->capacity = count;                                                                           \
+            stack->size = count;                                                                               \
+            if (count > stack->minimum_capacity)                                                               \
+            {                                                                                                  \
+                stack->minimum_capacity = count;                                                               \
+            }                                                                                                  \
+        }                                                                                                      \
+        return stack;                                                                                          \
+    }
 
-#define DEFINE_STACK_TYPE(T, prefix)                                                                \
-    typedef struct prefix##_stack                                                                   \
-    {                                                                                               \
-        int capacity;                                                                               \
-        int size;                                                                                   \
-        T *storage_array;                                                                           \
-        bool reset_iterator;                                                                        \
-        int next_item;                                                                              \
-        bool has_next;                                                                              \
-    } prefix##_stack;                                                                               \
-                                                                                                    \
-    prefix##_stack *stack_##prefix##_create(void)                                                   \
-    {                                                                                               \
-        prefix##_stack *stack = malloc(sizeof(*stack));                                             \
-                                                                                                    \
-        assert(stack);                                                                              \
-        stack->capacity = MINIMUM_CAPACITY;                                                         \
-        stack->size = 0;                                                                            \
-        assert((stack->storage_array = malloc(sizeof(*stack->storage_array) * stack->capacity)));   \
-        stack->reset_iterator = true;                                                               \
-        stack->next_item = 0;                                                                       \
-        stack->has_next = false;                                                                    \
-        return stack;                                                                               \
-    }                                                                                               \
-                                                                                                    \
-    void stack_##prefix##_free(prefix##_stack *stack)                                               \
-    {                                                                                               \
-        assert(stack);                                                                              \
-        free(stack->storage_array);                                                                 \
-        stack->storage_array = NULL;                                                                \
-        free(stack);                                                                                \
-        stack = NULL;                                                                               \
-    }                                                                                               \
-                                                                                                    \
-    bool stack_##prefix##_is_empty(prefix##_stack *stack)                                           \
-    {                                                                                               \
-        assert(stack);                                                                              \
-        return stack->size == 0;                                                                    \
-    }                                                                                               \
-                                                                                                    \
-    void stack_##prefix##_push(prefix##_stack *stack, T item)                                       \
-    {                                                                                               \
-        assert(stack);                                                                              \
-        if (stack->size == stack->capacity)                                                         \
-        {                                                                                           \
-            stack->capacity *= 2;                                                                   \
-            T *tmp = realloc(stack->storage_array, sizeof(stack->storage_array) * stack->capacity); \
-            assert(tmp);                                                                            \
-            stack->storage_array = tmp;                                                             \
-        }                                                                                           \
-        stack->storage_array[stack->size] = item;                                                   \
-        stack->size++;                                                                              \
-        stack->reset_iterator = true;                                                               \
-    }                                                                                               \
-                                                                                                    \
-    T stack_##prefix##_pop(prefix##_stack *stack)                                                   \
-    {                                                                                               \
-        assert(stack);                                                                              \
-        assert(stack->size > 0);                                                                    \
-        if (stack->size <= (stack->capacity / 4) && stack->size > MINIMUM_CAPACITY)                 \
-        {                                                                                           \
-            stack->capacity /= 2;                                                                   \
-            T *tmp = realloc(stack->storage_array, sizeof(stack->storage_array) * stack->capacity); \
-            assert(tmp);                                                                            \
-            stack->storage_array = tmp;                                                             \
-        }                                                                                           \
-        stack->size--;                                                                              \
-        T item = stack->storage_array[stack->size];                                                 \
-        stack->reset_iterator = true;                                                               \
-        return item;                                                                                \
-    }                                                                                               \
-                                                                                                    \
-    T stack_##prefix##_iterator_next(prefix##_stack *stack)                                         \
-    {                                                                                               \
-        assert(stack);                                                                              \
-        assert(stack->size > 0);                                                                    \
-        if (stack->reset_iterator)                                                                  \
-        {                                                                                           \
-            stack->next_item = stack->size - 1;                                                     \
-            if (stack->size == 1)                                                                   \
-            {                                                                                       \
-                stack->has_next = false;                                                            \
-            }                                                                                       \
-            else                                                                                    \
-            {                                                                                       \
-                stack->has_next = true;                                                             \
-            }                                                                                       \
-            stack->reset_iterator = false;                                                          \
-        }                                                                                           \
-                                                                                                    \
-        T item = stack->storage_array[stack->next_item];                                            \
-        stack->next_item--;                                                                         \
-        if (stack->next_item <= 0)                                                                  \
-        {                                                                                           \
-            stack->has_next = false;                                                                \
-        }                                                                                           \
-        return item;                                                                                \
+/* Stack with room for N items inside the struct itself, so it can live on the
+ * caller's stack and only goes to the heap once it holds more than N items.
+ * Use init/deinit instead of create/free. Like the heap stack it halves its heap
+ * array when at most 1 / shrink factor of it is in use, and the halving that would
+ * bring it down to N items moves them back into the struct instead. The struct must
+ * not be copied or moved while in use, since storage_array may point into it.
+ * allocations counts the heap arrays allocated and reallocated */
+#define DEFINE_SMALL_STACK_TYPE(T, prefix, N)                                              \
+    typedef struct prefix##_small_stack                                                    \
+    {                                                                                      \
+        int capacity;                                                                      \
+        int size;                                                                          \
+        T *storage_array;                                                                  \
+        int shrink_factor;                                                                 \
+        long allocations;                                                                  \
+        T inline_array[N];                                                                 \
+    } prefix##_small_stack;                                                                \
+                                                                                           \
+    void small_stack_##prefix##_init(prefix##_small_stack *stack)                          \
+    {                                                                                      \
+        assert(stack);                                                                     \
+        stack->capacity = N;                                                               \
+        stack->size = 0;                                                                   \
+        stack->storage_array = stack->inline_array;                                        \
+        stack->shrink_factor = DEFAULT_SHRINK_FACTOR;                                      \
+        stack->allocations = 0;                                                            \
+    }                                                                                      \
+                                                                                           \
+    /* Free the heap array if the stack has spilled over */                                \
+    void small_stack_##prefix##_deinit(prefix##_small_stack *stack)                        \
+    {                                                                                      \
+        assert(stack);                                                                     \
+        if (stack->storage_array != stack->inline_array)                                   \
+        {                                                                                  \
+            free(stack->storage_array);                                                    \
+        }                                                                                  \
+        stack->storage_array = stack->inline_array;                                        \
+        stack->capacity = N;                                                               \
+        stack->size = 0;                                                                   \
+    }                                                                                      \
+                                                                                           \
+    /* Shrink when at most 1 / factor of the heap array is in use (factor > 2),            \
+     * or never if factor is 0 */                                                          \
+    void small_stack_##prefix##_set_shrink_factor(prefix##_small_stack *stack, int factor) \
+    {                                                                                      \
+        assert(stack);                                                                     \
+        assert(factor == 0 || factor > 2);                                                 \
+        stack->shrink_factor = factor;                                                     \
+    }                                                                                      \
+                                                                                           \
+    bool small_stack_##prefix##_is_empty(prefix##_small_stack *stack)                      \
+    {                                                                                      \
+        assert(stack);                                                                     \
+        return stack->size == 0;                                                           \
+    }                                                                                      \
+                                                                                           \
+    /* Move the items to an array of the given capacity: the inline array if it is N,      \
+     * otherwise one on the heap */                                                        \
+    void small_stack_##prefix##_reallocate(prefix##_small_stack *stack, int capacity)      \
+    {                                                                                      \
+        assert(capacity >= stack->size && capacity >= N);                                  \
+        T *tmp;                                                                            \
+        if (capacity == N)                                                                 \
+        {                                                                                  \
+            tmp = stack->inline_array;                                                     \
+            memcpy(tmp, stack->storage_array, sizeof(T) * stack->size);                    \
+            free(stack->storage_array);                                                    \
+        }                                                                                  \
+        else if (stack->storage_array == stack->inline_array)                              \
+        {                                                                                  \
+            tmp = malloc(sizeof(T) * capacity);                                            \
+            assert(tmp);                                                                   \
+            memcpy(tmp, stack->inline_array, sizeof(T) * stack->size);                     \
+            stack->allocations++;                                                          \
+        }                                                                                  \
+        else                                                                               \
+        {                                                                                  \
+            tmp = realloc(stack->storage_array, sizeof(T) * capacity);                     \
+            assert(tmp);                                                                   \
+            stack->allocations++;                                                          \
+        }                                                                                  \
+        stack->storage_array = tmp;                                                        \
+        stack->capacity = capacity;                                                        \
+    }                                                                                      \
+                                                                                           \
+    void small_stack_##prefix##_push(prefix##_small_stack *stack, T item)                  \
+    {                                                                                      \
+        assert(stack);                                                                     \
+        if (stack->size == stack->capacity)                                                \
+        {                                                                                  \
+            small_stack_##prefix##_reallocate(stack, stack->capacity * 2);                 \
+        }                                                                                  \
+        stack->storage_array[stack->size] = item;                                          \
+        stack->size++;                                                                     \
+    }                                                                                      \
+                                                                                           \
+    T small_stack_##prefix##_pop(prefix##_small_stack *stack)                              \
+    {                                                                                      \
+        assert(stack);                                                                     \
+        assert(stack->size > 0);                                                           \
+        if (stack->shrink_factor > 0 && stack->capacity > N &&                             \
+            stack->size <= stack->capacity / stack->shrink_factor)                         \
+        {                                                                                  \
+            small_stack_##prefix##_reallocate(stack, stack->capacity / 2);                 \
+        }                                                                                  \
+        stack->size--;                                                                     \
+        return stack->storage_array[stack->size];                                          \
     }
 
-#endif
\ No newline at end of file
+/* Loop over the items of a stack from the bottom up, with item a pointer into the
+ * storage array. A plain loop over one array, so the compiler can vectorise the
+ * body. The stack must not be pushed or popped inside the loop */
+#define STACK_FOREACH(prefix, item, stack)                                                                          \
+    for (prefix##_stack_item *item = (stack)->storage_array, *item##_end = item + (stack)->size; item < item##_end; \
+         item++)
+
+#endif
@@ -0,0 +1,61 @@
+/* Evaluation of one expression with a precedence climbing parser
+ * Allows for exponentiation, multiplication, division, addition, subtraction and
+ * negation of floats, and functions such as sqrt(x) and max(a, b).
+ * get_solution evaluates an expression in one pass over its text with the parser of
+ * expression.h, which climbs precedences and does each operation as soon as both of
+ * its operands are known. The file is named after Dijkstra's two stack algorithm,
+ * which it used before.
+ */
+
+#ifndef TWO_STACK_H
+#define TWO_STACK_H
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "expression.h"
+
+double get_solution(char *operation);
+double do_operation(double a, double b, char operator);
+
+double get_solution(char *operation)
+{
+    double solution;
+    expression_error error;
+    if (!expression_calculate(operation, strlen(operation), &solution, &error))
+    {
+        printf("Warning: invalid input at column %i (%s), results not reliable\n", error.position + 1, error.message);
+        return 0;
+    }
+    return solution;
+}
+
+double do_operation(double a, double b, char operator)
+{
+    double solution = 0.0;
+
+    if (operator== '+')
+    {
+        solution = a + b;
+    }
+    else if (operator== '-')
+    {
+        solution = a - b;
+    }
+    else if (operator== '*')
+    {
+        solution = a * b;
+    }
+    else if (operator== '/')
+    {
+        solution = a / b;
+    }
+    else if (operator== '^')
+    {
+        solution = pow(a, b);
+    }
+
+    return solution;
+}
+
+#endif
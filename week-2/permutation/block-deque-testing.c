@@ -0,0 +1,233 @@
+/* Differential test and tail latency comparison of block-deque.h against deque.h.
+ * The test runs a random sequence of adds and removes at both ends on a block deque
+ * and a deque.h deque side by side, with phases that mostly add and phases that
+ * mostly remove, so that blocks are taken, recycled and freed and the block map
+ * wraps around and grows. It runs once more with phases 20 times as long, so that
+ * the map grows to thousands of blocks while items come and go at both ends.
+ * Contents are compared every 64 steps, along with the entries of a map that is
+ * being filled, and a pointer to one item is kept for as long as the item is in
+ * the deque, to check that items never move.
+ * The comparison then adds n items at the front of each deque one by one, timing
+ * every add, and prints the mean, the 99.9th and 99.99th percentiles and the worst
+ * add: deque.h copies every item when its array runs full, so its worst add grows
+ * with n, while the worst add of the block deque is a new block or the scheduler
+ * getting in the way. The times include reading the clock.
+ * Usage: ./block-deque-testing [steps] [n] [seed]
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "block-deque.h"
+#include "deque.h"
+
+// Items of 256 bytes, so that a block holds only 16 of them and the test crosses many blocks
+typedef struct wide
+{
+    int value;
+    char padding[252];
+} wide;
+
+DEFINE_DEQUE_TYPE(int, model);
+DEFINE_BLOCK_DEQUE_TYPE(wide, wide);
+DEFINE_DEQUE_TYPE(int, number);
+DEFINE_BLOCK_DEQUE_TYPE(int, block);
+
+// Steps per phase of mostly adding or mostly removing, in the first run
+#define PHASE_LENGTH 3000
+
+static unsigned int seed;
+static long step;
+
+// Report the first difference with the model, with the seed and step to reproduce it
+#define CHECK(condition)                                                                       \
+    if (!(condition))                                                                          \
+    {                                                                                          \
+        printf("FAILED: %s (line %i, seed %u, step %li)\n", #condition, __LINE__, seed, step); \
+        exit(1);                                                                               \
+    }
+
+/* Every item of the block deque against the model, and the block counts */
+void compare(wide_block_deque *deque, model_deque *model)
+{
+    CHECK(deque->size == model->size);
+    int i = 0;
+    for (int part = 0; part <= 1; part++)
+    {
+        model_deque_span span = deque_model_span(model, part);
+        for (int j = 0; j < span.length; j++, i++)
+        {
+            CHECK(deque_wide_at(deque, i)->value == span.items[j]);
+        }
+    }
+    CHECK(deque->block_count == (deque->first + deque->size + wide_block_size - 1) / wide_block_size);
+    CHECK(deque->block_count <= deque->map_capacity);
+    CHECK(deque->free_count >= 0 && deque->free_count <= BLOCK_DEQUE_MAX_FREE_BLOCKS);
+    // Every block whose entry of the old map has been copied is in the next map too, at the same address
+    if (deque->next_map)
+    {
+        CHECK(deque->next_copied < deque->map_capacity);
+        for (int i = 0; i < deque->block_count; i++)
+        {
+            int address = deque->map_first + i;
+            if ((address & (deque->map_capacity - 1)) < deque->next_copied)
+            {
+                CHECK(deque->next_map[address & (2 * deque->map_capacity - 1)] == deque_wide_block(deque, i));
+            }
+        }
+    }
+}
+
+void run_test(long steps, int phase_length)
+{
+    wide_block_deque *deque = deque_wide_create();
+    model_deque *model = deque_model_create();
+    // An item of the deque, where it was and where it should still be
+    wide *pinned = NULL;
+    int pinned_value = 0;
+    int pinned_index = 0;
+
+    for (step = 0; step < steps; step++)
+    {
+        bool adding = (step / phase_length) % 2 == 0;
+        int choice = rand() % 100;
+        bool add = adding ? choice < 70 : choice < 30;
+        bool front = rand() % 2 == 0;
+        wide item;
+        memset(&item, 0, sizeof(item));
+        item.value = (int)step;
+
+        CHECK(deque_wide_is_empty(deque) == deque_model_is_empty(model));
+        if (add && front)
+        {
+            deque_wide_add_first(deque, item);
+            deque_model_add_first(model, item.value);
+            pinned_index++;
+        }
+        else if (add)
+        {
+            deque_wide_add_last(deque, item);
+            deque_model_add_last(model, item.value);
+        }
+        else if (!deque_model_is_empty(model) && front)
+        {
+            CHECK(deque_wide_remove_first(deque).value == deque_model_remove_first(model));
+            pinned = pinned_index == 0 ? NULL : pinned;
+            pinned_index--;
+        }
+        else if (!deque_model_is_empty(model))
+        {
+            CHECK(deque_wide_remove_last(deque).value == deque_model_remove_last(model));
+            pinned = pinned_index == model->size ? NULL : pinned;
+        }
+
+        if (pinned)
+        {
+            CHECK(deque_wide_at(deque, pinned_index) == pinned && pinned->value == pinned_value);
+        }
+        else if (model->size > 0)
+        {
+            pinned_index = rand() % model->size;
+            pinned = deque_wide_at(deque, pinned_index);
+            pinned_value = pinned->value;
+        }
+        if (step % 64 == 0)
+        {
+            compare(deque, model);
+        }
+    }
+    compare(deque, model);
+    printf("Test: %li steps, phases of %i, map capacity %i, OK\n", steps, phase_length, deque->map_capacity);
+    deque_wide_free(deque);
+    deque_model_free(model);
+}
+
+int compare_longs(const void *a, const void *b)
+{
+    long x = *(const long *)a;
+    long y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+long nanoseconds_between(struct timespec start, struct timespec end)
+{
+    return (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+}
+
+/* Print the mean, the 99.9th and 99.99th percentiles and the largest of n times, sorting them */
+void print_latencies(const char *name, long *times, int n)
+{
+    double total = 0.0;
+    for (int i = 0; i < n; i++)
+    {
+        total += times[i];
+    }
+    qsort(times, n, sizeof(*times), compare_longs);
+    printf("%-12s %10.1f %10li %10li %12li\n", name, total / n, times[(long)n * 999 / 1000],
+           times[(long)n * 9999 / 10000], times[n - 1]);
+}
+
+/* Time every one of n adds at the front of a new deque.h deque and a new block deque */
+void run_latency_comparison(int n)
+{
+    long *times = malloc(n * sizeof(*times));
+    assert(times);
+    // Touched first, so that the page faults are not timed
+    memset(times, 0, n * sizeof(*times));
+    struct timespec start;
+    struct timespec end;
+    printf("%-12s %10s %10s %10s %12s\n", "add_first", "mean ns", "p99.9 ns", "p99.99 ns", "worst ns");
+
+    number_deque *deque = deque_number_create();
+    for (int i = 0; i < n; i++)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        deque_number_add_first(deque, i);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        times[i] = nanoseconds_between(start, end);
+    }
+    for (int i = 0; i < n; i++)
+    {
+        CHECK(deque_number_remove_last(deque) == i);
+    }
+    deque_number_free(deque);
+    print_latencies("deque.h", times, n);
+
+    block_block_deque *blocks = deque_block_create();
+    for (int i = 0; i < n; i++)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        deque_block_add_first(blocks, i);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        times[i] = nanoseconds_between(start, end);
+    }
+    for (int i = 0; i < n; i++)
+    {
+        CHECK(deque_block_remove_last(blocks) == i);
+    }
+    deque_block_free(blocks);
+    print_latencies("block-deque", times, n);
+    free(times);
+}
+
+int main(int argc, char *argv[])
+{
+    long steps = argc > 1 ? atol(argv[1]) : 1000000;
+    int n = argc > 2 ? atoi(argv[2]) : 1 << 22;
+    seed = argc > 3 ? (unsigned int)atol(argv[3]) : (unsigned int)time(NULL);
+    if (steps < 1 || n < 1)
+    {
+        printf("Usage: ./block-deque-testing [steps] [n] [seed]\n");
+        return 1;
+    }
+
+    srand(seed);
+    run_test(steps, PHASE_LENGTH);
+    run_test(steps, 20 * PHASE_LENGTH);
+    run_latency_comparison(n);
+    return 0;
+}
@@ -0,0 +1,325 @@
+/* Generic segmented DEQUE datastructure (using macro's)
+ * Alternative to deque.h in the style of std::deque: items are stored in fixed-size
+ * blocks that are linked from a circular block map. Adding or removing an item never
+ * moves other items, so pointers into the deque stay valid while the item is in it,
+ * and a full deque never has to be copied into a bigger array.
+ * Emptied blocks are kept on a free list (up to BLOCK_DEQUE_MAX_FREE_BLOCKS) so a
+ * deque whose size moves back and forth over a block boundary does not call malloc.
+ * The block map grows without a pause as well: once it is half full a map of twice
+ * its capacity is allocated, and every block added from then on first copies two
+ * entries of the old map into it, so the new map is complete by the time the old
+ * one is full. An add therefore moves no items, copies at most two map entries and
+ * calls malloc at most twice (for a block and for a new map), and a remove calls
+ * free at most once; how long malloc and the page faults of fresh memory take is
+ * up to the C library and the kernel.
+ */
+
+#ifndef BLOCK_DEQUE_H
+#define BLOCK_DEQUE_H
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef BLOCK_DEQUE_BLOCK_BYTES
+#define BLOCK_DEQUE_BLOCK_BYTES 4096
+#endif
+
+#ifndef BLOCK_DEQUE_MAX_FREE_BLOCKS
+#define BLOCK_DEQUE_MAX_FREE_BLOCKS 4
+#endif
+
+static const int BLOCK_DEQUE_MINIMUM_MAP_CAPACITY = 8;
+
+/* Blocks hold 'first + size' item slots: the front item is at offset 'first'
+ * (0 <= first < block size) of the block at address map_first, and the map always
+ * holds exactly the blocks that contain items. A block at address a is in
+ * map[a & (map_capacity - 1)]; while the map grows, addresses are counted modulo
+ * the capacity of the new map, next_map, so a block keeps its address in both.
+ * The map capacity is a power of two. */
+#define DEFINE_BLOCK_DEQUE_TYPE(T, prefix)                                                                   \
+    enum                                                                                                     \
+    {                                                                                                        \
+        prefix##_block_size = sizeof(T) < BLOCK_DEQUE_BLOCK_BYTES ? BLOCK_DEQUE_BLOCK_BYTES / sizeof(T) : 1  \
+    };                                                                                                       \
+                                                                                                             \
+    typedef struct prefix##_block_deque                                                                      \
+    {                                                                                                        \
+        int size;                                                                                            \
+        int first;                                                                                           \
+        T **map;                                                                                             \
+        int map_capacity;                                                                                    \
+        int map_first;                                                                                       \
+        int block_count;                                                                                     \
+        /* Map of twice the capacity being filled, and how many entries of map are copied into it */         \
+        T **next_map;                                                                                        \
+        int next_copied;                                                                                     \
+        void *free_blocks;                                                                                   \
+        int free_count;                                                                                      \
+        bool reset_iterator;                                                                                 \
+        int next_item;                                                                                       \
+        bool has_next;                                                                                       \
+    } prefix##_block_deque;                                                                                  \
+                                                                                                             \
+    /* Return pointer to deque */                                                                            \
+    prefix##_block_deque *deque_##prefix##_create(void)                                                      \
+    {                                                                                                        \
+        prefix##_block_deque *deque = malloc(sizeof(*deque));                                                \
+                                                                                                             \
+        assert(deque);                                                                                       \
+        deque->size = 0;                                                                                     \
+        deque->first = 0;                                                                                    \
+        deque->map_capacity = BLOCK_DEQUE_MINIMUM_MAP_CAPACITY;                                              \
+        deque->map_first = 0;                                                                                \
+        deque->block_count = 0;                                                                              \
+        assert((deque->map = malloc(sizeof(*deque->map) * deque->map_capacity)));                            \
+        deque->next_map = NULL;                                                                              \
+        deque->next_copied = 0;                                                                              \
+        deque->free_blocks = NULL;                                                                           \
+        deque->free_count = 0;                                                                               \
+        deque->reset_iterator = true;                                                                        \
+        deque->next_item = 0;                                                                                \
+        deque->has_next = false;                                                                             \
+        return deque;                                                                                        \
+    }                                                                                                        \
+                                                                                                             \
+    /* Block i of the deque, counted from the front */                                                       \
+    T *deque_##prefix##_block(const prefix##_block_deque *deque, int i)                                      \
+    {                                                                                                        \
+        return deque->map[(deque->map_first + i) & (deque->map_capacity - 1)];                               \
+    }                                                                                                        \
+                                                                                                             \
+    /* Free memory allocated for deque */                                                                    \
+    void deque_##prefix##_free(prefix##_block_deque *deque)                                                  \
+    {                                                                                                        \
+        assert(deque);                                                                                       \
+        for (int i = 0; i < deque->block_count; i++)                                                         \
+        {                                                                                                    \
+            free(deque_##prefix##_block(deque, i));                                                          \
+        }                                                                                                    \
+        while (deque->free_blocks)                                                                           \
+        {                                                                                                    \
+            void *next = *(void **)deque->free_blocks;                                                       \
+            free(deque->free_blocks);                                                                        \
+            deque->free_blocks = next;                                                                       \
+        }                                                                                                    \
+        free(deque->map);                                                                                    \
+        free(deque->next_map);                                                                               \
+        deque->map = NULL;                                                                                   \
+        free(deque);                                                                                         \
+        deque = NULL;                                                                                        \
+    }                                                                                                        \
+                                                                                                             \
+    /* Get an empty block, from the free list if possible */                                                 \
+    T *deque_##prefix##_take_block(prefix##_block_deque *deque)                                              \
+    {                                                                                                        \
+        if (deque->free_blocks)                                                                              \
+        {                                                                                                    \
+            T *block = deque->free_blocks;                                                                   \
+            deque->free_blocks = *(void **)deque->free_blocks;                                               \
+            deque->free_count--;                                                                             \
+            return block;                                                                                    \
+        }                                                                                                    \
+        T *block = malloc(sizeof(T) * prefix##_block_size);                                                  \
+        assert(block);                                                                                       \
+        return block;                                                                                        \
+    }                                                                                                        \
+                                                                                                             \
+    /* Put an emptied block on the free list, or free it if the list is full */                              \
+    void deque_##prefix##_release_block(prefix##_block_deque *deque, T *block)                               \
+    {                                                                                                        \
+        if (deque->free_count < BLOCK_DEQUE_MAX_FREE_BLOCKS)                                                 \
+        {                                                                                                    \
+            *(void **)block = deque->free_blocks;                                                            \
+            deque->free_blocks = block;                                                                      \
+            deque->free_count++;                                                                             \
+        }                                                                                                    \
+        else                                                                                                 \
+        {                                                                                                    \
+            free(block);                                                                                     \
+        }                                                                                                    \
+    }                                                                                                        \
+                                                                                                             \
+    /* Mask that turns a block address into an index of the newest map */                                    \
+    int deque_##prefix##_address_mask(const prefix##_block_deque *deque)                                     \
+    {                                                                                                        \
+        return (deque->next_map ? deque->map_capacity * 2 : deque->map_capacity) - 1;                        \
+    }                                                                                                        \
+                                                                                                             \
+    /* Make room for one more block in the map: from half full on, copy two more entries                     \
+     * into the next map, allocating it first if need be, and switch to it once all are in */                \
+    void deque_##prefix##_reserve_block(prefix##_block_deque *deque)                                         \
+    {                                                                                                        \
+        if (!deque->next_map && deque->block_count < deque->map_capacity / 2)                                \
+        {                                                                                                    \
+            return;                                                                                          \
+        }                                                                                                    \
+        if (!deque->next_map)                                                                                \
+        {                                                                                                    \
+            deque->next_map = malloc(sizeof(*deque->next_map) * deque->map_capacity * 2);                    \
+            assert(deque->next_map);                                                                         \
+            deque->next_copied = 0;                                                                          \
+        }                                                                                                    \
+                                                                                                             \
+        /* Entry i of the old map holds a block only if it lies within block_count of map_first */           \
+        int mask = deque->map_capacity * 2 - 1;                                                              \
+        for (int copies = 0; copies < 2 && deque->next_copied < deque->map_capacity; copies++)               \
+        {                                                                                                    \
+            int i = deque->next_copied++;                                                                    \
+            int offset = (i - deque->map_first) & (deque->map_capacity - 1);                                 \
+            if (offset < deque->block_count)                                                                 \
+            {                                                                                                \
+                deque->next_map[(deque->map_first + offset) & mask] = deque->map[i];                         \
+            }                                                                                                \
+        }                                                                                                    \
+        if (deque->next_copied == deque->map_capacity)                                                       \
+        {                                                                                                    \
+            free(deque->map);                                                                                \
+            deque->map = deque->next_map;                                                                    \
+            deque->next_map = NULL;                                                                          \
+            deque->map_capacity *= 2;                                                                        \
+        }                                                                                                    \
+    }                                                                                                        \
+                                                                                                             \
+    /* Put a new block at address in the map, and in the next map if there is one */                         \
+    void deque_##prefix##_set_block(prefix##_block_deque *deque, int address, T *block)                      \
+    {                                                                                                        \
+        deque->map[address & (deque->map_capacity - 1)] = block;                                             \
+        if (deque->next_map)                                                                                 \
+        {                                                                                                    \
+            deque->next_map[address & (deque->map_capacity * 2 - 1)] = block;                                \
+        }                                                                                                    \
+    }                                                                                                        \
+                                                                                                             \
+    /* Return pointer to the item at position i, counted from the front.                                     \
+     * The pointer stays valid until that item is removed */                                                 \
+    T *deque_##prefix##_at(const prefix##_block_deque *deque, int i)                                         \
+    {                                                                                                        \
+        assert(deque);                                                                                       \
+        assert(i >= 0 && i < deque->size);                                                                   \
+        int slot = deque->first + i;                                                                         \
+        return &deque_##prefix##_block(deque, slot / prefix##_block_size)[slot % prefix##_block_size];       \
+    }                                                                                                        \
+                                                                                                             \
+    /* Returns true if deque is empty */                                                                     \
+    bool deque_##prefix##_is_empty(const prefix##_block_deque *deque)                                        \
+    {                                                                                                        \
+        assert(deque);                                                                                       \
+        return deque->size == 0;                                                                             \
+    }                                                                                                        \
+                                                                                                             \
+    /* Add item to the front of the deque */                                                                 \
+    void deque_##prefix##_add_first(prefix##_block_deque *deque, T item)                                     \
+    {                                                                                                        \
+        assert(deque);                                                                                       \
+        if (deque->first == 0)                                                                               \
+        {                                                                                                    \
+            /* Front block is full (or there is none): put a new block in front of it */                     \
+            deque_##prefix##_reserve_block(deque);                                                           \
+            deque->map_first = (deque->map_first - 1) & deque_##prefix##_address_mask(deque);                \
+            deque_##prefix##_set_block(deque, deque->map_first, deque_##prefix##_take_block(deque));         \
+            deque->block_count++;                                                                            \
+            deque->first = prefix##_block_size;                                                              \
+        }                                                                                                    \
+                                                                                                             \
+        deque->first--;                                                                                      \
+        deque_##prefix##_block(deque, 0)[deque->first] = item;                                               \
+        deque->size++;                                                                                       \
+        deque->reset_iterator = true;                                                                        \
+    }                                                                                                        \
+                                                                                                             \
+    /* Add item to the back of the deque */                                                                  \
+    void deque_##prefix##_add_last(prefix##_block_deque *deque, T item)                                      \
+    {                                                                                                        \
+        assert(deque);                                                                                       \
+        int slot = deque->first + deque->size;                                                               \
+        int block = slot / prefix##_block_size;                                                              \
+        if (block == deque->block_count)                                                                     \
+        {                                                                                                    \
+            /* Back block is full (or there is none): put a new block behind it */                           \
+            deque_##prefix##_reserve_block(deque);                                                           \
+            deque_##prefix##_set_block(deque, deque->map_first + block, deque_##prefix##_take_block(deque)); \
+            deque->block_count++;                                                                            \
+        }                                                                                                    \
+                                                                                                             \
+        deque_##prefix##_block(deque, block)[slot % prefix##_block_size] = item;                             \
+        deque->size++;                                                                                       \
+        deque->reset_iterator = true;                                                                        \
+    }                                                                                                        \
+                                                                                                             \
+    /* Remove item from front of deque */                                                                    \
+    T deque_##prefix##_remove_first(prefix##_block_deque *deque)                                             \
+    {                                                                                                        \
+        assert(deque);                                                                                       \
+        assert(deque->size > 0);                                                                             \
+                                                                                                             \
+        T *front = deque_##prefix##_block(deque, 0);                                                         \
+        T item = front[deque->first];                                                                        \
+        deque->size--;                                                                                       \
+        deque->first++;                                                                                      \
+        if (deque->first == prefix##_block_size || deque->size == 0)                                         \
+        {                                                                                                    \
+            /* Front block is now empty */                                                                   \
+            deque_##prefix##_release_block(deque, front);                                                    \
+            deque->map_first = (deque->map_first + 1) & deque_##prefix##_address_mask(deque);                \
+            deque->block_count--;                                                                            \
+            deque->first = 0;                                                                                \
+        }                                                                                                    \
+        deque->reset_iterator = true;                                                                        \
+        return item;                                                                                         \
+    }                                                                                                        \
+                                                                                                             \
+    /* Remove item from back of deque */                                                                     \
+    T deque_##prefix##_remove_last(prefix##_block_deque *deque)                                              \
+    {                                                                                                        \
+        assert(deque);                                                                                       \
+        assert(deque->size > 0);                                                                             \
+                                                                                                             \
+        deque->size--;                                                                                       \
+        int slot = deque->first + deque->size;                                                               \
+        T *block = deque_##prefix##_block(deque, slot / prefix##_block_size);                                \
+        T item = block[slot % prefix##_block_size];                                                          \
+        if (slot % prefix##_block_size == 0 || deque->size == 0)                                             \
+        {                                                                                                    \
+            /* Back block is now empty */                                                                    \
+            deque_##prefix##_release_block(deque, block);                                                    \
+            deque->block_count--;                                                                            \
+            if (deque->size == 0)                                                                            \
+            {                                                                                                \
+                deque->first = 0;                                                                            \
+            }                                                                                                \
+        }                                                                                                    \
+        deque->reset_iterator = true;                                                                        \
+        return item;                                                                                         \
+    }                                                                                                        \
+                                                                                                             \
+    /* Iterator */                                                                                           \
+    T deque_##prefix##_iterator_next(prefix##_block_deque *deque)                                            \
+    {                                                                                                        \
+        assert(deque);                                                                                       \
+        assert(deque->size > 0);                                                                             \
+        if (deque->reset_iterator)                                                                           \
+        {                                                                                                    \
+            deque->next_item = 0;                                                                            \
+            if (deque->size == 1)                                                                            \
+            {                                                                                                \
+                deque->has_next = false;                                                                     \
+            }                                                                                                \
+            else                                                                                             \
+            {                                                                                                \
+                deque->has_next = true;                                                                      \
+            }                                                                                                \
+            deque->reset_iterator = false;                                                                   \
+        }                                                                                                    \
+                                                                                                             \
+        T item = *deque_##prefix##_at(deque, deque->next_item);                                              \
+        deque->next_item++;                                                                                  \
+        if (deque->next_item >= deque->size)                                                                 \
+        {                                                                                                    \
+            deque->has_next = false;                                                                         \
+        }                                                                                                    \
+        return item;                                                                                         \
+    }
+
+#endif
@@ -0,0 +1,121 @@
+/* Scaling benchmark of the sharded concurrent randomized queue against a single
+ * randomized queue behind one mutex. Every thread enqueues two items for each
+ * item it dequeues, for 1, 2, 4, ... up to the given number of threads.
+ * Usage: ./concurrent-rqueue-benchmark [max threads] [operations per thread]
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "concurrent-rqueue.h"
+
+DEFINE_CONCURRENT_RQUEUE_TYPE(long, number);
+
+#define MAX_THREADS 256
+
+static number_concurrent_rqueue *sharded_queue;
+static number_shard_rqueue *locked_queue;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static long operations;
+
+double seconds_since(struct timespec start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+void *sharded_worker(void *arg)
+{
+    (void)arg;
+    long item;
+    for (long i = 0; i < operations; i++)
+    {
+        if (i % 3 == 2)
+        {
+            concurrent_rqueue_number_dequeue(sharded_queue, &item);
+        }
+        else
+        {
+            concurrent_rqueue_number_enqueue(sharded_queue, i);
+        }
+    }
+    return NULL;
+}
+
+void *locked_worker(void *arg)
+{
+    (void)arg;
+    long item;
+    for (long i = 0; i < operations; i++)
+    {
+        pthread_mutex_lock(&queue_lock);
+        if (i % 3 == 2)
+        {
+            if (!rqueue_number_shard_is_empty(locked_queue))
+            {
+                rqueue_number_shard_dequeue_k(locked_queue, 1, &item);
+            }
+        }
+        else
+        {
+            rqueue_number_shard_enqueue(locked_queue, i);
+        }
+        pthread_mutex_unlock(&queue_lock);
+    }
+    return NULL;
+}
+
+double run(int threads, bool sharded)
+{
+    pthread_t workers[MAX_THREADS];
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_create(&workers[i], NULL, sharded ? sharded_worker : locked_worker, NULL);
+    }
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    return threads * operations / seconds_since(start);
+}
+
+int main(int argc, char *argv[])
+{
+    int max_threads = 8;
+    operations = 3000000;
+    if (argc > 1)
+    {
+        max_threads = atoi(argv[1]);
+    }
+    if (argc > 2)
+    {
+        operations = atol(argv[2]);
+    }
+    if (max_threads < 1 || max_threads > MAX_THREADS || operations < 1)
+    {
+        printf("Usage: ./concurrent-rqueue-benchmark [max threads] [operations per thread]\n");
+        return 1;
+    }
+
+    printf("%8s %16s %16s\n", "threads", "sharded ops/s", "mutex ops/s");
+    for (int threads = 1; threads <= max_threads; threads *= 2)
+    {
+        sharded_queue = concurrent_rqueue_number_create(threads);
+        locked_queue = rqueue_number_shard_create();
+
+        double sharded = run(threads, true);
+        double locked = run(threads, false);
+        printf("%8i %16.0f %16.0f\n", threads, sharded, locked);
+
+        concurrent_rqueue_number_free(sharded_queue);
+        rqueue_number_shard_free(locked_queue);
+    }
+    return 0;
+}
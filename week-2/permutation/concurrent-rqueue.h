@@ -0,0 +1,186 @@
+/* Generic sharded CONCURRENT RANDOMIZED QUEUE (using macro's)
+ * The queue is split into shards, each a randomized queue from rqueue.h with its
+ * own lock and random number generator. A thread enqueues into its own home
+ * shard (moving on to the next shard if that one is locked), so producers rarely
+ * contend. Dequeue picks two random shards and takes from one of them with
+ * probability proportional to its size, so bigger shards drain faster and the
+ * shards stay balanced (power of two choices).
+ *
+ * Uniformity: an item in shard s with n_s items is dequeued with probability
+ * P(s) / n_s, where P(s) is the chance that shard s is picked. With S shards
+ * P(s) = (1 + 2 * sum over j != s of n_s / (n_s + n_j)) / S^2, which is exactly
+ * 1 / S when all shards are equally full, making every item equally likely.
+ * When shard s holds (1 + d) times the average number of items, P(s) is about
+ * (1 + d / 2) / S, so its items are about (1 - d / 2) times as likely to come
+ * out as with a single queue: the deviation is half the relative imbalance
+ * between shards. Picking shards exactly in proportion to their size would
+ * remove it, but needs a consistent view of all shard sizes at every dequeue.
+ */
+
+#ifndef CONCURRENT_RQUEUE_H
+#define CONCURRENT_RQUEUE_H
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "rqueue.h"
+
+// Each thread gets a number on first use, which picks its home shard and seeds its generator
+static atomic_int concurrent_rqueue_threads;
+static _Thread_local int concurrent_rqueue_thread = -1;
+static _Thread_local uint64_t concurrent_rqueue_random_state;
+
+static inline int concurrent_rqueue_thread_number(void)
+{
+    if (concurrent_rqueue_thread < 0)
+    {
+        concurrent_rqueue_thread = atomic_fetch_add(&concurrent_rqueue_threads, 1);
+        concurrent_rqueue_random_state = rqueue_mix((uint64_t)time(NULL) ^ ((uint64_t)concurrent_rqueue_thread << 32));
+    }
+    return concurrent_rqueue_thread;
+}
+
+#define DEFINE_CONCURRENT_RQUEUE_TYPE(T, prefix)                                                      \
+    DEFINE_RQUEUE_TYPE(T, prefix##_shard)                                                             \
+                                                                                                      \
+    typedef struct prefix##_rqueue_shard                                                              \
+    {                                                                                                 \
+        _Alignas(64) pthread_mutex_t lock;                                                            \
+        atomic_int size;                                                                              \
+        prefix##_shard_rqueue *randomized_queue;                                                      \
+    } prefix##_rqueue_shard;                                                                          \
+                                                                                                      \
+    typedef struct prefix##_concurrent_rqueue                                                         \
+    {                                                                                                 \
+        int shard_count;                                                                              \
+        prefix##_rqueue_shard *shards;                                                                \
+    } prefix##_concurrent_rqueue;                                                                     \
+                                                                                                      \
+    /* Create queue with the given number of shards, typically the number of cores */                 \
+    prefix##_concurrent_rqueue *concurrent_rqueue_##prefix##_create(int shard_count)                  \
+    {                                                                                                 \
+        assert(shard_count > 0);                                                                      \
+        prefix##_concurrent_rqueue *queue = malloc(sizeof(*queue));                                   \
+        assert(queue);                                                                                \
+        queue->shard_count = shard_count;                                                             \
+        queue->shards = aligned_alloc(64, shard_count * sizeof(*queue->shards));                      \
+        assert(queue->shards);                                                                        \
+        for (int i = 0; i < shard_count; i++)                                                         \
+        {                                                                                             \
+            pthread_mutex_init(&queue->shards[i].lock, NULL);                                         \
+            atomic_init(&queue->shards[i].size, 0);                                                   \
+            queue->shards[i].randomized_queue = rqueue_##prefix##_shard_create();                     \
+            /* rqueue seeds all shards from rand(), make sure the streams differ */                   \
+            queue->shards[i].randomized_queue->random_state ^= rqueue_mix((uint64_t)i + 1);           \
+        }                                                                                             \
+        return queue;                                                                                 \
+    }                                                                                                 \
+                                                                                                      \
+    /* Free memory allocated for queue. No other thread may be using it anymore */                    \
+    void concurrent_rqueue_##prefix##_free(prefix##_concurrent_rqueue *queue)                         \
+    {                                                                                                 \
+        assert(queue);                                                                                \
+        for (int i = 0; i < queue->shard_count; i++)                                                  \
+        {                                                                                             \
+            pthread_mutex_destroy(&queue->shards[i].lock);                                            \
+            rqueue_##prefix##_shard_free(queue->shards[i].randomized_queue);                          \
+        }                                                                                             \
+        free(queue->shards);                                                                          \
+        free(queue);                                                                                  \
+        queue = NULL;                                                                                 \
+    }                                                                                                 \
+                                                                                                      \
+    /* Approximate number of items, exact when no other thread is using the queue */                  \
+    int concurrent_rqueue_##prefix##_size(prefix##_concurrent_rqueue *queue)                          \
+    {                                                                                                 \
+        assert(queue);                                                                                \
+        int size = 0;                                                                                 \
+        for (int i = 0; i < queue->shard_count; i++)                                                  \
+        {                                                                                             \
+            size += atomic_load_explicit(&queue->shards[i].size, memory_order_relaxed);               \
+        }                                                                                             \
+        return size;                                                                                  \
+    }                                                                                                 \
+                                                                                                      \
+    void concurrent_rqueue_##prefix##_enqueue(prefix##_concurrent_rqueue *queue, T item)              \
+    {                                                                                                 \
+        assert(queue);                                                                                \
+        int home = concurrent_rqueue_thread_number() % queue->shard_count;                            \
+                                                                                                      \
+        /* Try the home shard first and move on if it is busy, block on it if all are */              \
+        prefix##_rqueue_shard *shard = NULL;                                                          \
+        for (int i = 0; i < queue->shard_count && !shard; i++)                                        \
+        {                                                                                             \
+            prefix##_rqueue_shard *candidate = &queue->shards[(home + i) % queue->shard_count];       \
+            if (pthread_mutex_trylock(&candidate->lock) == 0)                                         \
+            {                                                                                         \
+                shard = candidate;                                                                    \
+            }                                                                                         \
+        }                                                                                             \
+        if (!shard)                                                                                   \
+        {                                                                                             \
+            shard = &queue->shards[home];                                                             \
+            pthread_mutex_lock(&shard->lock);                                                         \
+        }                                                                                             \
+                                                                                                      \
+        rqueue_##prefix##_shard_enqueue(shard->randomized_queue, item);                               \
+        atomic_store_explicit(&shard->size, shard->randomized_queue->size, memory_order_relaxed);     \
+        pthread_mutex_unlock(&shard->lock);                                                           \
+    }                                                                                                 \
+                                                                                                      \
+    /* Take an item out of the given shard into *item, returns false if it was empty */               \
+    bool concurrent_rqueue_##prefix##_take(prefix##_rqueue_shard *shard, T *item)                     \
+    {                                                                                                 \
+        pthread_mutex_lock(&shard->lock);                                                             \
+        bool found = shard->randomized_queue->size > 0;                                               \
+        if (found)                                                                                    \
+        {                                                                                             \
+            rqueue_##prefix##_shard_dequeue_k(shard->randomized_queue, 1, item);                      \
+            atomic_store_explicit(&shard->size, shard->randomized_queue->size, memory_order_relaxed); \
+        }                                                                                             \
+        pthread_mutex_unlock(&shard->lock);                                                           \
+        return found;                                                                                 \
+    }                                                                                                 \
+                                                                                                      \
+    /* Dequeue an approximately uniformly chosen item into *item (see top of file).                   \
+     * Returns false if the queue was empty */                                                        \
+    bool concurrent_rqueue_##prefix##_dequeue(prefix##_concurrent_rqueue *queue, T *item)             \
+    {                                                                                                 \
+        assert(queue);                                                                                \
+        concurrent_rqueue_thread_number();                                                            \
+        uint64_t *state = &concurrent_rqueue_random_state;                                            \
+                                                                                                      \
+        /* Two random shards, pick one in proportion to their sizes */                                \
+        prefix##_rqueue_shard *a = &queue->shards[rqueue_random_below(state, queue->shard_count)];    \
+        prefix##_rqueue_shard *b = &queue->shards[rqueue_random_below(state, queue->shard_count)];    \
+        int a_size = atomic_load_explicit(&a->size, memory_order_relaxed);                            \
+        int b_size = atomic_load_explicit(&b->size, memory_order_relaxed);                            \
+        if (a_size + b_size > 0)                                                                      \
+        {                                                                                             \
+            prefix##_rqueue_shard *chosen =                                                           \
+                (int)rqueue_random_below(state, a_size + b_size) < a_size ? a : b;                    \
+            if (concurrent_rqueue_##prefix##_take(chosen, item))                                      \
+            {                                                                                         \
+                return true;                                                                          \
+            }                                                                                         \
+        }                                                                                             \
+                                                                                                      \
+        /* Both looked empty: check every shard before giving up */                                   \
+        int start = rqueue_random_below(state, queue->shard_count);                                   \
+        for (int i = 0; i < queue->shard_count; i++)                                                  \
+        {                                                                                             \
+            prefix##_rqueue_shard *shard = &queue->shards[(start + i) % queue->shard_count];          \
+            if (atomic_load_explicit(&shard->size, memory_order_relaxed) > 0 &&                       \
+                concurrent_rqueue_##prefix##_take(shard, item))                                       \
+            {                                                                                         \
+                return true;                                                                          \
+            }                                                                                         \
+        }                                                                                             \
+        return false;                                                                                 \
+    }
+
+#endif
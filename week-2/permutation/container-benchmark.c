@@ -0,0 +1,246 @@
+/* Benchmark of stack.h, deque.h and rqueue.h, written to stdout as JSON so runs
+ * can be compared over time. Every container runs every workload for sizes 10,
+ * 100, ... up to the maximum size and for items of 4, 16 and 64 bytes:
+ * - growth:      add n items to a new container, then remove them all
+ * - steady_fifo: at size n, add at the back and remove from the front
+ * - steady_lifo: at size n, add and remove at the back
+ * - oscillating: go from n items down to n / 8 and back up, which crosses the
+ *                point where the container shrinks
+ * Stacks and randomized queues skip steady_fifo, as they have no front to remove
+ * from (a randomized queue dequeues a random item either way). For each run the
+ * output holds the operations per second and the allocations (storage array
+ * included) per operation.
+ * Runs whose storage would pass 2 GiB are skipped.
+ * Usage: ./container-benchmark [max size] [minimum operations per run] > results.json
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../dijkstra-two-stack/stack.h"
+#include "deque.h"
+#include "rqueue.h"
+
+typedef struct bytes16
+{
+    int values[4];
+} bytes16;
+
+typedef struct bytes64
+{
+    int values[16];
+} bytes64;
+
+DEFINE_STACK_TYPE(int, bytes4);
+DEFINE_STACK_TYPE(bytes16, bytes16);
+DEFINE_STACK_TYPE(bytes64, bytes64);
+DEFINE_DEQUE_TYPE(int, bytes4);
+DEFINE_DEQUE_TYPE(bytes16, bytes16);
+DEFINE_DEQUE_TYPE(bytes64, bytes64);
+DEFINE_RQUEUE_TYPE(int, bytes4);
+DEFINE_RQUEUE_TYPE(bytes16, bytes16);
+DEFINE_RQUEUE_TYPE(bytes64, bytes64);
+
+typedef enum workload
+{
+    GROWTH,
+    STEADY_FIFO,
+    STEADY_LIFO,
+    OSCILLATING,
+    WORKLOAD_COUNT
+} workload;
+
+static const char *WORKLOAD_NAMES[] = {"growth", "steady_fifo", "steady_lifo", "oscillating"};
+
+static const size_t MAX_STORAGE_BYTES = (size_t)2 << 30;
+
+// Every removed item ends up here, so the compiler cannot leave the removals out
+static volatile unsigned char sink;
+
+double seconds_since(struct timespec start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/* Define benchmark_name(workload, n, operations, *allocations), returning the time
+ * taken by at least the given number of operations. It sets operations to the
+ * number actually done. add, remove_front and remove_back are container functions */
+#define DEFINE_BENCHMARK(name, T, type, create, destroy, add, remove_front, remove_back) \
+    double benchmark_##name(workload w, int n, long *operations, long *allocations)      \
+    {                                                                                    \
+        T item;                                                                          \
+        T removed;                                                                       \
+        memset(&item, 1, sizeof(item));                                                  \
+        unsigned char checksum = 0;                                                      \
+        long done = 0;                                                                   \
+        struct timespec start;                                                           \
+                                                                                         \
+        type *c = create();                                                              \
+        if (w != GROWTH)                                                                 \
+        {                                                                                \
+            for (int i = 0; i < n; i++)                                                  \
+            {                                                                            \
+                add(c, item);                                                            \
+            }                                                                            \
+        }                                                                                \
+        long allocations_before = c->allocations;                                        \
+        *allocations = 0;                                                                \
+                                                                                         \
+        clock_gettime(CLOCK_MONOTONIC, &start);                                          \
+        if (w == GROWTH)                                                                 \
+        {                                                                                \
+            while (true)                                                                 \
+            {                                                                            \
+                for (int i = 0; i < n; i++)                                              \
+                {                                                                        \
+                    add(c, item);                                                        \
+                }                                                                        \
+                for (int i = 0; i < n; i++)                                              \
+                {                                                                        \
+                    removed = remove_back(c);                                            \
+                    checksum += *(unsigned char *)&removed;                              \
+                }                                                                        \
+                done += 2 * (long)n;                                                     \
+                *allocations += c->allocations;                                          \
+                destroy(c);                                                              \
+                if (done >= *operations)                                                 \
+                {                                                                        \
+                    break;                                                               \
+                }                                                                        \
+                c = create();                                                            \
+            }                                                                            \
+        }                                                                                \
+        else if (w == OSCILLATING)                                                       \
+        {                                                                                \
+            int low = n / 8;                                                             \
+            while (done < *operations)                                                   \
+            {                                                                            \
+                for (int i = n; i > low; i--)                                            \
+                {                                                                        \
+                    removed = remove_back(c);                                            \
+                    checksum += *(unsigned char *)&removed;                              \
+                }                                                                        \
+                for (int i = low; i < n; i++)                                            \
+                {                                                                        \
+                    add(c, item);                                                        \
+                }                                                                        \
+                done += 2 * (long)(n - low);                                             \
+            }                                                                            \
+        }                                                                                \
+        else                                                                             \
+        {                                                                                \
+            for (; done < *operations; done += 2)                                        \
+            {                                                                            \
+                add(c, item);                                                            \
+                removed = w == STEADY_FIFO ? remove_front(c) : remove_back(c);           \
+                checksum += *(unsigned char *)&removed;                                  \
+            }                                                                            \
+        }                                                                                \
+        double seconds = seconds_since(start);                                           \
+                                                                                         \
+        if (w != GROWTH)                                                                 \
+        {                                                                                \
+            *allocations = c->allocations - allocations_before;                          \
+            destroy(c);                                                                  \
+        }                                                                                \
+        sink = checksum;                                                                 \
+        *operations = done;                                                              \
+        return seconds;                                                                  \
+    }
+
+DEFINE_BENCHMARK(stack_bytes4, int, bytes4_stack, stack_bytes4_create, stack_bytes4_free, stack_bytes4_push,
+                 stack_bytes4_pop, stack_bytes4_pop);
+DEFINE_BENCHMARK(stack_bytes16, bytes16, bytes16_stack, stack_bytes16_create, stack_bytes16_free,
+                 stack_bytes16_push, stack_bytes16_pop, stack_bytes16_pop);
+DEFINE_BENCHMARK(stack_bytes64, bytes64, bytes64_stack, stack_bytes64_create, stack_bytes64_free,
+                 stack_bytes64_push, stack_bytes64_pop, stack_bytes64_pop);
+DEFINE_BENCHMARK(deque_bytes4, int, bytes4_deque, deque_bytes4_create, deque_bytes4_free, deque_bytes4_add_last,
+                 deque_bytes4_remove_first, deque_bytes4_remove_last);
+DEFINE_BENCHMARK(deque_bytes16, bytes16, bytes16_deque, deque_bytes16_create, deque_bytes16_free,
+                 deque_bytes16_add_last, deque_bytes16_remove_first, deque_bytes16_remove_last);
+DEFINE_BENCHMARK(deque_bytes64, bytes64, bytes64_deque, deque_bytes64_create, deque_bytes64_free,
+                 deque_bytes64_add_last, deque_bytes64_remove_first, deque_bytes64_remove_last);
+DEFINE_BENCHMARK(rqueue_bytes4, int, bytes4_rqueue, rqueue_bytes4_create, rqueue_bytes4_free, rqueue_bytes4_enqueue,
+                 rqueue_bytes4_dequeue, rqueue_bytes4_dequeue);
+DEFINE_BENCHMARK(rqueue_bytes16, bytes16, bytes16_rqueue, rqueue_bytes16_create, rqueue_bytes16_free,
+                 rqueue_bytes16_enqueue, rqueue_bytes16_dequeue, rqueue_bytes16_dequeue);
+DEFINE_BENCHMARK(rqueue_bytes64, bytes64, bytes64_rqueue, rqueue_bytes64_create, rqueue_bytes64_free,
+                 rqueue_bytes64_enqueue, rqueue_bytes64_dequeue, rqueue_bytes64_dequeue);
+
+typedef struct benchmark
+{
+    const char *container;
+    int element_size;
+    // Stacks and randomized queues have no separate front to remove from
+    bool has_front;
+    double (*run)(workload w, int n, long *operations, long *allocations);
+} benchmark;
+
+static const benchmark BENCHMARKS[] = {
+    {"stack", sizeof(int), false, benchmark_stack_bytes4},
+    {"stack", sizeof(bytes16), false, benchmark_stack_bytes16},
+    {"stack", sizeof(bytes64), false, benchmark_stack_bytes64},
+    {"deque", sizeof(int), true, benchmark_deque_bytes4},
+    {"deque", sizeof(bytes16), true, benchmark_deque_bytes16},
+    {"deque", sizeof(bytes64), true, benchmark_deque_bytes64},
+    {"rqueue", sizeof(int), false, benchmark_rqueue_bytes4},
+    {"rqueue", sizeof(bytes16), false, benchmark_rqueue_bytes16},
+    {"rqueue", sizeof(bytes64), false, benchmark_rqueue_bytes64},
+};
+
+int main(int argc, char *argv[])
+{
+    long max_size = 1000000;
+    long minimum_operations = 2000000;
+    if (argc > 1)
+    {
+        max_size = atol(argv[1]);
+    }
+    if (argc > 2)
+    {
+        minimum_operations = atol(argv[2]);
+    }
+    if (max_size < 10 || max_size > 100000000 || minimum_operations < 1)
+    {
+        printf("Usage: ./container-benchmark [max size, 10 to 10^8] [minimum operations per run]\n");
+        return 1;
+    }
+
+    bool first = true;
+    printf("[");
+    for (size_t b = 0; b < sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]); b++)
+    {
+        const benchmark *bench = &BENCHMARKS[b];
+        for (workload w = 0; w < WORKLOAD_COUNT; w++)
+        {
+            if (w == STEADY_FIFO && !bench->has_front)
+            {
+                continue;
+            }
+            for (long n = 10; n <= max_size; n *= 10)
+            {
+                // A growing container may briefly hold twice its items during a reallocation
+                if ((size_t)n * bench->element_size * 3 > MAX_STORAGE_BYTES)
+                {
+                    continue;
+                }
+                long operations = minimum_operations;
+                long allocations;
+                double seconds = bench->run(w, n, &operations, &allocations);
+                printf("%s\n  {\"container\": \"%s\", \"workload\": \"%s\", \"size\": %li, \"element_size\": %i, "
+                       "\"operations\": %li, \"seconds\": %.6f, \"ops_per_sec\": %.0f, \"allocations_per_op\": %.3g}",
+                       first ? "" : ",", bench->container, WORKLOAD_NAMES[w], n, bench->element_size, operations,
+                       seconds, operations / seconds, (double)allocations / operations);
+                fflush(stdout);
+                first = false;
+            }
+        }
+    }
+    printf("\n]\n");
+    return 0;
+}
@@ -0,0 +1,548 @@
+/* Randomized differential tests for stack.h, deque.h and rqueue.h.
+ * Every container runs a random sequence of operations next to a trivially
+ * correct model (a plain array), with phases that mostly add and phases that
+ * mostly remove so the storage array grows and shrinks many times. Contents are
+ * compared whenever the storage array changed and every 64 steps. Each container is run
+ * with the heap, pool and arena allocators. The small stack of stack.h runs the same
+ * way, around its inline capacity, after checking when it goes to the heap and back
+ * and how many heap arrays that takes. Finally snapshots are saved and loaded back
+ * with load_mmap.
+ * Usage: ./container-testing [steps] [seed]
+ */
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../dijkstra-two-stack/stack.h"
+#include "deque.h"
+#include "rqueue.h"
+
+DEFINE_STACK_TYPE(int, number);
+DEFINE_DEQUE_TYPE(int, number);
+DEFINE_RQUEUE_TYPE(int, number);
+DEFINE_STACK_TYPE(double, real);
+
+// Items the small stack holds inside itself
+#define SMALL_STACK_INLINE 8
+DEFINE_SMALL_STACK_TYPE(int, number, SMALL_STACK_INLINE);
+
+// Largest batch for the *_n and *_k operations
+#define MAX_BATCH 40
+// Steps per phase of mostly adding or mostly removing
+#define PHASE_LENGTH 3000
+
+static unsigned int seed;
+static long step;
+
+// Report the first difference with the model, with the seed and step to reproduce it
+#define CHECK(condition)                                                                       \
+    if (!(condition))                                                                          \
+    {                                                                                          \
+        printf("FAILED: %s (line %i, seed %u, step %li)\n", #condition, __LINE__, seed, step); \
+        exit(1);                                                                               \
+    }
+
+// Model: items live in buffer[front .. back), with room on both sides
+typedef struct model
+{
+    int *buffer;
+    int length;
+    int front;
+    int back;
+} model;
+
+void model_init(model *m, int length)
+{
+    m->buffer = malloc(length * sizeof(*m->buffer));
+    CHECK(m->buffer);
+    m->length = length;
+    m->front = m->back = length / 2;
+}
+
+// Move the items back to the middle when one side runs out of room
+void model_make_room(model *m, int n)
+{
+    if (m->front < n || m->back + n > m->length)
+    {
+        int size = m->back - m->front;
+        int front = (m->length - size) / 2;
+        CHECK(front >= n && front + size + n <= m->length);
+        memmove(m->buffer + front, m->buffer + m->front, size * sizeof(*m->buffer));
+        m->front = front;
+        m->back = front + size;
+    }
+}
+
+// True with a chance that favours adding in even phases and removing in odd ones,
+// always false once the container holds limit items
+bool should_add(int size, int limit)
+{
+    if (size >= limit)
+    {
+        return false;
+    }
+    bool growing = (step / PHASE_LENGTH) % 2 == 0;
+    return rand() % 10 < (growing ? 7 : 3);
+}
+
+// Random change to reservation and shrinking, which the model does not notice
+#define TUNE(container, prefix, object)                                                    \
+    switch (rand() % 3)                                                                    \
+    {                                                                                      \
+    case 0:                                                                                \
+        container##_##prefix##_reserve(object, rand() % (2 * (object)->size + 64));        \
+        break;                                                                             \
+    case 1:                                                                                \
+        container##_##prefix##_shrink_to_fit(object);                                      \
+        break;                                                                             \
+    default:                                                                               \
+        container##_##prefix##_set_shrink_factor(object, rand() % 2 ? 0 : 3 + rand() % 6); \
+        break;                                                                             \
+    }                                                                                      \
+    CHECK((object)->capacity >= (object)->size)
+
+void test_stack(const allocator *allocator, long steps)
+{
+    number_stack *stack = stack_number_create_with(allocator);
+    model m;
+    model_init(&m, 4 * PHASE_LENGTH);
+    int next = 0;
+
+    for (step = 0; step < steps; step++)
+    {
+        int choice = rand() % 100;
+        if (choice < 2)
+        {
+            TUNE(stack, number, stack);
+        }
+        else if (should_add(m.back - m.front, PHASE_LENGTH) || m.back == m.front)
+        {
+            stack_number_push(stack, next);
+            m.buffer[m.back++] = next++;
+        }
+        else
+        {
+            CHECK(stack_number_pop(stack) == m.buffer[--m.back]);
+        }
+
+        CHECK(stack->size == m.back - m.front);
+        CHECK(stack->capacity >= stack->size);
+        if (choice < 2 || step % 64 == 0)
+        {
+            int i = m.front;
+            STACK_FOREACH(number, item, stack)
+            {
+                CHECK(*item == m.buffer[i++]);
+            }
+        }
+    }
+
+    free(m.buffer);
+    stack_number_free(stack);
+}
+
+/* The items of a small stack against the model, and whether it uses its inline array exactly when it should */
+void check_small_stack(number_small_stack *stack, const model *m)
+{
+    CHECK(stack->size == m->back - m->front);
+    CHECK(stack->capacity >= stack->size && stack->capacity >= SMALL_STACK_INLINE);
+    CHECK((stack->storage_array == stack->inline_array) == (stack->capacity == SMALL_STACK_INLINE));
+    for (int i = 0; i < stack->size; i++)
+    {
+        CHECK(stack->storage_array[i] == m->buffer[m->front + i]);
+    }
+}
+
+void test_small_stack(long steps)
+{
+    number_small_stack stack;
+    small_stack_number_init(&stack);
+    model m;
+    model_init(&m, 4 * PHASE_LENGTH);
+    step = 0;
+
+    // Up to the inline capacity without the heap, then to 8 times it with a heap array that
+    // grows twice, each time the stack is full at a power of two
+    long allocations = 0;
+    for (int i = 0; i < 8 * SMALL_STACK_INLINE; i++)
+    {
+        allocations += i >= SMALL_STACK_INLINE && (i & (i - 1)) == 0;
+        small_stack_number_push(&stack, i);
+        m.buffer[m.back++] = i;
+        CHECK(stack.allocations == allocations);
+        check_small_stack(&stack, &m);
+    }
+    CHECK(stack.allocations == 3 && stack.capacity == 8 * SMALL_STACK_INLINE);
+    // Back down: three halvings, the last of which moves the items back inside without a heap call
+    while (stack.storage_array != stack.inline_array)
+    {
+        CHECK(small_stack_number_pop(&stack) == m.buffer[--m.back]);
+        check_small_stack(&stack, &m);
+    }
+    CHECK(stack.allocations == 5 && stack.size < SMALL_STACK_INLINE / 2);
+
+    // Going back and forth over the inline capacity allocates one heap array, not one per crossing
+    while (stack.size < SMALL_STACK_INLINE)
+    {
+        small_stack_number_push(&stack, m.back);
+        m.buffer[m.back] = m.back;
+        m.back++;
+    }
+    for (int i = 0; i < 100; i++)
+    {
+        small_stack_number_push(&stack, -i);
+        m.buffer[m.back++] = -i;
+        check_small_stack(&stack, &m);
+        CHECK(small_stack_number_pop(&stack) == m.buffer[--m.back]);
+    }
+    CHECK(stack.allocations == 6);
+
+    // Without shrinking, the heap array is kept even when the stack is empty
+    small_stack_number_set_shrink_factor(&stack, 0);
+    small_stack_number_push(&stack, 1);
+    while (!small_stack_number_is_empty(&stack))
+    {
+        small_stack_number_pop(&stack);
+    }
+    CHECK(stack.storage_array != stack.inline_array && stack.allocations == 6);
+    small_stack_number_deinit(&stack);
+    CHECK(stack.storage_array == stack.inline_array && stack.size == 0);
+
+    // Random pushes and pops around the inline capacity, with random shrink factors
+    small_stack_number_init(&stack);
+    m.front = m.back = 0;
+    int next = 0;
+    for (step = 0; step < steps; step++)
+    {
+        int choice = rand() % 100;
+        if (choice < 2)
+        {
+            small_stack_number_set_shrink_factor(&stack, rand() % 2 ? 0 : 3 + rand() % 6);
+        }
+        else if (should_add(m.back - m.front, 4 * SMALL_STACK_INLINE) || m.back == m.front)
+        {
+            small_stack_number_push(&stack, next);
+            m.buffer[m.back++] = next++;
+        }
+        else
+        {
+            CHECK(small_stack_number_pop(&stack) == m.buffer[--m.back]);
+        }
+        check_small_stack(&stack, &m);
+    }
+
+    free(m.buffer);
+    small_stack_number_deinit(&stack);
+}
+
+void test_deque(const allocator *allocator, long steps)
+{
+    number_deque *deque = deque_number_create_with(allocator);
+    model m;
+    model_init(&m, 4 * MAX_BATCH * PHASE_LENGTH);
+    int batch[MAX_BATCH];
+    int next = 0;
+
+    for (step = 0; step < steps; step++)
+    {
+        int size = m.back - m.front;
+        int capacity = deque->capacity;
+        int choice = rand() % 100;
+        model_make_room(&m, MAX_BATCH);
+
+        if (choice < 2)
+        {
+            TUNE(deque, number, deque);
+        }
+        else if (should_add(size, MAX_BATCH * PHASE_LENGTH) || size == 0)
+        {
+            int n = 1 + rand() % MAX_BATCH;
+            for (int i = 0; i < n; i++)
+            {
+                batch[i] = next++;
+            }
+            switch (rand() % 4)
+            {
+            case 0:
+                deque_number_add_first(deque, batch[0]);
+                m.buffer[--m.front] = batch[0];
+                break;
+            case 1:
+                deque_number_add_last(deque, batch[0]);
+                m.buffer[m.back++] = batch[0];
+                break;
+            case 2:
+                deque_number_add_first_n(deque, batch, n);
+                m.front -= n;
+                memcpy(m.buffer + m.front, batch, n * sizeof(*batch));
+                break;
+            default:
+                deque_number_add_last_n(deque, batch, n);
+                memcpy(m.buffer + m.back, batch, n * sizeof(*batch));
+                m.back += n;
+                break;
+            }
+        }
+        else
+        {
+            int n = 1 + rand() % (size < MAX_BATCH ? size : MAX_BATCH);
+            switch (rand() % 3)
+            {
+            case 0:
+                CHECK(deque_number_remove_first(deque) == m.buffer[m.front++]);
+                break;
+            case 1:
+                CHECK(deque_number_remove_last(deque) == m.buffer[--m.back]);
+                break;
+            default:
+                deque_number_remove_first_n(deque, batch, n);
+                CHECK(memcmp(batch, m.buffer + m.front, n * sizeof(*batch)) == 0);
+                m.front += n;
+                break;
+            }
+        }
+
+        CHECK(deque->size == m.back - m.front);
+        CHECK(deque->capacity >= deque->size);
+        CHECK(deque->first >= 0 && deque->first < deque->capacity);
+        CHECK(deque->last == deque->first + deque->size);
+        if (deque->size > 0)
+        {
+            // Both ends after every step, everything after resizes and every 64 steps
+            CHECK(deque->storage_array[deque->first] == m.buffer[m.front]);
+            CHECK(deque->storage_array[(deque->last - 1) % deque->capacity] == m.buffer[m.back - 1]);
+        }
+        if (choice < 2 || deque->capacity != capacity || step % 64 == 0)
+        {
+            int i = m.front;
+            DEQUE_FOREACH(number, item, deque)
+            {
+                CHECK(*item == m.buffer[i++]);
+            }
+            CHECK(i == m.back);
+        }
+    }
+
+    free(m.buffer);
+    deque_number_free(deque);
+}
+
+// The model of a randomized queue only knows which items are in it
+void test_rqueue(const allocator *allocator, long steps)
+{
+    number_rqueue *rqueue = rqueue_number_create_with(allocator);
+    bool *present = calloc(steps + 1, sizeof(*present));
+    CHECK(present);
+    int batch[MAX_BATCH];
+    int size = 0;
+    int next = 0;
+
+    for (step = 0; step < steps; step++)
+    {
+        int choice = rand() % 100;
+        if (choice < 2)
+        {
+            TUNE(rqueue, number, rqueue);
+        }
+        else if (should_add(size, PHASE_LENGTH) || size == 0)
+        {
+            rqueue_number_enqueue(rqueue, next);
+            present[next++] = true;
+            size++;
+        }
+        else
+        {
+            int n = 1 + rand() % (size < MAX_BATCH ? size : MAX_BATCH);
+            switch (rand() % 3)
+            {
+            case 0:
+                batch[0] = rqueue_number_dequeue(rqueue);
+                n = 1;
+                break;
+            case 1:
+                rqueue_number_dequeue_k(rqueue, n, batch);
+                break;
+            default:
+                rqueue_number_sample_k(rqueue, n, batch);
+                break;
+            }
+            for (int i = 0; i < n; i++)
+            {
+                CHECK(batch[i] >= 0 && batch[i] < next && present[batch[i]]);
+                present[batch[i]] = false;
+            }
+            if (rqueue->size == size)
+            {
+                // Sampled items stay in the queue, and must have been distinct
+                for (int i = 0; i < n; i++)
+                {
+                    CHECK(!present[batch[i]]);
+                    present[batch[i]] = true;
+                }
+            }
+            else
+            {
+                size -= n;
+            }
+        }
+
+        CHECK(rqueue->size == size);
+        CHECK(rqueue->capacity >= rqueue->size);
+        if (choice < 2 || step % 64 == 0)
+        {
+            int count = 0;
+            RQUEUE_FOREACH(number, item, rqueue)
+            {
+                CHECK(*item >= 0 && *item < next && present[*item]);
+                count++;
+            }
+            CHECK(count == size);
+        }
+    }
+
+    free(present);
+    rqueue_number_free(rqueue);
+}
+
+// Save a deque whose items wrap around the end of its storage array, load it as every
+// container and check that items come from the mapping until the container changes
+void test_snapshots(void)
+{
+    char path[] = "/tmp/container-testing-XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    int n = 1000;
+    step = 0;
+
+    number_deque *deque = deque_number_create();
+    for (int i = 0; i < n; i++)
+    {
+        deque_number_add_last(deque, i);
+    }
+    for (int i = 0; i < n / 2; i++)
+    {
+        deque_number_remove_first(deque);
+        deque_number_add_last(deque, n + i);
+    }
+    CHECK(deque->last > deque->capacity);
+    CHECK(deque_number_save(deque, fd));
+    close(fd);
+    deque_number_free(deque);
+
+    // Items n / 2 .. n + n / 2 - 1, front to back
+    number_deque *loaded = deque_number_load_mmap(path);
+    CHECK(loaded && loaded->mapping.address && loaded->size == n);
+    int expected = n / 2;
+    DEQUE_FOREACH(number, item, loaded)
+    {
+        CHECK(*item == expected++);
+    }
+    CHECK(deque_number_remove_first(loaded) == n / 2);
+    CHECK(deque_number_remove_last(loaded) == n + n / 2 - 1);
+    CHECK(loaded->mapping.address);
+    deque_number_add_first(loaded, -1);
+    CHECK(!loaded->mapping.address);
+    CHECK(deque_number_remove_first(loaded) == -1);
+    expected = n / 2 + 1;
+    DEQUE_FOREACH(number, item, loaded)
+    {
+        CHECK(*item == expected++);
+    }
+    CHECK(expected == n + n / 2 - 1);
+    deque_number_free(loaded);
+
+    number_stack *stack = stack_number_load_mmap(path);
+    CHECK(stack && stack->mapping.address && stack->size == n);
+    CHECK(stack_number_pop(stack) == n + n / 2 - 1);
+    stack_number_push(stack, -1);
+    CHECK(!stack->mapping.address);
+    CHECK(stack_number_pop(stack) == -1);
+    CHECK(stack_number_pop(stack) == n + n / 2 - 2);
+    stack_number_free(stack);
+
+    number_rqueue *rqueue = rqueue_number_load_mmap(path);
+    CHECK(rqueue && rqueue->mapping.address && rqueue->size == n);
+    long sum = 0;
+    RQUEUE_FOREACH(number, item, rqueue)
+    {
+        sum += *item;
+    }
+    CHECK(sum == (long)n * (n - 1) / 2 + (long)n * (n / 2));
+    int item = rqueue_number_dequeue(rqueue);
+    CHECK(!rqueue->mapping.address);
+    CHECK(item >= n / 2 && item < n + n / 2 && rqueue->size == n - 1);
+    rqueue_number_free(rqueue);
+
+    // Items of another size, a truncated file and a missing file are refused
+    CHECK(stack_real_load_mmap(path) == NULL);
+    CHECK(truncate(path, sizeof(snapshot_header) + 10) == 0);
+    CHECK(deque_number_load_mmap(path) == NULL);
+    CHECK(unlink(path) == 0);
+    CHECK(deque_number_load_mmap(path) == NULL);
+
+    // An empty snapshot maps nothing
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    CHECK(fd >= 0);
+    stack = stack_number_create();
+    CHECK(stack_number_save(stack, fd));
+    close(fd);
+    stack_number_free(stack);
+    stack = stack_number_load_mmap(path);
+    CHECK(stack && !stack->mapping.address && stack->size == 0);
+    stack_number_push(stack, 1);
+    CHECK(stack_number_pop(stack) == 1);
+    stack_number_free(stack);
+    unlink(path);
+}
+
+int main(int argc, char *argv[])
+{
+    long steps = 300000;
+    seed = time(NULL);
+    if (argc > 1)
+    {
+        steps = atol(argv[1]);
+    }
+    if (argc > 2)
+    {
+        seed = strtoul(argv[2], NULL, 10);
+    }
+    if (steps < 1)
+    {
+        printf("Usage: ./container-testing [steps] [seed]\n");
+        return 1;
+    }
+    srand(seed);
+    printf("Seed %u, %li steps per test\n", seed, steps);
+
+    pool p;
+    arena a;
+    pool_init(&p);
+    arena_init(&a, 64 * 1024);
+    const allocator *allocators[] = {&HEAP_ALLOCATOR, &p.allocator, &a.allocator};
+    const char *names[] = {"heap", "pool", "arena"};
+
+    for (int i = 0; i < 3; i++)
+    {
+        test_stack(allocators[i], steps);
+        printf("stack  (%-5s): OK\n", names[i]);
+        test_deque(allocators[i], steps);
+        printf("deque  (%-5s): OK\n", names[i]);
+        test_rqueue(allocators[i], steps);
+        printf("rqueue (%-5s): OK\n", names[i]);
+        arena_reset(&a);
+    }
+    test_small_stack(steps);
+    printf("small stack   : OK\n");
+    test_snapshots();
+    printf("snapshots     : OK\n");
+
+    pool_free(&p);
+    arena_free(&a);
+    return 0;
+}
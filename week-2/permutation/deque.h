@@ -8,259 +8,531 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-static const size_t MINIMUM_CAPACITY = 8;
+#include "allocator.h"
+#include "snapshot.h"
 
-#define DEFINE_DEQUE_TYPE(T, prefix)                                                                                   \
-    typedef struct prefix##_deque                                                                                      \
-    {                                                                                                                  \
-        int capacity;                                                                                                  \
-        int size;                                                                                                      \
-        int first;                                                                                                     \
-        int last;                                                                                                      \
-        T *storage_array;                                                                                              \
-        bool reset_iterator;                                                                                           \
-        int next_item;                                                                                                 \
-        bool has_next;                                                                                                 \
-    } prefix##_deque;                                                                                                  \
-                                                                                                                       \
-    /* Return pointer to deque */                                                                                      \
-    prefix##_deque *deque_##prefix##_create(void)                                                                      \
-    {                                                                                                                  \
-        prefix##_deque *deque = malloc(sizeof(*deque));                                                                \
-                                                                                                                       \
-        assert(deque);                                                                                                 \
-        deque->capacity = MINIMUM_CAPACITY;                                                                            \
-        deque->size = 0;                                                                                               \
-        deque->first = 0;                                                                                              \
-        deque->last = 0;                                                                                               \
-        assert((deque->storage_array = malloc(sizeof(*deque->storage_array) * deque->capacity)));                      \
-        deque->reset_iterator = true;                                                                                  \
-        deque->next_item = 0;                                                                                          \
-        deque->has_next = false;                                                                                       \
-        return deque;                                                                                                  \
-    }                                                                                                                  \
-                                                                                                                       \
-    /* Free memory allocated for deque */                                                                              \
-    void deque_##prefix##_free(prefix##_deque *deque)                                                                  \
-    {                                                                                                                  \
-        assert(deque);                                                                                                 \
-        free(deque->storage_array);                                                                                    \
-        deque->storage_array = NULL;                                                                                   \
-        free(deque);                                                                                                   \
-        deque = NULL;                                                                                                  \
-    }                                                                                                                  \
-                                                                                                                       \
-    /* Resize deque */                                                                                                 \
-    void deque_##prefix##_resize(prefix##_deque *deque, int increase)                                                  \
-    {                                                                                                                  \
-        if (!increase)                                                                                                 \
-        {                                                                                                              \
-            /* Halve array capacity */                                                                                 \
-            deque->capacity /= 2;                                                                                      \
-            T *tmp = malloc(deque->capacity * sizeof(deque->storage_array));                                           \
-            assert(tmp);                                                                                               \
-            for (int i = deque->first; i < deque->last; i++)                                                           \
-            {                                                                                                          \
-                if (i < 0)                                                                                             \
-                {                                                                                                      \
-                    tmp[i - deque->first] = deque->storage_array[(deque->capacity * 2) + (i % (deque->capacity * 2))]; \
-                }                                                                                                      \
-                else                                                                                                   \
-                {                                                                                                      \
-                    tmp[i - deque->first] = deque->storage_array[i % (deque->capacity * 2)];                           \
-                }                                                                                                      \
-            }                                                                                                          \
-            deque->first = 0;                                                                                          \
-            deque->last = deque->size;                                                                                 \
-            free(deque->storage_array);                                                                                \
-            deque->storage_array = tmp;                                                                                \
-        }                                                                                                              \
-        else                                                                                                           \
-        {                                                                                                              \
-            /* Double array capacity */                                                                                \
-            deque->capacity *= 2;                                                                                      \
-            T *tmp = malloc(deque->capacity * sizeof(deque->storage_array));                                           \
-            assert(tmp);                                                                                               \
-            for (int i = deque->first; i < deque->last; i++)                                                           \
-            {                                                                                                          \
-                if (i < 0)                                                                                             \
-                {                                                                                                      \
-                    tmp[i - deque->first] = deque->storage_array[(deque->capacity / 2) + (i % (deque->capacity / 2))]; \
-                }                                                                                                      \
-                else                                                                                                   \
-                {                                                                                                      \
-                    tmp[i - deque->first] = deque->storage_array[i % (deque->capacity / 2)];                           \
-                }                                                                                                      \
-            }                                                                                                          \
-            deque->first = 0;                                                                                          \
-            deque->last = deque->size;                                                                                 \
-            free(deque->storage_array);                                                                                \
-            deque->storage_array = tmp;                                                                                \
-        }                                                                                                              \
-        return;                                                                                                        \
-    }                                                                                                                  \
-                                                                                                                       \
-    /* Returns true if deque is empty */                                                                               \
-    bool deque_##prefix##_is_empty(const prefix##_deque *deque)                                                        \
-    {                                                                                                                  \
-        assert(deque);                                                                                                 \
-        return deque->size == 0;                                                                                       \
-    }                                                                                                                  \
-                                                                                                                       \
-    /* Add item to the front of the deque */                                                                           \
-    void deque_##prefix##_add_first(prefix##_deque *deque, T item)                                                     \
-    {                                                                                                                  \
-        assert(deque);                                                                                                 \
-        if (deque->size == deque->capacity)                                                                            \
-        {                                                                                                              \
-            deque_##prefix##_resize(deque, 1);                                                                         \
-        }                                                                                                              \
-                                                                                                                       \
-        if (deque->size == 0)                                                                                          \
-        {                                                                                                              \
-            deque->size++;                                                                                             \
-            deque->first = 0;                                                                                          \
-            deque->last = 1;                                                                                           \
-            deque->storage_array[0] = item;                                                                            \
-        }                                                                                                              \
-        else                                                                                                           \
-        {                                                                                                              \
-            deque->size++;                                                                                             \
-            deque->first--;                                                                                            \
-            int index;                                                                                                 \
-            if (deque->first < 0)                                                                                      \
-            {                                                                                                          \
-                index = deque->capacity + (deque->first % deque->capacity);                                            \
-                deque->storage_array[index] = item;                                                                    \
-            }                                                                                                          \
-            else                                                                                                       \
-            {                                                                                                          \
-                index = deque->first % deque->capacity;                                                                \
-                deque->storage_array[deque->first % deque->capacity] = item;                                           \
-            }                                                                                                          \
-        }                                                                                                              \
-        deque->reset_iterator = true;                                                                                  \
-    }                                                                                                                  \
-                                                                                                                       \
-    /* Add item to the back of the deque */                                                                            \
-    void deque_##prefix##_add_last(prefix##_deque *deque, T item)                                                      \
-    {                                                                                                                  \
-        assert(deque);                                                                                                 \
-        if (deque->size == deque->capacity)                                                                            \
-        {                                                                                                              \
-            deque_##prefix##_resize(deque, 1);                                                                         \
-        }                                                                                                              \
-        if (deque->size == 0)                                                                                          \
-        {                                                                                                              \
-            deque->size++;                                                                                             \
-            deque->first = 0;                                                                                          \
-            deque->last = 1;                                                                                           \
-            deque->storage_array[0] = item;                                                                            \
-        }                                                                                                              \
-        else                                                                                                           \
-        {                                                                                                              \
-            deque->size++;                                                                                             \
-            int index;                                                                                                 \
-            if (deque->last < 0)                                                                                       \
-            {                                                                                                          \
-                index = deque->capacity + (deque->last % deque->capacity);                                             \
-                deque->storage_array[index] = item;                                                                    \
-            }                                                                                                          \
-            else                                                                                                       \
-            {                                                                                                          \
-                index = deque->last % deque->capacity;                                                                 \
-                deque->storage_array[index] = item;                                                                    \
-            }                                                                                                          \
-            deque->last++;                                                                                             \
-            deque->reset_iterator = true;                                                                              \
-        }                                                                                                              \
-    }                                                                                                                  \
-                                                                                                                       \
-    /* Remove item from front of deck */                                                                               \
-    T deque_##prefix##_remove_first(prefix##_deque *deque)                                                             \
-    {                                                                                                                  \
-        assert(deque);                                                                                                 \
-        assert(deque->size > 0);                                                                                       \
-        if ((deque->size <= (deque->capacity / 4)) && (deque->capacity > MINIMUM_CAPACITY))                            \
-        {                                                                                                              \
-            deque_##prefix##_resize(deque, 0);                                                                         \
-        }                                                                                                              \
-                                                                                                                       \
-        deque->size--;                                                                                                 \
-        T item;                                                                                                        \
-        if (deque->first < 0)                                                                                          \
-        {                                                                                                              \
-            item = deque->storage_array[deque->capacity + (deque->first % deque->capacity)];                           \
-        }                                                                                                              \
-        else                                                                                                           \
-        {                                                                                                              \
-            item = deque->storage_array[deque->first % deque->capacity];                                               \
-        }                                                                                                              \
-        deque->first++;                                                                                                \
-        deque->reset_iterator = true;                                                                                  \
-        return item;                                                                                                   \
-    }                                                                                                                  \
-                                                                                                                       \
-    /* Remove item from back of deque */                                                                               \
-    T deque_##prefix##_remove_last(prefix##_deque *deque)                                                              \
-    {                                                                                                                  \
-        assert(deque);                                                                                                 \
-        assert(deque->size > 0);                                                                                       \
-        if ((deque->size <= (deque->capacity / 4)) && (deque->capacity > MINIMUM_CAPACITY))                            \
-        {                                                                                                              \
-            deque_##prefix##_resize(deque, 0);                                                                         \
-        }                                                                                                              \
-                                                                                                                       \
-        deque->size--;                                                                                                 \
-        deque->last--;                                                                                                 \
-        T item;                                                                                                        \
-        if (deque->last < 0)                                                                                           \
-        {                                                                                                              \
-            item = deque->storage_array[deque->capacity + (deque->last % deque->capacity)];                            \
-        }                                                                                                              \
-        else                                                                                                           \
-        {                                                                                                              \
-            item = deque->storage_array[deque->last % deque->capacity];                                                \
-        }                                                                                                              \
-        deque->reset_iterator = true;                                                                                  \
-        return item;                                                                                                   \
-    }                                                                                                                  \
-                                                                                                                       \
-    /* Iterator */                                                                                                     \
-    T deque_##prefix##_iterator_next(prefix##_deque *deque)                                                            \
-    {                                                                                                                  \
-        assert(deque);                                                                                                 \
-        assert(deque->size > 0);                                                                                       \
-        if (deque->reset_iterator)                                                                                     \
-        {                                                                                                              \
-            deque->next_item = deque->first;                                                                           \
-            if (deque->size == 1)                                                                                      \
-            {                                                                                                          \
-                deque->has_next = false;                                                                               \
-            }                                                                                                          \
-            else                                                                                                       \
-            {                                                                                                          \
-                deque->has_next = true;                                                                                \
-            }                                                                                                          \
-            deque->reset_iterator = false;                                                                             \
-        }                                                                                                              \
-                                                                                                                       \
-        T item;                                                                                                        \
-        if (deque->next_item < 0)                                                                                      \
-        {                                                                                                              \
-            item = deque->storage_array[deque->capacity + (deque->next_item % deque->capacity)];                       \
-        }                                                                                                              \
-        else                                                                                                           \
-        {                                                                                                              \
-            item = deque->storage_array[deque->next_item % deque->capacity];                                           \
-        }                                                                                                              \
-                                                                                                                       \
-        deque->next_item++;                                                                                            \
-        if (deque->next_item >= deque->last)                                                                           \
-        {                                                                                                              \
-            deque->has_next = false;                                                                                   \
-        }                                                                                                              \
-        return item;                                                                                                   \
+/* Shared with stack.h and rqueue.h. By default a container halves its capacity
+ * once it is at most a quarter full (DEFAULT_SHRINK_FACTOR) */
+#ifndef CONTAINER_DEFAULTS
+#define CONTAINER_DEFAULTS
+static const int MINIMUM_CAPACITY = 8;
+static const int DEFAULT_SHRINK_FACTOR = 4;
+#endif
+
+/* Items live in a circular storage array: 'first' is the array index of the
+ * front item (0 <= first < capacity) and 'last' is first + size, so the item
+ * at logical position i is found at index first + i, minus capacity if that
+ * runs past the end of the array. */
+#define DEFINE_DEQUE_TYPE(T, prefix)                                                                            \
+    typedef struct prefix##_deque                                                                               \
+    {                                                                                                           \
+        int capacity;                                                                                           \
+        int size;                                                                                               \
+        int first;                                                                                              \
+        int last;                                                                                               \
+        T *storage_array;                                                                                       \
+        const allocator *allocator;                                                                             \
+        int minimum_capacity;                                                                                   \
+        int shrink_factor;                                                                                      \
+        long allocations;                                                                                       \
+        snapshot_mapping mapping;                                                                               \
+        bool reset_iterator;                                                                                    \
+        int next_item;                                                                                          \
+        bool has_next;                                                                                          \
+    } prefix##_deque;                                                                                           \
+                                                                                                                \
+    /* Item type, for DEQUE_FOREACH */                                                                          \
+    typedef T prefix##_deque_item;                                                                              \
+                                                                                                                \
+    /* Contiguous run of items, see deque_span */                                                               \
+    typedef struct prefix##_deque_span                                                                          \
+    {                                                                                                           \
+        T *items;                                                                                               \
+        int length;                                                                                             \
+    } prefix##_deque_span;                                                                                      \
+                                                                                                                \
+    /* Return pointer to deque whose memory comes from the given allocator */                                   \
+    prefix##_deque *deque_##prefix##_create_with(const allocator *allocator)                                    \
+    {                                                                                                           \
+        prefix##_deque *deque = allocator->allocate(allocator->context, sizeof(*deque));                        \
+                                                                                                                \
+        assert(deque);                                                                                          \
+        deque->capacity = MINIMUM_CAPACITY;                                                                     \
+        deque->size = 0;                                                                                        \
+        deque->first = 0;                                                                                       \
+        deque->last = 0;                                                                                        \
+        deque->allocator = allocator;                                                                           \
+        assert((deque->storage_array = allocator->allocate(allocator->context, sizeof(T) * deque->capacity)));  \
+        deque->minimum_capacity = MINIMUM_CAPACITY;                                                             \
+        deque->shrink_factor = DEFAULT_SHRINK_FACTOR;                                                           \
+        deque->allocations = 1;                                                                                 \
+        deque->mapping = (snapshot_mapping){NULL, 0};                                                           \
+        deque->reset_iterator = true;                                                                           \
+        deque->next_item = 0;                                                                                   \
+        deque->has_next = false;                                                                                \
+        return deque;                                                                                           \
+    }                                                                                                           \
+                                                                                                                \
+    /* Return pointer to deque */                                                                               \
+    prefix##_deque *deque_##prefix##_create(void)                                                               \
+    {                                                                                                           \
+        return deque_##prefix##_create_with(&HEAP_ALLOCATOR);                                                   \
+    }                                                                                                           \
+                                                                                                                \
+    /* Free memory allocated for deque */                                                                       \
+    void deque_##prefix##_free(prefix##_deque *deque)                                                           \
+    {                                                                                                           \
+        assert(deque);                                                                                          \
+        const allocator *allocator = deque->allocator;                                                          \
+        if (deque->mapping.address)                                                                             \
+        {                                                                                                       \
+            snapshot_unmap(&deque->mapping);                                                                    \
+        }                                                                                                       \
+        else                                                                                                    \
+        {                                                                                                       \
+            allocator->release(allocator->context, deque->storage_array, sizeof(T) * deque->capacity);          \
+        }                                                                                                       \
+        deque->storage_array = NULL;                                                                            \
+        allocator->release(allocator->context, deque, sizeof(*deque));                                          \
+        deque = NULL;                                                                                           \
+    }                                                                                                           \
+                                                                                                                \
+    /* Move the items into a storage array of the given capacity (at least size).                               \
+     * Growing reallocs in place and moves the wrapped-around part behind the old                               \
+     * end; shrinking copies at most two contiguous segments into a new array */                                \
+    void deque_##prefix##_reallocate(prefix##_deque *deque, int capacity)                                       \
+    {                                                                                                           \
+        assert(capacity >= deque->size);                                                                        \
+        const allocator *allocator = deque->allocator;                                                          \
+        if (deque->mapping.address)                                                                             \
+        {                                                                                                       \
+            /* Loaded snapshot: copy the items out of the read-only mapping,                                    \
+             * where they never wrap around since nothing was added yet */                                      \
+            T *tmp = allocator->allocate(allocator->context, capacity * sizeof(T));                             \
+            assert(tmp);                                                                                        \
+            deque->allocations++;                                                                               \
+            memcpy(tmp, deque->storage_array + deque->first, deque->size * sizeof(*tmp));                       \
+            snapshot_unmap(&deque->mapping);                                                                    \
+            deque->storage_array = tmp;                                                                         \
+            deque->capacity = capacity;                                                                         \
+            deque->first = 0;                                                                                   \
+            deque->last = deque->size;                                                                          \
+            return;                                                                                             \
+        }                                                                                                       \
+        if (deque->size == 0)                                                                                   \
+        {                                                                                                       \
+            deque->first = 0;                                                                                   \
+            deque->last = 0;                                                                                    \
+        }                                                                                                       \
+        int old_capacity = deque->capacity;                                                                     \
+        int head = old_capacity - deque->first;                                                                 \
+        int wrapped = deque->last > old_capacity ? deque->last - old_capacity : 0;                              \
+                                                                                                                \
+        if (capacity > old_capacity)                                                                            \
+        {                                                                                                       \
+            T *tmp = allocator->reallocate(allocator->context, deque->storage_array, old_capacity * sizeof(T),  \
+                                           capacity * sizeof(T));                                               \
+            assert(tmp);                                                                                        \
+            deque->allocations++;                                                                               \
+            if (wrapped > 0)                                                                                    \
+            {                                                                                                   \
+                /* Continue the front segment past the old end if the wrapped part fits there,                  \
+                 * otherwise slide the front segment to the new end of the array */                             \
+                if (wrapped <= capacity - old_capacity)                                                         \
+                {                                                                                               \
+                    memcpy(tmp + old_capacity, tmp, wrapped * sizeof(*tmp));                                    \
+                }                                                                                               \
+                else                                                                                            \
+                {                                                                                               \
+                    memmove(tmp + capacity - head, tmp + deque->first, head * sizeof(*tmp));                    \
+                    deque->first = capacity - head;                                                             \
+                }                                                                                               \
+            }                                                                                                   \
+            deque->storage_array = tmp;                                                                         \
+        }                                                                                                       \
+        else if (wrapped == 0 && deque->last <= capacity)                                                       \
+        {                                                                                                       \
+            T *tmp = allocator->reallocate(allocator->context, deque->storage_array, old_capacity * sizeof(T),  \
+                                           capacity * sizeof(T));                                               \
+            assert(tmp);                                                                                        \
+            deque->allocations++;                                                                               \
+            deque->storage_array = tmp;                                                                         \
+        }                                                                                                       \
+        else                                                                                                    \
+        {                                                                                                       \
+            T *tmp = allocator->allocate(allocator->context, capacity * sizeof(T));                             \
+            assert(tmp);                                                                                        \
+            deque->allocations++;                                                                               \
+            if (wrapped > 0)                                                                                    \
+            {                                                                                                   \
+                memcpy(tmp, deque->storage_array + deque->first, head * sizeof(*tmp));                          \
+                memcpy(tmp + head, deque->storage_array, wrapped * sizeof(*tmp));                               \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                memcpy(tmp, deque->storage_array + deque->first, deque->size * sizeof(*tmp));                   \
+            }                                                                                                   \
+            allocator->release(allocator->context, deque->storage_array, old_capacity * sizeof(T));             \
+            deque->storage_array = tmp;                                                                         \
+            deque->first = 0;                                                                                   \
+        }                                                                                                       \
+        deque->capacity = capacity;                                                                             \
+        deque->last = deque->first + deque->size;                                                               \
+    }                                                                                                           \
+                                                                                                                \
+    /* Resize deque */                                                                                          \
+    void deque_##prefix##_resize(prefix##_deque *deque, int increase)                                           \
+    {                                                                                                           \
+        if (!increase)                                                                                          \
+        {                                                                                                       \
+            /* Halve array capacity */                                                                          \
+            deque_##prefix##_reallocate(deque, deque->capacity / 2);                                            \
+        }                                                                                                       \
+        else                                                                                                    \
+        {                                                                                                       \
+            /* Double array capacity */                                                                         \
+            deque_##prefix##_reallocate(deque, deque->capacity * 2);                                            \
+        }                                                                                                       \
+        return;                                                                                                 \
+    }                                                                                                           \
+                                                                                                                \
+    /* Copy the items of a loaded snapshot into storage that can be written,                                    \
+     * with room for one more item */                                                                           \
+    void deque_##prefix##_make_writable(prefix##_deque *deque)                                                  \
+    {                                                                                                           \
+        if (deque->mapping.address)                                                                             \
+        {                                                                                                       \
+            int capacity = deque->size == deque->capacity ? deque->capacity * 2 : deque->capacity;              \
+            deque_##prefix##_reallocate(deque, capacity);                                                       \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    /* Double capacity until n more items fit, with at most one reallocation */                                 \
+    void deque_##prefix##_grow_for(prefix##_deque *deque, int n)                                                \
+    {                                                                                                           \
+        int capacity = deque->capacity;                                                                         \
+        while (deque->size + n > capacity)                                                                      \
+        {                                                                                                       \
+            capacity *= 2;                                                                                      \
+        }                                                                                                       \
+        if (capacity != deque->capacity)                                                                        \
+        {                                                                                                       \
+            deque_##prefix##_reallocate(deque, capacity);                                                       \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    /* Halve capacity while the deque is sparse enough according to its shrink factor,                          \
+     * with at most one reallocation */                                                                         \
+    void deque_##prefix##_shrink_after_remove(prefix##_deque *deque)                                            \
+    {                                                                                                           \
+        if (deque->shrink_factor == 0)                                                                          \
+        {                                                                                                       \
+            return;                                                                                             \
+        }                                                                                                       \
+        int capacity = deque->capacity;                                                                         \
+        while ((deque->size <= (capacity / deque->shrink_factor)) && (capacity / 2 >= deque->minimum_capacity)) \
+        {                                                                                                       \
+            capacity /= 2;                                                                                      \
+        }                                                                                                       \
+        if (capacity != deque->capacity)                                                                        \
+        {                                                                                                       \
+            deque_##prefix##_reallocate(deque, capacity);                                                       \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    /* Make room for at least n items. Automatic shrinking will not go below                                    \
+     * this capacity until deque_shrink_to_fit is called */                                                     \
+    void deque_##prefix##_reserve(prefix##_deque *deque, int n)                                                 \
+    {                                                                                                           \
+        assert(deque);                                                                                          \
+        assert(n >= 0);                                                                                         \
+        if (n > deque->minimum_capacity)                                                                        \
+        {                                                                                                       \
+            deque->minimum_capacity = n;                                                                        \
+        }                                                                                                       \
+        if (n > deque->capacity)                                                                                \
+        {                                                                                                       \
+            deque_##prefix##_reallocate(deque, n);                                                              \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    /* Reduce capacity to the current size (or MINIMUM_CAPACITY) and drop any reservation */                    \
+    void deque_##prefix##_shrink_to_fit(prefix##_deque *deque)                                                  \
+    {                                                                                                           \
+        assert(deque);                                                                                          \
+        deque->minimum_capacity = MINIMUM_CAPACITY;                                                             \
+        int capacity = deque->size > MINIMUM_CAPACITY ? deque->size : MINIMUM_CAPACITY;                         \
+        if (capacity != deque->capacity)                                                                        \
+        {                                                                                                       \
+            deque_##prefix##_reallocate(deque, capacity);                                                       \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    /* Shrink when at most 1 / factor of the capacity is in use (factor > 2),                                   \
+     * or never if factor is 0 */                                                                               \
+    void deque_##prefix##_set_shrink_factor(prefix##_deque *deque, int factor)                                  \
+    {                                                                                                           \
+        assert(deque);                                                                                          \
+        assert(factor == 0 || factor > 2);                                                                      \
+        deque->shrink_factor = factor;                                                                          \
+    }                                                                                                           \
+                                                                                                                \
+    /* Returns true if deque is empty */                                                                        \
+    bool deque_##prefix##_is_empty(const prefix##_deque *deque)                                                 \
+    {                                                                                                           \
+        assert(deque);                                                                                          \
+        return deque->size == 0;                                                                                \
+    }                                                                                                           \
+                                                                                                                \
+    /* Add item to the front of the deque */                                                                    \
+    void deque_##prefix##_add_first(prefix##_deque *deque, T item)                                              \
+    {                                                                                                           \
+        assert(deque);                                                                                          \
+        deque_##prefix##_make_writable(deque);                                                                  \
+        if (deque->size == deque->capacity)                                                                     \
+        {                                                                                                       \
+            deque_##prefix##_resize(deque, 1);                                                                  \
+        }                                                                                                       \
+                                                                                                                \
+        if (deque->first == 0)                                                                                  \
+        {                                                                                                       \
+            deque->first = deque->capacity;                                                                     \
+        }                                                                                                       \
+        deque->first--;                                                                                         \
+        deque->storage_array[deque->first] = item;                                                              \
+        deque->size++;                                                                                          \
+        deque->last = deque->first + deque->size;                                                               \
+        deque->reset_iterator = true;                                                                           \
+    }                                                                                                           \
+                                                                                                                \
+    /* Add item to the back of the deque */                                                                     \
+    void deque_##prefix##_add_last(prefix##_deque *deque, T item)                                               \
+    {                                                                                                           \
+        assert(deque);                                                                                          \
+        deque_##prefix##_make_writable(deque);                                                                  \
+        if (deque->size == deque->capacity)                                                                     \
+        {                                                                                                       \
+            deque_##prefix##_resize(deque, 1);                                                                  \
+        }                                                                                                       \
+                                                                                                                \
+        int index = deque->last;                                                                                \
+        if (index >= deque->capacity)                                                                           \
+        {                                                                                                       \
+            index -= deque->capacity;                                                                           \
+        }                                                                                                       \
+        deque->storage_array[index] = item;                                                                     \
+        deque->size++;                                                                                          \
+        deque->last++;                                                                                          \
+        deque->reset_iterator = true;                                                                           \
+    }                                                                                                           \
+                                                                                                                \
+    /* Add n items to the front of the deque, keeping their order:                                              \
+     * items[0] becomes the new first item */                                                                   \
+    void deque_##prefix##_add_first_n(prefix##_deque *deque, const T *items, int n)                             \
+    {                                                                                                           \
+        assert(deque);                                                                                          \
+        assert(n >= 0);                                                                                         \
+        deque_##prefix##_make_writable(deque);                                                                  \
+        deque_##prefix##_grow_for(deque, n);                                                                    \
+                                                                                                                \
+        /* Fill the space in front of 'first', then wrap to the end of the array */                             \
+        int front = n < deque->first ? n : deque->first;                                                        \
+        int wrapped = n - front;                                                                                \
+        memcpy(deque->storage_array + deque->first - front, items + wrapped, front * sizeof(*items));           \
+        memcpy(deque->storage_array + deque->capacity - wrapped, items, wrapped * sizeof(*items));              \
+        deque->first = wrapped > 0 ? deque->capacity - wrapped : deque->first - front;                          \
+        deque->size += n;                                                                                       \
+        deque->last = deque->first + deque->size;                                                               \
+        deque->reset_iterator = true;                                                                           \
+    }                                                                                                           \
+                                                                                                                \
+    /* Add n items to the back of the deque, keeping their order:                                               \
+     * items[n - 1] becomes the new last item */                                                                \
+    void deque_##prefix##_add_last_n(prefix##_deque *deque, const T *items, int n)                              \
+    {                                                                                                           \
+        assert(deque);                                                                                          \
+        assert(n >= 0);                                                                                         \
+        deque_##prefix##_make_writable(deque);                                                                  \
+        deque_##prefix##_grow_for(deque, n);                                                                    \
+                                                                                                                \
+        int tail = deque->last >= deque->capacity ? deque->last - deque->capacity : deque->last;                \
+        int back = n < deque->capacity - tail ? n : deque->capacity - tail;                                     \
+        memcpy(deque->storage_array + tail, items, back * sizeof(*items));                                      \
+        memcpy(deque->storage_array, items + back, (n - back) * sizeof(*items));                                \
+        deque->size += n;                                                                                       \
+        deque->last += n;                                                                                       \
+        deque->reset_iterator = true;                                                                           \
+    }                                                                                                           \
+                                                                                                                \
+    /* Remove item from front of deck */                                                                        \
+    T deque_##prefix##_remove_first(prefix##_deque *deque)                                                      \
+    {                                                                                                           \
+        assert(deque);                                                                                          \
+        assert(deque->size > 0);                                                                                \
+        deque_##prefix##_shrink_after_remove(deque);                                                            \
+                                                                                                                \
+        T item = deque->storage_array[deque->first];                                                            \
+        deque->size--;                                                                                          \
+        deque->first++;                                                                                         \
+        if (deque->first == deque->capacity)                                                                    \
+        {                                                                                                       \
+            deque->first = 0;                                                                                   \
+        }                                                                                                       \
+        deque->last = deque->first + deque->size;                                                               \
+        deque->reset_iterator = true;                                                                           \
+        return item;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    /* Remove item from back of deque */                                                                        \
+    T deque_##prefix##_remove_last(prefix##_deque *deque)                                                       \
+    {                                                                                                           \
+        assert(deque);                                                                                          \
+        assert(deque->size > 0);                                                                                \
+        deque_##prefix##_shrink_after_remove(deque);                                                            \
+                                                                                                                \
+        deque->size--;                                                                                          \
+        deque->last--;                                                                                          \
+        int index = deque->last;                                                                                \
+        if (index >= deque->capacity)                                                                           \
+        {                                                                                                       \
+            index -= deque->capacity;                                                                           \
+        }                                                                                                       \
+        deque->reset_iterator = true;                                                                           \
+        return deque->storage_array[index];                                                                     \
+    }                                                                                                           \
+                                                                                                                \
+    /* Remove n items from the front of the deque into out, front item first */                                 \
+    void deque_##prefix##_remove_first_n(prefix##_deque *deque, T *out, int n)                                  \
+    {                                                                                                           \
+        assert(deque);                                                                                          \
+        assert(n >= 0 && n <= deque->size);                                                                     \
+                                                                                                                \
+        int front = n < deque->capacity - deque->first ? n : deque->capacity - deque->first;                    \
+        memcpy(out, deque->storage_array + deque->first, front * sizeof(*out));                                 \
+        memcpy(out + front, deque->storage_array, (n - front) * sizeof(*out));                                  \
+        deque->first += n;                                                                                      \
+        if (deque->first >= deque->capacity)                                                                    \
+        {                                                                                                       \
+            deque->first -= deque->capacity;                                                                    \
+        }                                                                                                       \
+        deque->size -= n;                                                                                       \
+        deque->last = deque->first + deque->size;                                                               \
+        deque->reset_iterator = true;                                                                           \
+        deque_##prefix##_shrink_after_remove(deque);                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    /* Iterator */                                                                                              \
+    T deque_##prefix##_iterator_next(prefix##_deque *deque)                                                     \
+    {                                                                                                           \
+        assert(deque);                                                                                          \
+        assert(deque->size > 0);                                                                                \
+        if (deque->reset_iterator)                                                                              \
+        {                                                                                                       \
+            deque->next_item = deque->first;                                                                    \
+            if (deque->size == 1)                                                                               \
+            {                                                                                                   \
+                deque->has_next = false;                                                                        \
+            }                                                                                                   \
+            else                                                                                                \
+            {                                                                                                   \
+                deque->has_next = true;                                                                         \
+            }                                                                                                   \
+            deque->reset_iterator = false;                                                                      \
+        }                                                                                                       \
+                                                                                                                \
+        T item;                                                                                                 \
+        if (deque->next_item >= deque->capacity)                                                                \
+        {                                                                                                       \
+            item = deque->storage_array[deque->next_item - deque->capacity];                                    \
+        }                                                                                                       \
+        else                                                                                                    \
+        {                                                                                                       \
+            item = deque->storage_array[deque->next_item];                                                      \
+        }                                                                                                       \
+                                                                                                                \
+        deque->next_item++;                                                                                     \
+        if (deque->next_item >= deque->last)                                                                    \
+        {                                                                                                       \
+            deque->has_next = false;                                                                            \
+        }                                                                                                       \
+        return item;                                                                                            \
+    }                                                                                                           \
+                                                                                                                \
+    /* The items as at most two arrays: part 0 runs from the front item up to the end                           \
+     * of the storage array, part 1 holds the items that wrapped around to its start                            \
+     * (length 0 if none did). Valid until the deque changes */                                                 \
+    prefix##_deque_span deque_##prefix##_span(const prefix##_deque *deque, int part)                            \
+    {                                                                                                           \
+        assert(deque);                                                                                          \
+        assert(part == 0 || part == 1);                                                                         \
+        int front = deque->last < deque->capacity ? deque->size : deque->capacity - deque->first;               \
+        if (part == 0)                                                                                          \
+        {                                                                                                       \
+            return (prefix##_deque_span){deque->storage_array + deque->first, front};                           \
+        }                                                                                                       \
+        return (prefix##_deque_span){deque->storage_array, deque->size - front};                                \
+    }                                                                                                           \
+                                                                                                                \
+    /* Write the items front to back to fd as a snapshot (see snapshot.h). T must not                           \
+     * contain pointers. Returns false if writing failed */                                                     \
+    bool deque_##prefix##_save(const prefix##_deque *deque, int fd)                                             \
+    {                                                                                                           \
+        assert(deque);                                                                                          \
+        bool written = snapshot_write_header(fd, sizeof(T), deque->size);                                       \
+        for (int part = 0; part < 2 && written; part++)                                                         \
+        {                                                                                                       \
+            prefix##_deque_span span = deque_##prefix##_span(deque, part);                                      \
+            written = snapshot_write(fd, span.items, span.length * sizeof(T));                                  \
+        }                                                                                                       \
+        return written;                                                                                         \
+    }                                                                                                           \
+                                                                                                                \
+    /* Return deque holding the items of the snapshot at path, or NULL if it cannot be                          \
+     * read or does not hold items of type T. The items are read from the mapped file                           \
+     * until the deque first grows; it will not shrink below its loaded size until                              \
+     * deque_shrink_to_fit. Do not write through deque_span or DEQUE_FOREACH before that */                     \
+    prefix##_deque *deque_##prefix##_load_mmap(const char *path)                                                \
+    {                                                                                                           \
+        snapshot_mapping mapping;                                                                               \
+        const void *items;                                                                                      \
+        int count;                                                                                              \
+        if (!snapshot_map(path, sizeof(T), &mapping, &items, &count))                                           \
+        {                                                                                                       \
+            return NULL;                                                                                        \
+        }                                                                                                       \
+        prefix##_deque *deque = deque_##prefix##_create();                                                      \
+        if (count > 0)                                                                                          \
+        {                                                                                                       \
+            const allocator *allocator = deque->allocator;                                                      \
+            allocator->release(allocator->context, deque->storage_array, sizeof(T) * deque->capacity);          \
+            deque->storage_array = (T *)items;                                                                  \
+            deque->mapping = mapping;                                                                           \
+            deque->capacity = count;                                                                            \
+            deque->size = count;                                                                                \
+            deque->last = count;                                                                                \
+            if (count > deque->minimum_capacity)                                                                \
+            {                                                                                                   \
+                deque->minimum_capacity = count;                                                                \
+            }                                                                                                   \
+        }                                                                                                       \
+        return deque;                                                                                           \
     }
-#endif
\ No newline at end of file
+
+/* Loop over the items of a deque from front to back, with item a pointer into the
+ * storage array. Runs as two plain loops over the parts of deque_span, so the compiler
+ * can vectorise the body. 'break' only leaves the current part. The deque must not
+ * change inside the loop */
+#define DEQUE_FOREACH(prefix, item, deque)                                                                         \
+    for (int item##_part = 0; item##_part < 2; item##_part++)                                                      \
+        for (prefix##_deque_item *item = (deque)->storage_array + (item##_part == 0 ? (deque)->first : 0),         \
+               *item##_end = item##_part == 0                                                                      \
+                                 ? (deque)->storage_array + ((deque)->last < (deque)->capacity ? (deque)->last     \
+                                                                                              : (deque)->capacity) \
+                                 : (deque)->storage_array + ((deque)->last > (deque)->capacity                     \
+                                                                 ? (deque)->last - (deque)->capacity               \
+                                                                 : 0);                                             \
+             item < item##_end; item++)
+
+#endif
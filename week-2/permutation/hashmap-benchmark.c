@@ -0,0 +1,156 @@
+/* Counts the words of a text file (by default 'shakespeare.txt') with the hash
+ * map from hashmap.h and prints the most frequent ones. Words are read the same
+ * way as in permutation.c and lowercased. The count is done twice: once hashing
+ * every word inside hashmap_upsert_string, and once hashing it while it is read
+ * and passing the hash to hashmap_upsert_string_hashed.
+ * Usage: ./hashmap-benchmark [filename] [number of words to print]
+ */
+
+#include <assert.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hashmap.h"
+
+DEFINE_STRING_HASHMAP_TYPE(int, count);
+
+// Words longer than this are skipped, as in permutation.c
+#define MAX_WORD_LENGTH 40
+
+double seconds_since(struct timespec start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+// Count every word in text into map, returns the number of words
+long count_words(const char *text, long length, count_hashmap *map, arena *key_arena, bool precomputed)
+{
+    char word[MAX_WORD_LENGTH + 1];
+    int index = 0;
+    long words = 0;
+    uint64_t hash = HASHMAP_STRING_SEED;
+
+    // One position past the end, so the last word is ended like all others
+    for (long i = 0; i <= length; i++)
+    {
+        char c = i < length ? text[i] : ' ';
+        if (isalpha(c) || ((c == '\'' || c == '-') && index > 0))
+        {
+            if (index == MAX_WORD_LENGTH)
+            {
+                // Too long, skip the rest of the word
+                while (i + 1 < length && isalpha(text[i + 1]))
+                {
+                    i++;
+                }
+                index = 0;
+                hash = HASHMAP_STRING_SEED;
+                continue;
+            }
+            c = tolower(c);
+            word[index++] = c;
+            hash = hashmap_string_step(hash, c);
+        }
+        else if (index > 0)
+        {
+            word[index] = '\0';
+            words++;
+            if (precomputed)
+            {
+                hashmap_count_upsert_string_hashed(map, key_arena, word, index, hashmap_string_finish(hash), 0, NULL)
+                    ->value++;
+            }
+            else
+            {
+                hashmap_count_upsert_string(map, key_arena, word, 0, NULL)->value++;
+            }
+            index = 0;
+            hash = HASHMAP_STRING_SEED;
+        }
+    }
+    return words;
+}
+
+int compare_by_count(const void *a, const void *b)
+{
+    const count_hashmap_entry *x = a;
+    const count_hashmap_entry *y = b;
+    if (x->value != y->value)
+    {
+        return y->value - x->value;
+    }
+    return strcmp(x->key, y->key);
+}
+
+int main(int argc, char *argv[])
+{
+    char *filename = argc > 1 ? argv[1] : "shakespeare.txt";
+    int top = argc > 2 ? atoi(argv[2]) : 20;
+
+    FILE *infile_ptr = fopen(filename, "rb");
+    if (infile_ptr == NULL)
+    {
+        printf("Cannot open '%s'\nUsage: ./hashmap-benchmark [filename] [number of words to print]\n", filename);
+        return 1;
+    }
+    fseek(infile_ptr, 0, SEEK_END);
+    long length = ftell(infile_ptr);
+    fseek(infile_ptr, 0, SEEK_SET);
+    char *text = malloc(length + 1);
+    assert(text);
+    assert(fread(text, 1, length, infile_ptr) == (size_t)length);
+    fclose(infile_ptr);
+
+    struct timespec start;
+    count_hashmap *maps[2];
+    arena key_arenas[2];
+    double seconds[2];
+    long words = 0;
+    for (int run = 0; run < 2; run++)
+    {
+        arena_init(&key_arenas[run], 64 * 1024);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        maps[run] = hashmap_count_create();
+        words = count_words(text, length, maps[run], &key_arenas[run], run == 1);
+        seconds[run] = seconds_since(start);
+    }
+
+    // Both runs have to agree on every count
+    assert(maps[0]->size == maps[1]->size);
+    HASHMAP_FOREACH(count, entry, maps[0])
+    {
+        int *other = hashmap_count_find(maps[1], entry->key);
+        assert(other && *other == entry->value);
+    }
+
+    printf("%li words, %i distinct, table capacity %i\n", words, maps[0]->size, maps[0]->capacity);
+    printf("upsert_string:        %6.2f ns/word\n", seconds[0] * 1e9 / words);
+    printf("upsert_string_hashed: %6.2f ns/word\n\n", seconds[1] * 1e9 / words);
+
+    count_hashmap_entry *entries = malloc(maps[0]->size * sizeof(*entries) + 1);
+    assert(entries);
+    int n = 0;
+    HASHMAP_FOREACH(count, entry, maps[0])
+    {
+        entries[n++] = *entry;
+    }
+    qsort(entries, n, sizeof(*entries), compare_by_count);
+    for (int i = 0; i < top && i < n; i++)
+    {
+        printf("%8i %s\n", entries[i].value, entries[i].key);
+    }
+
+    free(entries);
+    for (int run = 0; run < 2; run++)
+    {
+        hashmap_count_free(maps[run]);
+        arena_free(&key_arenas[run]);
+    }
+    free(text);
+    return 0;
+}
@@ -4,6 +4,8 @@
  * of a reservoir sampling algorithm (see below).
  * Provided is 'shakespeare.txt', containing the complete works of
  * Shakespeare to sample from.
+ * Sampled words are copied into a string arena, which reuses the slot of
+ * every evicted word, so sampling does no heap allocation per word.
  */
 
 #include <assert.h>
@@ -16,8 +18,9 @@
 #include <time.h>
 
 #include "deque.h"
+#include "string-arena.h"
 
-DEFINE_DEQUE_TYPE(char *, string);
+DEFINE_DEQUE_TYPE(string_slice, string);
 
 int main(int argc, char *argv[])
 {
@@ -65,6 +68,10 @@ int main(int argc, char *argv[])
     int max_length = 40;
     char word[max_length + 1];
 
+    // Storage for the sampled words
+    string_arena words_arena;
+    string_arena_init(&words_arena, max_length);
+
     // Iteration
     int index = 0, words = 0;
 
@@ -105,19 +112,16 @@ int main(int argc, char *argv[])
                 if (replace <= k)
                 {
                     choice = rand() % 100 + 1;
-                    char *removed_word;
+                    string_slice removed_word;
                     if (choice <= 50)
                     {
                         removed_word = deque_string_remove_first(deque);
-                        free(removed_word);
-                        removed_word = NULL;
                     }
                     else
                     {
                         removed_word = deque_string_remove_last(deque);
-                        free(removed_word);
-                        removed_word = NULL;
                     }
+                    string_arena_release(&words_arena, removed_word);
                 }
                 else
                 {
@@ -126,8 +130,7 @@ int main(int argc, char *argv[])
                 }
             }
 
-            char *selected_word = malloc(index + 1);
-            strcpy(selected_word, word);
+            string_slice selected_word = string_arena_copy(&words_arena, word, index);
 
 
             choice = rand() % 4 + 1;
@@ -143,7 +146,7 @@ int main(int argc, char *argv[])
             {
                 if (deque->size > 0)
                 {
-                    char *swap = deque_string_remove_first(deque);
+                    string_slice swap = deque_string_remove_first(deque);
                     deque_string_add_first(deque, selected_word);
                     deque_string_add_first(deque, swap);
                 }
@@ -157,7 +160,7 @@ int main(int argc, char *argv[])
             {
                 if (deque->size > 0)
                 {
-                    char *swap = deque_string_remove_last(deque);
+                    string_slice swap = deque_string_remove_last(deque);
                     deque_string_add_last(deque, selected_word);
                     deque_string_add_last(deque, swap);
                 }
@@ -189,20 +192,13 @@ int main(int argc, char *argv[])
     printf("\n");
 
     printf("Sampled %i out of a total of %i words:\n\n", k, words);
-    for (int i = 0; i < k; i++)
+    DEQUE_FOREACH(string, sampled, deque)
     {
-        printf("- %s\n", deque_string_iterator_next(deque));
+        printf("- %.*s\n", sampled->length, sampled->chars);
     }
     printf("\n");
 
-    char *removed;
-    for (int i = 0; i < k; i++)
-    {
-        removed = deque_string_remove_last(deque);
-        free(removed);
-        removed = NULL;
-    }
-
+    string_arena_free(&words_arena);
 
     deque_string_free(deque);
     fclose(infile_ptr);
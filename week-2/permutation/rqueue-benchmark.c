@@ -0,0 +1,100 @@
+/* Compares the cost per item of dequeuing or sampling a randomized queue
+ * in batches of k against k calls to rqueue_dequeue.
+ * Usage: ./rqueue-benchmark [n] [k]
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "rqueue.h"
+
+DEFINE_RQUEUE_TYPE(int, number);
+
+double seconds_since(struct timespec start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+number_rqueue *filled_queue(int n)
+{
+    number_rqueue *rqueue = rqueue_number_create();
+    rqueue_number_reserve(rqueue, n);
+    for (int i = 0; i < n; i++)
+    {
+        rqueue_number_enqueue(rqueue, i);
+    }
+    rqueue_number_shrink_to_fit(rqueue);
+    return rqueue;
+}
+
+int main(int argc, char *argv[])
+{
+    int n = 10000000;
+    int k = 1000;
+    if (argc > 1)
+    {
+        n = atoi(argv[1]);
+    }
+    if (argc > 2)
+    {
+        k = atoi(argv[2]);
+    }
+    if (n < 1 || k < 1 || k > n)
+    {
+        printf("Usage: ./rqueue-benchmark [n] [k], with 1 <= k <= n\n");
+        return 1;
+    }
+
+    int *out = malloc(k * sizeof(*out));
+    assert(out);
+    struct timespec start;
+    long checksum = 0;
+
+    // Drain the whole queue with single dequeues
+    number_rqueue *rqueue = filled_queue(n);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (!rqueue_number_is_empty(rqueue))
+    {
+        checksum += rqueue_number_dequeue(rqueue);
+    }
+    double single = seconds_since(start);
+    rqueue_number_free(rqueue);
+
+    // Drain the whole queue k items at a time
+    rqueue = filled_queue(n);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (!rqueue_number_is_empty(rqueue))
+    {
+        int batch = rqueue->size < k ? rqueue->size : k;
+        rqueue_number_dequeue_k(rqueue, batch, out);
+        for (int i = 0; i < batch; i++)
+        {
+            checksum -= out[i];
+        }
+    }
+    double batched = seconds_since(start);
+
+    // Take n items in samples of k, without removing anything
+    rqueue_number_free(rqueue);
+    rqueue = filled_queue(n);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int taken = 0; taken < n; taken += k)
+    {
+        rqueue_number_sample_k(rqueue, k, out);
+    }
+    double sampled = seconds_since(start);
+    rqueue_number_free(rqueue);
+
+    assert(checksum == 0);
+    printf("n = %i, k = %i\n", n, k);
+    printf("dequeue:   %6.2f ns/item\n", single * 1e9 / n);
+    printf("dequeue_k: %6.2f ns/item\n", batched * 1e9 / n);
+    printf("sample_k:  %6.2f ns/item\n", sampled * 1e9 / n);
+
+    free(out);
+    return 0;
+}
@@ -24,9 +24,11 @@ int main(void)
     }
 
     printf("Randomized queue contents:\n");
-    for (int i = 0; i < rqueue->size; i++)
+    string_rqueue_iterator iterator;
+    rqueue_string_random_iterator_init(&iterator, rqueue);
+    while (rqueue_string_random_iterator_has_next(&iterator))
     {
-        printf("- %s\n", rqueue_string_iterator_next(rqueue));
+        printf("- %s\n", rqueue_string_random_iterator_next(&iterator));
     }
 
     printf("\nDequeued random items:\n");
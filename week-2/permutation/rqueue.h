@@ -6,117 +6,456 @@
 #define RQUEUE_H
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
 #include <time.h>
 
+#include "allocator.h"
+#include "snapshot.h"
+
+/* Shared with stack.h and deque.h. By default a container halves its capacity
+ * once it is at most a quarter full (DEFAULT_SHRINK_FACTOR) */
+#ifndef CONTAINER_DEFAULTS
+#define CONTAINER_DEFAULTS
 static const int MINIMUM_CAPACITY = 8;
+static const int DEFAULT_SHRINK_FACTOR = 4;
+#endif
+
+/* Random iterators visit the queue in the order of a pseudorandom permutation
+ * of 0..size-1, without copying the queue or storing the permutation.
+ * The permutation is a 4-round Feistel network on the smallest 2^(2 * half_bits)
+ * range that holds size, with random round keys per iterator. Counting through
+ * that range and skipping results of size or more gives every position exactly
+ * once, after at most 4 * size steps. */
+#define RQUEUE_FEISTEL_ROUNDS 4
+
+/* Feistel round function (splitmix64 finaliser) */
+static inline uint64_t rqueue_mix(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/* Next output of the queue's splitmix64 generator */
+static inline uint64_t rqueue_random(uint64_t *state)
+{
+    *state += 0x9e3779b97f4a7c15ULL;
+    return rqueue_mix(*state);
+}
 
-#define DEFINE_RQUEUE_TYPE(T, prefix)                                                                                                \
-    typedef struct prefix##_rqueue                                                                                                   \
-    {                                                                                                                                \
-        int capacity;                                                                                                                \
-        int size;                                                                                                                    \
-        T *storage_array;                                                                                                            \
-        bool reset_iterator;                                                                                                         \
-        int next_item;                                                                                                               \
-        bool has_next;                                                                                                               \
-    } prefix##_rqueue;                                                                                                               \
-                                                                                                                                     \
-    prefix##_rqueue *rqueue_##prefix##_create(void)                                                                                  \
-    {                                                                                                                                \
-        prefix##_rqueue *randomized_queue = malloc(sizeof(*randomized_queue));                                                       \
-        assert(randomized_queue);                                                                                                    \
-        randomized_queue->capacity = MINIMUM_CAPACITY;                                                                               \
-        randomized_queue->size = 0;                                                                                                  \
-        randomized_queue->storage_array = malloc(randomized_queue->capacity * sizeof(*randomized_queue->storage_array));             \
-        assert(randomized_queue->storage_array);                                                                                     \
-        randomized_queue->reset_iterator = true;                                                                                     \
-        randomized_queue->next_item = 0;                                                                                             \
-        randomized_queue->has_next = false;                                                                                          \
-                                                                                                                                     \
-        /* Seed RNG using nanosecond CPU time */                                                                                     \
-        struct timeval timer;                                                                                                        \
-        gettimeofday(&timer, NULL);                                                                                                  \
-        srand((timer.tv_sec * 1000) + (timer.tv_usec / 1000));                                                                       \
-                                                                                                                                     \
-        return randomized_queue;                                                                                                     \
-    }                                                                                                                                \
-                                                                                                                                     \
-    void rqueue_##prefix##_free(prefix##_rqueue *randomized_queue)                                                                   \
-    {                                                                                                                                \
-        assert(randomized_queue);                                                                                                    \
-        free(randomized_queue->storage_array);                                                                                       \
-        randomized_queue->storage_array = NULL;                                                                                      \
-        free(randomized_queue);                                                                                                      \
-        randomized_queue = NULL;                                                                                                     \
-    }                                                                                                                                \
-                                                                                                                                     \
-    bool rqueue_##prefix##_is_empty(prefix##_rqueue *randomized_queue)                                                               \
-    {                                                                                                                                \
-        assert(randomized_queue);                                                                                                    \
-        return randomized_queue->size == 0;                                                                                          \
-    }                                                                                                                                \
-                                                                                                                                     \
-    void rqueue_##prefix##_enqueue(prefix##_rqueue *randomized_queue, T item)                                                        \
-    {                                                                                                                                \
-        assert(randomized_queue);                                                                                                    \
-        if (randomized_queue->size == randomized_queue->capacity)                                                                    \
-        {                                                                                                                            \
-            randomized_queue->capacity *= 2;                                                                                         \
-            T *tmp = realloc(randomized_queue->storage_array, randomized_queue->capacity * sizeof(randomized_queue->storage_array)); \
-            assert(tmp);                                                                                                             \
-            randomized_queue->storage_array = tmp;                                                                                   \
-        }                                                                                                                            \
-        randomized_queue->storage_array[randomized_queue->size] = item;                                                              \
-        randomized_queue->size++;                                                                                                    \
-        randomized_queue->reset_iterator = true;                                                                                     \
-    }                                                                                                                                \
-                                                                                                                                     \
-    T rqueue_##prefix##_dequeue(prefix##_rqueue *randomized_queue)                                                                   \
-    {                                                                                                                                \
-        assert(randomized_queue);                                                                                                    \
-        assert(randomized_queue->size > 0);                                                                                          \
-        if (randomized_queue->size <= (randomized_queue->capacity / 4) && randomized_queue->size > MINIMUM_CAPACITY)                 \
-        {                                                                                                                            \
-            randomized_queue->capacity /= 2;                                                                                         \
-            T *tmp = realloc(randomized_queue->storage_array, randomized_queue->capacity * sizeof(randomized_queue->storage_array)); \
-            assert(tmp);                                                                                                             \
-            randomized_queue->storage_array = tmp;                                                                                   \
-        }                                                                                                                            \
-        int chosen_index = rand() % randomized_queue->size;                                                                          \
-        T item = randomized_queue->storage_array[chosen_index];                                                                      \
-        randomized_queue->size--;                                                                                                    \
-        randomized_queue->storage_array[chosen_index] = randomized_queue->storage_array[randomized_queue->size];                     \
-        return item;                                                                                                                 \
-    }                                                                                                                                \
-                                                                                                                                     \
-    T rqueue_##prefix##_iterator_next(prefix##_rqueue *randomized_queue)                                                             \
-    {                                                                                                                                \
-        assert(randomized_queue);                                                                                                    \
-        assert(randomized_queue->size > 0);                                                                                          \
-        if (randomized_queue->reset_iterator)                                                                                        \
-        {                                                                                                                            \
-            randomized_queue->next_item = 0;                                                                                         \
-            if (randomized_queue->size == 1)                                                                                         \
-            {                                                                                                                        \
-                randomized_queue->has_next = false;                                                                                  \
-            }                                                                                                                        \
-            else                                                                                                                     \
-            {                                                                                                                        \
-                randomized_queue->has_next = true;                                                                                   \
-            }                                                                                                                        \
-            randomized_queue->reset_iterator = false;                                                                                \
-        }                                                                                                                            \
-                                                                                                                                     \
-        T item = randomized_queue->storage_array[randomized_queue->next_item];                                                       \
-        randomized_queue->next_item++;                                                                                               \
-        if (randomized_queue->next_item >= randomized_queue->size - 1)                                                               \
-        {                                                                                                                            \
-            randomized_queue->has_next = false;                                                                                      \
-        }                                                                                                                            \
-        return item;                                                                                                                 \
+/* Uniform random number in 0..range-1 without division in the common case
+ * (Lemire, "Fast Random Integer Generation in an Interval", 2019) */
+static inline uint32_t rqueue_random_below(uint64_t *state, uint32_t range)
+{
+    uint64_t product = (rqueue_random(state) >> 32) * range;
+    uint32_t low = (uint32_t)product;
+    if (low < range)
+    {
+        uint32_t threshold = -range % range;
+        while (low < threshold)
+        {
+            product = (rqueue_random(state) >> 32) * range;
+            low = (uint32_t)product;
+        }
     }
+    return product >> 32;
+}
+
+#define DEFINE_RQUEUE_TYPE(T, prefix)                                                                            \
+    typedef struct prefix##_rqueue                                                                               \
+    {                                                                                                            \
+        int capacity;                                                                                            \
+        int size;                                                                                                \
+        T *storage_array;                                                                                        \
+        const allocator *allocator;                                                                              \
+        int minimum_capacity;                                                                                    \
+        int shrink_factor;                                                                                       \
+        long allocations;                                                                                        \
+        snapshot_mapping mapping;                                                                                \
+        uint64_t random_state;                                                                                   \
+        bool reset_iterator;                                                                                     \
+        int next_item;                                                                                           \
+        bool has_next;                                                                                           \
+    } prefix##_rqueue;                                                                                           \
+                                                                                                                 \
+    /* Item type, for RQUEUE_FOREACH */                                                                          \
+    typedef T prefix##_rqueue_item;                                                                              \
+                                                                                                                 \
+    /* Contiguous run of items, see rqueue_span */                                                               \
+    typedef struct prefix##_rqueue_span                                                                          \
+    {                                                                                                            \
+        T *items;                                                                                                \
+        int length;                                                                                              \
+    } prefix##_rqueue_span;                                                                                      \
+                                                                                                                 \
+    /* Independent random iterator, see rqueue_random_iterator_init */                                           \
+    typedef struct prefix##_rqueue_iterator                                                                      \
+    {                                                                                                            \
+        const prefix##_rqueue *randomized_queue;                                                                 \
+        int size;                                                                                                \
+        int returned;                                                                                            \
+        uint64_t counter;                                                                                        \
+        int half_bits;                                                                                           \
+        uint64_t keys[RQUEUE_FEISTEL_ROUNDS];                                                                    \
+    } prefix##_rqueue_iterator;                                                                                  \
+                                                                                                                 \
+    /* Create randomized queue whose memory comes from the given allocator */                                    \
+    prefix##_rqueue *rqueue_##prefix##_create_with(const allocator *allocator)                                   \
+    {                                                                                                            \
+        prefix##_rqueue *randomized_queue = allocator->allocate(allocator->context, sizeof(*randomized_queue));  \
+        assert(randomized_queue);                                                                                \
+        randomized_queue->capacity = MINIMUM_CAPACITY;                                                           \
+        randomized_queue->size = 0;                                                                              \
+        randomized_queue->allocator = allocator;                                                                 \
+        randomized_queue->storage_array = allocator->allocate(allocator->context, MINIMUM_CAPACITY * sizeof(T)); \
+        assert(randomized_queue->storage_array);                                                                 \
+        randomized_queue->minimum_capacity = MINIMUM_CAPACITY;                                                   \
+        randomized_queue->shrink_factor = DEFAULT_SHRINK_FACTOR;                                                 \
+        randomized_queue->allocations = 1;                                                                       \
+        randomized_queue->mapping = (snapshot_mapping){NULL, 0};                                                 \
+        randomized_queue->reset_iterator = true;                                                                 \
+        randomized_queue->next_item = 0;                                                                         \
+        randomized_queue->has_next = false;                                                                      \
+                                                                                                                 \
+        /* Seed RNG using nanosecond CPU time */                                                                 \
+        struct timeval timer;                                                                                    \
+        gettimeofday(&timer, NULL);                                                                              \
+        srand((timer.tv_sec * 1000) + (timer.tv_usec / 1000));                                                   \
+        randomized_queue->random_state = ((uint64_t)rand() << 32) ^ (uint64_t)rand();                            \
+                                                                                                                 \
+        return randomized_queue;                                                                                 \
+    }                                                                                                            \
+                                                                                                                 \
+    prefix##_rqueue *rqueue_##prefix##_create(void)                                                              \
+    {                                                                                                            \
+        return rqueue_##prefix##_create_with(&HEAP_ALLOCATOR);                                                   \
+    }                                                                                                            \
+                                                                                                                 \
+    void rqueue_##prefix##_free(prefix##_rqueue *randomized_queue)                                               \
+    {                                                                                                            \
+        assert(randomized_queue);                                                                                \
+        const allocator *allocator = randomized_queue->allocator;                                                \
+        if (randomized_queue->mapping.address)                                                                   \
+        {                                                                                                        \
+            snapshot_unmap(&randomized_queue->mapping);                                                          \
+        }                                                                                                        \
+        else                                                                                                     \
+        {                                                                                                        \
+            allocator->release(allocator->context, randomized_queue->storage_array,                              \
+                               randomized_queue->capacity * sizeof(T));                                          \
+        }                                                                                                        \
+        randomized_queue->storage_array = NULL;                                                                  \
+        allocator->release(allocator->context, randomized_queue, sizeof(*randomized_queue));                     \
+        randomized_queue = NULL;                                                                                 \
+    }                                                                                                            \
+                                                                                                                 \
+    /* Move the items into a storage array of the given capacity (at least size) */                              \
+    void rqueue_##prefix##_reallocate(prefix##_rqueue *randomized_queue, int capacity)                           \
+    {                                                                                                            \
+        assert(capacity >= randomized_queue->size);                                                              \
+        const allocator *allocator = randomized_queue->allocator;                                                \
+        T *tmp;                                                                                                  \
+        if (randomized_queue->mapping.address)                                                                   \
+        {                                                                                                        \
+            /* Loaded snapshot: copy the items out of the read-only mapping */                                   \
+            tmp = allocator->allocate(allocator->context, capacity * sizeof(T));                                 \
+            assert(tmp);                                                                                         \
+            memcpy(tmp, randomized_queue->storage_array, randomized_queue->size * sizeof(T));                    \
+            snapshot_unmap(&randomized_queue->mapping);                                                          \
+        }                                                                                                        \
+        else                                                                                                     \
+        {                                                                                                        \
+            tmp = allocator->reallocate(allocator->context, randomized_queue->storage_array,                     \
+                                        randomized_queue->capacity * sizeof(T), capacity * sizeof(T));           \
+            assert(tmp);                                                                                         \
+        }                                                                                                        \
+        randomized_queue->storage_array = tmp;                                                                   \
+        randomized_queue->capacity = capacity;                                                                   \
+        randomized_queue->allocations++;                                                                         \
+    }                                                                                                            \
+                                                                                                                 \
+    /* Copy the items of a loaded snapshot into storage that can be written,                                     \
+     * with room for one more item */                                                                            \
+    void rqueue_##prefix##_make_writable(prefix##_rqueue *randomized_queue)                                      \
+    {                                                                                                            \
+        if (randomized_queue->mapping.address)                                                                   \
+        {                                                                                                        \
+            rqueue_##prefix##_reallocate(randomized_queue, randomized_queue->size == randomized_queue->capacity  \
+                                                               ? randomized_queue->capacity * 2                  \
+                                                               : randomized_queue->capacity);                    \
+        }                                                                                                        \
+    }                                                                                                            \
+                                                                                                                 \
+    /* Make room for at least n items. Automatic shrinking will not go below                                     \
+     * this capacity until rqueue_shrink_to_fit is called */                                                     \
+    void rqueue_##prefix##_reserve(prefix##_rqueue *randomized_queue, int n)                                     \
+    {                                                                                                            \
+        assert(randomized_queue);                                                                                \
+        assert(n >= 0);                                                                                          \
+        if (n > randomized_queue->minimum_capacity)                                                              \
+        {                                                                                                        \
+            randomized_queue->minimum_capacity = n;                                                              \
+        }                                                                                                        \
+        if (n > randomized_queue->capacity)                                                                      \
+        {                                                                                                        \
+            rqueue_##prefix##_reallocate(randomized_queue, n);                                                   \
+        }                                                                                                        \
+    }                                                                                                            \
+                                                                                                                 \
+    /* Reduce capacity to the current size (or MINIMUM_CAPACITY) and drop any reservation */                     \
+    void rqueue_##prefix##_shrink_to_fit(prefix##_rqueue *randomized_queue)                                      \
+    {                                                                                                            \
+        assert(randomized_queue);                                                                                \
+        randomized_queue->minimum_capacity = MINIMUM_CAPACITY;                                                   \
+        int capacity = randomized_queue->size > MINIMUM_CAPACITY ? randomized_queue->size : MINIMUM_CAPACITY;    \
+        if (capacity != randomized_queue->capacity)                                                              \
+        {                                                                                                        \
+            rqueue_##prefix##_reallocate(randomized_queue, capacity);                                            \
+        }                                                                                                        \
+    }                                                                                                            \
+                                                                                                                 \
+    /* Shrink when at most 1 / factor of the capacity is in use (factor > 2),                                    \
+     * or never if factor is 0 */                                                                                \
+    void rqueue_##prefix##_set_shrink_factor(prefix##_rqueue *randomized_queue, int factor)                      \
+    {                                                                                                            \
+        assert(randomized_queue);                                                                                \
+        assert(factor == 0 || factor > 2);                                                                       \
+        randomized_queue->shrink_factor = factor;                                                                \
+    }                                                                                                            \
+                                                                                                                 \
+    /* Halve capacity while the queue is sparse enough according to its shrink factor,                           \
+     * with at most one reallocation */                                                                          \
+    void rqueue_##prefix##_shrink_after_remove(prefix##_rqueue *randomized_queue)                                \
+    {                                                                                                            \
+        if (randomized_queue->shrink_factor == 0)                                                                \
+        {                                                                                                        \
+            return;                                                                                              \
+        }                                                                                                        \
+        int capacity = randomized_queue->capacity;                                                               \
+        while (randomized_queue->size <= (capacity / randomized_queue->shrink_factor) &&                         \
+               capacity / 2 >= randomized_queue->minimum_capacity)                                               \
+        {                                                                                                        \
+            capacity /= 2;                                                                                       \
+        }                                                                                                        \
+        if (capacity != randomized_queue->capacity)                                                              \
+        {                                                                                                        \
+            rqueue_##prefix##_reallocate(randomized_queue, capacity);                                            \
+        }                                                                                                        \
+    }                                                                                                            \
+                                                                                                                 \
+    bool rqueue_##prefix##_is_empty(prefix##_rqueue *randomized_queue)                                           \
+    {                                                                                                            \
+        assert(randomized_queue);                                                                                \
+        return randomized_queue->size == 0;                                                                      \
+    }                                                                                                            \
+                                                                                                                 \
+    void rqueue_##prefix##_enqueue(prefix##_rqueue *randomized_queue, T item)                                    \
+    {                                                                                                            \
+        assert(randomized_queue);                                                                                \
+        rqueue_##prefix##_make_writable(randomized_queue);                                                       \
+        if (randomized_queue->size == randomized_queue->capacity)                                                \
+        {                                                                                                        \
+            rqueue_##prefix##_reallocate(randomized_queue, randomized_queue->capacity * 2);                      \
+        }                                                                                                        \
+        randomized_queue->storage_array[randomized_queue->size] = item;                                          \
+        randomized_queue->size++;                                                                                \
+        randomized_queue->reset_iterator = true;                                                                 \
+    }                                                                                                            \
+                                                                                                                 \
+    T rqueue_##prefix##_dequeue(prefix##_rqueue *randomized_queue)                                               \
+    {                                                                                                            \
+        assert(randomized_queue);                                                                                \
+        assert(randomized_queue->size > 0);                                                                      \
+        rqueue_##prefix##_shrink_after_remove(randomized_queue);                                                 \
+        rqueue_##prefix##_make_writable(randomized_queue);                                                       \
+        int chosen_index = rand() % randomized_queue->size;                                                      \
+        T item = randomized_queue->storage_array[chosen_index];                                                  \
+        randomized_queue->size--;                                                                                \
+        randomized_queue->storage_array[chosen_index] = randomized_queue->storage_array[randomized_queue->size]; \
+        return item;                                                                                             \
+    }                                                                                                            \
+                                                                                                                 \
+    /* Dequeue k random items into out: a partial Fisher-Yates shuffle that moves                                \
+     * the last item into each chosen slot, shrinking at most once afterwards */                                 \
+    void rqueue_##prefix##_dequeue_k(prefix##_rqueue *randomized_queue, int k, T *out)                           \
+    {                                                                                                            \
+        assert(randomized_queue);                                                                                \
+        assert(k >= 0 && k <= randomized_queue->size);                                                           \
+        rqueue_##prefix##_make_writable(randomized_queue);                                                       \
+        T *items = randomized_queue->storage_array;                                                              \
+        int size = randomized_queue->size;                                                                       \
+        for (int i = 0; i < k; i++)                                                                              \
+        {                                                                                                        \
+            uint32_t chosen_index = rqueue_random_below(&randomized_queue->random_state, size);                  \
+            out[i] = items[chosen_index];                                                                        \
+            size--;                                                                                              \
+            items[chosen_index] = items[size];                                                                   \
+        }                                                                                                        \
+        randomized_queue->size = size;                                                                           \
+        randomized_queue->reset_iterator = true;                                                                 \
+        rqueue_##prefix##_shrink_after_remove(randomized_queue);                                                 \
+    }                                                                                                            \
+                                                                                                                 \
+    /* Copy k distinct random items into out without removing them. The chosen                                   \
+     * items are swapped to the back of the array, so the queue keeps its contents */                            \
+    void rqueue_##prefix##_sample_k(prefix##_rqueue *randomized_queue, int k, T *out)                            \
+    {                                                                                                            \
+        assert(randomized_queue);                                                                                \
+        assert(k >= 0 && k <= randomized_queue->size);                                                           \
+        rqueue_##prefix##_make_writable(randomized_queue);                                                       \
+        T *items = randomized_queue->storage_array;                                                              \
+        int remaining = randomized_queue->size;                                                                  \
+        for (int i = 0; i < k; i++)                                                                              \
+        {                                                                                                        \
+            uint32_t chosen_index = rqueue_random_below(&randomized_queue->random_state, remaining);             \
+            remaining--;                                                                                         \
+            T item = items[chosen_index];                                                                        \
+            items[chosen_index] = items[remaining];                                                              \
+            items[remaining] = item;                                                                             \
+            out[i] = item;                                                                                       \
+        }                                                                                                        \
+        randomized_queue->reset_iterator = true;                                                                 \
+    }                                                                                                            \
+                                                                                                                 \
+    T rqueue_##prefix##_iterator_next(prefix##_rqueue *randomized_queue)                                         \
+    {                                                                                                            \
+        assert(randomized_queue);                                                                                \
+        assert(randomized_queue->size > 0);                                                                      \
+        if (randomized_queue->reset_iterator)                                                                    \
+        {                                                                                                        \
+            randomized_queue->next_item = 0;                                                                     \
+            if (randomized_queue->size == 1)                                                                     \
+            {                                                                                                    \
+                randomized_queue->has_next = false;                                                              \
+            }                                                                                                    \
+            else                                                                                                 \
+            {                                                                                                    \
+                randomized_queue->has_next = true;                                                               \
+            }                                                                                                    \
+            randomized_queue->reset_iterator = false;                                                            \
+        }                                                                                                        \
+                                                                                                                 \
+        T item = randomized_queue->storage_array[randomized_queue->next_item];                                   \
+        randomized_queue->next_item++;                                                                           \
+        if (randomized_queue->next_item >= randomized_queue->size - 1)                                           \
+        {                                                                                                        \
+            randomized_queue->has_next = false;                                                                  \
+        }                                                                                                        \
+        return item;                                                                                             \
+    }                                                                                                            \
+                                                                                                                 \
+    /* Start a random iterator over the queue. Any number of iterators can run at                                \
+     * the same time, each in its own order. The queue must not change while an                                  \
+     * iterator is in use */                                                                                     \
+    void rqueue_##prefix##_random_iterator_init(prefix##_rqueue_iterator *iterator,                              \
+                                                const prefix##_rqueue *randomized_queue)                         \
+    {                                                                                                            \
+        assert(iterator);                                                                                        \
+        assert(randomized_queue);                                                                                \
+        iterator->randomized_queue = randomized_queue;                                                           \
+        iterator->size = randomized_queue->size;                                                                 \
+        iterator->returned = 0;                                                                                  \
+        iterator->counter = 0;                                                                                   \
+        iterator->half_bits = 1;                                                                                 \
+        while ((1ULL << (2 * iterator->half_bits)) < (uint64_t)randomized_queue->size)                           \
+        {                                                                                                        \
+            iterator->half_bits++;                                                                               \
+        }                                                                                                        \
+        for (int i = 0; i < RQUEUE_FEISTEL_ROUNDS; i++)                                                          \
+        {                                                                                                        \
+            iterator->keys[i] = rqueue_mix(((uint64_t)rand() << 32) ^ (uint64_t)rand() ^ ((uint64_t)i << 62));   \
+        }                                                                                                        \
+    }                                                                                                            \
+                                                                                                                 \
+    bool rqueue_##prefix##_random_iterator_has_next(const prefix##_rqueue_iterator *iterator)                    \
+    {                                                                                                            \
+        assert(iterator);                                                                                        \
+        return iterator->returned < iterator->size;                                                              \
+    }                                                                                                            \
+                                                                                                                 \
+    /* Return the next item in the iterator's random order */                                                    \
+    T rqueue_##prefix##_random_iterator_next(prefix##_rqueue_iterator *iterator)                                 \
+    {                                                                                                            \
+        assert(iterator);                                                                                        \
+        assert(iterator->returned < iterator->size);                                                             \
+        assert(iterator->randomized_queue->size == iterator->size);                                              \
+        uint64_t mask = (1ULL << iterator->half_bits) - 1;                                                       \
+        uint64_t index;                                                                                          \
+        do                                                                                                       \
+        {                                                                                                        \
+            uint64_t left = iterator->counter >> iterator->half_bits;                                            \
+            uint64_t right = iterator->counter & mask;                                                           \
+            for (int i = 0; i < RQUEUE_FEISTEL_ROUNDS; i++)                                                      \
+            {                                                                                                    \
+                uint64_t next = left ^ (rqueue_mix(right ^ iterator->keys[i]) & mask);                           \
+                left = right;                                                                                    \
+                right = next;                                                                                    \
+            }                                                                                                    \
+            index = (left << iterator->half_bits) | right;                                                       \
+            iterator->counter++;                                                                                 \
+        } while (index >= (uint64_t)iterator->size);                                                             \
+                                                                                                                 \
+        iterator->returned++;                                                                                    \
+        return iterator->randomized_queue->storage_array[index];                                                 \
+    }                                                                                                            \
+                                                                                                                 \
+    /* All items as one array, in storage order (not random). Valid until the queue changes */                   \
+    prefix##_rqueue_span rqueue_##prefix##_span(const prefix##_rqueue *randomized_queue)                         \
+    {                                                                                                            \
+        assert(randomized_queue);                                                                                \
+        return (prefix##_rqueue_span){randomized_queue->storage_array, randomized_queue->size};                  \
+    }                                                                                                            \
+                                                                                                                 \
+    /* Write the items in storage order to fd as a snapshot (see snapshot.h). T must                             \
+     * not contain pointers. Returns false if writing failed */                                                  \
+    bool rqueue_##prefix##_save(const prefix##_rqueue *randomized_queue, int fd)                                 \
+    {                                                                                                            \
+        assert(randomized_queue);                                                                                \
+        return snapshot_write_header(fd, sizeof(T), randomized_queue->size) &&                                   \
+               snapshot_write(fd, randomized_queue->storage_array, randomized_queue->size * sizeof(T));          \
+    }                                                                                                            \
+                                                                                                                 \
+    /* Return randomized queue holding the items of the snapshot at path, or NULL if                             \
+     * it cannot be read or does not hold items of type T. The items are read from the                           \
+     * mapped file until the queue first changes; it will not shrink below its loaded                            \
+     * size until rqueue_shrink_to_fit. Do not write through rqueue_span or                                      \
+     * RQUEUE_FOREACH before that */                                                                             \
+    prefix##_rqueue *rqueue_##prefix##_load_mmap(const char *path)                                               \
+    {                                                                                                            \
+        snapshot_mapping mapping;                                                                                \
+        const void *items;                                                                                       \
+        int count;                                                                                               \
+        if (!snapshot_map(path, sizeof(T), &mapping, &items, &count))                                            \
+        {                                                                                                        \
+            return NULL;                                                                                         \
+        }                                                                                                        \
+        prefix##_rqueue *randomized_queue = rqueue_##prefix##_create();                                          \
+        if (count > 0)                                                                                           \
+        {                                                                                                        \
+            const allocator *allocator = randomized_queue->allocator;                                            \
+            allocator->release(allocator->context, randomized_queue->storage_array,                              \
+                               randomized_queue->capacity * sizeof(T));                                          \
+            randomized_queue->storage_array = (T *)items;                                                        \
+            randomized_queue->mapping = mapping;                                                                 \
+            randomized_queue->capacity = count;                                                                  \
+            randomized_queue->size = count;                                                                      \
+            if (count > randomized_queue->minimum_capacity)                                                      \
+            {                                                                                                    \
+                randomized_queue->minimum_capacity = count;                                                      \
+            }                                                                                                    \
+        }                                                                                                        \
+        return randomized_queue;                                                                                 \
+    }
+
+/* Loop over the items of a randomized queue in storage order, with item a pointer
+ * into the storage array. Use a random iterator when the order matters. The queue
+ * must not change inside the loop */
+#define RQUEUE_FOREACH(prefix, item, randomized_queue)                                                                  \
+    for (prefix##_rqueue_item *item = (randomized_queue)->storage_array, *item##_end = item + (randomized_queue)->size; \
+         item < item##_end; item++)
 
-#endif
\ No newline at end of file
+#endif
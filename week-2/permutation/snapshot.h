@@ -0,0 +1,127 @@
+/* Binary SNAPSHOTS of container contents
+ * A snapshot file is a 32 byte header (magic, layout version, item size and item
+ * count) followed by the items front to back, byte for byte as they are in
+ * memory. So only items without pointers can be saved, and a snapshot can only
+ * be read back on a machine with the same endianness and struct layout.
+ * *_load_mmap maps the file read-only: the container reads its items straight
+ * from the page cache, and the first change copies them into ordinary storage.
+ * The same file is used by stack.h, deque.h and rqueue.h, and a snapshot saved
+ * by one of them can be loaded by any of the others.
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SNAPSHOT_MAGIC "CSNAPSHT"
+#define SNAPSHOT_VERSION 1
+
+typedef struct snapshot_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t element_size;
+    uint64_t count;
+    // Keeps the items 32 byte aligned in a mapping
+    uint64_t reserved;
+} snapshot_header;
+
+// A read-only mapping of a snapshot file, address is NULL when nothing is mapped
+typedef struct snapshot_mapping
+{
+    void *address;
+    size_t size;
+} snapshot_mapping;
+
+/* Write size bytes, continuing after partial writes and interrupts */
+static inline bool snapshot_write(int fd, const void *data, size_t size)
+{
+    const char *bytes = data;
+    while (size > 0)
+    {
+        ssize_t written = write(fd, bytes, size);
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            return false;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return true;
+}
+
+static inline bool snapshot_write_header(int fd, size_t element_size, int count)
+{
+    snapshot_header header = {.version = SNAPSHOT_VERSION, .element_size = element_size, .count = count};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    return snapshot_write(fd, &header, sizeof(header));
+}
+
+/* Map the snapshot at path and check that it holds items of element_size bytes.
+ * On success *items points at the first of *count items inside the mapping. An
+ * empty snapshot maps nothing. Returns false if the file cannot be read or is not
+ * a complete snapshot of items of this size */
+static inline bool snapshot_map(const char *path, size_t element_size, snapshot_mapping *mapping, const void **items,
+                                int *count)
+{
+    mapping->address = NULL;
+    mapping->size = 0;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    snapshot_header header;
+    struct stat file;
+    bool valid = fstat(fd, &file) == 0 && pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+                 memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0 &&
+                 header.version == SNAPSHOT_VERSION && header.element_size == element_size &&
+                 header.count <= INT_MAX && (uint64_t)file.st_size == sizeof(header) + header.count * element_size;
+    if (valid && header.count > 0)
+    {
+        void *address = mmap(NULL, file.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address == MAP_FAILED)
+        {
+            valid = false;
+        }
+        else
+        {
+            mapping->address = address;
+            mapping->size = file.st_size;
+        }
+    }
+    close(fd);
+
+    if (valid)
+    {
+        *items = mapping->address ? (const char *)mapping->address + sizeof(header) : NULL;
+        *count = header.count;
+    }
+    return valid;
+}
+
+static inline void snapshot_unmap(snapshot_mapping *mapping)
+{
+    if (mapping->address)
+    {
+        munmap(mapping->address, mapping->size);
+        mapping->address = NULL;
+        mapping->size = 0;
+    }
+}
+
+#endif
@@ -0,0 +1,93 @@
+/* STRING ARENA for short strings of bounded length
+ * Strings are copied into fixed-size slots, big enough for the longest string
+ * allowed plus its '\0', carved out of an arena (allocator.h). A released slot
+ * goes on a free list and is reused by the next copy, so a program that keeps a
+ * bounded number of strings alive needs only that many slots, however many
+ * strings pass through. Containers hold string_slice handles, which carry the
+ * length of the string with a pointer to its slot.
+ */
+
+#ifndef STRING_ARENA_H
+#define STRING_ARENA_H
+#include <assert.h>
+#include <string.h>
+
+#include "allocator.h"
+
+typedef struct string_slice
+{
+    char *chars;
+    int length;
+} string_slice;
+
+typedef struct string_arena
+{
+    arena slots;
+    int max_length;
+    size_t slot_size;
+    void *free_slots;
+    // Number of slots in use and taken from the arena so far
+    long live;
+    long allocated;
+} string_arena;
+
+// Slots per arena chunk
+#define STRING_ARENA_CHUNK_SLOTS 1024
+
+/* Initialise arena for strings of at most max_length characters */
+static inline void string_arena_init(string_arena *strings, int max_length)
+{
+    assert(strings);
+    assert(max_length >= 0);
+    strings->max_length = max_length;
+    // A free slot holds the link to the next free slot
+    int slot_size = max_length + 1 > (int)sizeof(void *) ? max_length + 1 : (int)sizeof(void *);
+    strings->slot_size = allocator_round_up(slot_size);
+    strings->free_slots = NULL;
+    strings->live = 0;
+    strings->allocated = 0;
+    arena_init(&strings->slots, strings->slot_size * STRING_ARENA_CHUNK_SLOTS);
+}
+
+/* Copy the first length characters of chars into a slot */
+static inline string_slice string_arena_copy(string_arena *strings, const char *chars, int length)
+{
+    assert(strings);
+    assert(length >= 0 && length <= strings->max_length);
+    char *slot = strings->free_slots;
+    if (slot)
+    {
+        strings->free_slots = *(void **)slot;
+    }
+    else
+    {
+        slot = arena_allocate(&strings->slots, strings->slot_size);
+        strings->allocated++;
+    }
+    memcpy(slot, chars, length);
+    slot[length] = '\0';
+    strings->live++;
+    return (string_slice){slot, length};
+}
+
+/* Give the slot of a copied string back for reuse */
+static inline void string_arena_release(string_arena *strings, string_slice string)
+{
+    assert(strings);
+    assert(string.chars);
+    *(void **)string.chars = strings->free_slots;
+    strings->free_slots = string.chars;
+    strings->live--;
+}
+
+/* Release every string at once */
+static inline void string_arena_free(string_arena *strings)
+{
+    assert(strings);
+    arena_free(&strings->slots);
+    strings->free_slots = NULL;
+    strings->live = 0;
+    strings->allocated = 0;
+}
+
+#endif
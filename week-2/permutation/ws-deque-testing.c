@@ -0,0 +1,218 @@
+/* Stress test and steal throughput benchmark for the work-stealing deque.
+ * The stress test has one owner thread push and pop items while thieves steal,
+ * and checks that every item is taken exactly once; the program fails if any is not.
+ * The benchmark has the owner push items that the thieves steal, and compares
+ * the lock-free deque against DEFINE_DEQUE_TYPE protected by a mutex.
+ * Usage: ./ws-deque-testing [thieves]
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "deque.h"
+#include "ws-deque.h"
+
+DEFINE_WS_DEQUE_TYPE(long, task);
+DEFINE_DEQUE_TYPE(long, task);
+
+#define MAX_THIEVES 64
+
+static const long STRESS_ITEMS = 2000000;
+static const long BENCHMARK_ITEMS = 10000000;
+
+// Shared state of a test run
+static task_ws_deque *ws_deque;
+static task_deque *locked_deque;
+static pthread_mutex_t deque_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_bool done;
+static atomic_uchar *taken;
+static atomic_long stolen;
+
+double seconds_since(struct timespec start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+void *stress_thief(void *arg)
+{
+    (void)arg;
+    long item;
+    while (true)
+    {
+        ws_deque_result result = ws_deque_task_steal(ws_deque, &item);
+        if (result == WS_DEQUE_SUCCESS)
+        {
+            atomic_fetch_add_explicit(&taken[item], 1, memory_order_relaxed);
+        }
+        else if (result == WS_DEQUE_EMPTY && atomic_load(&done))
+        {
+            break;
+        }
+    }
+    return NULL;
+}
+
+void *ws_benchmark_thief(void *arg)
+{
+    (void)arg;
+    long item;
+    long count = 0;
+    while (true)
+    {
+        ws_deque_result result = ws_deque_task_steal(ws_deque, &item);
+        if (result == WS_DEQUE_SUCCESS)
+        {
+            count++;
+        }
+        else if (result == WS_DEQUE_EMPTY && atomic_load(&done))
+        {
+            break;
+        }
+    }
+    atomic_fetch_add(&stolen, count);
+    return NULL;
+}
+
+void *locked_benchmark_thief(void *arg)
+{
+    (void)arg;
+    long count = 0;
+    while (true)
+    {
+        pthread_mutex_lock(&deque_lock);
+        bool empty = deque_task_is_empty(locked_deque);
+        if (!empty)
+        {
+            deque_task_remove_first(locked_deque);
+            count++;
+        }
+        pthread_mutex_unlock(&deque_lock);
+
+        if (empty && atomic_load(&done))
+        {
+            break;
+        }
+    }
+    atomic_fetch_add(&stolen, count);
+    return NULL;
+}
+
+/* Returns the number of items not taken exactly once */
+long run_stress_test(int thieves)
+{
+    pthread_t threads[MAX_THIEVES];
+    ws_deque = ws_deque_task_create();
+    taken = calloc(STRESS_ITEMS, sizeof(*taken));
+    assert(taken);
+    atomic_store(&done, false);
+
+    for (int i = 0; i < thieves; i++)
+    {
+        pthread_create(&threads[i], NULL, stress_thief, NULL);
+    }
+
+    // Owner pushes everything, popping some items back in between
+    long item;
+    for (long i = 0; i < STRESS_ITEMS; i++)
+    {
+        ws_deque_task_push(ws_deque, i);
+        if (rand() % 3 == 0 && ws_deque_task_pop(ws_deque, &item))
+        {
+            atomic_fetch_add_explicit(&taken[item], 1, memory_order_relaxed);
+        }
+    }
+    while (ws_deque_task_pop(ws_deque, &item))
+    {
+        atomic_fetch_add_explicit(&taken[item], 1, memory_order_relaxed);
+    }
+    atomic_store(&done, true);
+
+    for (int i = 0; i < thieves; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    long errors = 0;
+    for (long i = 0; i < STRESS_ITEMS; i++)
+    {
+        if (taken[i] != 1)
+        {
+            errors++;
+        }
+    }
+    printf("Stress test: %li items, %i thieves, %li items not taken exactly once\n", STRESS_ITEMS, thieves, errors);
+
+    free(taken);
+    ws_deque_task_free(ws_deque);
+    return errors;
+}
+
+void run_benchmark(int thieves, bool locked)
+{
+    pthread_t threads[MAX_THIEVES];
+    ws_deque = ws_deque_task_create();
+    locked_deque = deque_task_create();
+    atomic_store(&done, false);
+    atomic_store(&stolen, 0);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < thieves; i++)
+    {
+        pthread_create(&threads[i], NULL, locked ? locked_benchmark_thief : ws_benchmark_thief, NULL);
+    }
+
+    for (long i = 0; i < BENCHMARK_ITEMS; i++)
+    {
+        if (locked)
+        {
+            pthread_mutex_lock(&deque_lock);
+            deque_task_add_last(locked_deque, i);
+            pthread_mutex_unlock(&deque_lock);
+        }
+        else
+        {
+            ws_deque_task_push(ws_deque, i);
+        }
+    }
+    atomic_store(&done, true);
+
+    for (int i = 0; i < thieves; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = seconds_since(start);
+
+    printf("%-22s %10.0f steals/s (%li stolen in %.3f s)\n", locked ? "Mutex-protected deque:" : "Work-stealing deque:",
+           atomic_load(&stolen) / elapsed, atomic_load(&stolen), elapsed);
+
+    ws_deque_task_free(ws_deque);
+    deque_task_free(locked_deque);
+}
+
+int main(int argc, char *argv[])
+{
+    int thieves = 3;
+    if (argc == 2)
+    {
+        thieves = atoi(argv[1]);
+    }
+    if (thieves < 1 || thieves > MAX_THIEVES)
+    {
+        printf("Usage: ./ws-deque-testing [thieves], with 1 to %i thieves\n", MAX_THIEVES);
+        return 1;
+    }
+
+    srand(time(NULL));
+    long errors = run_stress_test(thieves);
+    run_benchmark(thieves, false);
+    run_benchmark(thieves, true);
+    return errors > 0 ? 1 : 0;
+}
@@ -0,0 +1,183 @@
+/* Generic lock-free WORK-STEALING DEQUE (using macro's)
+ * Chase-Lev deque with C11 atomics, following "Correct and Efficient Work-Stealing
+ * for Weak Memory Models" (Le, Pop, Cohen, Zappa Nardelli, PPoPP 2013).
+ * One owner thread pushes and pops at the bottom, any number of thief threads
+ * steal from the top. T should be a pointer or integer type (a task handle), so
+ * that the slots of the circular array are lock-free atomics.
+ *
+ * When the circular array runs full the owner copies it into one of twice the
+ * size. Thieves may still be reading the old array at that point, so it is not
+ * freed but retired: old arrays are kept on a list and freed together with the
+ * deque, when no thief can be using it anymore. Because arrays double, all
+ * retired arrays together are smaller than the current one.
+ */
+
+#ifndef WS_DEQUE_H
+#define WS_DEQUE_H
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static const int64_t WS_DEQUE_MINIMUM_CAPACITY = 64;
+
+typedef enum ws_deque_result
+{
+    WS_DEQUE_EMPTY,
+    WS_DEQUE_ABORT,
+    WS_DEQUE_SUCCESS
+} ws_deque_result;
+
+#define DEFINE_WS_DEQUE_TYPE(T, prefix)                                                                            \
+    typedef struct prefix##_ws_array                                                                               \
+    {                                                                                                              \
+        int64_t capacity;                                                                                          \
+        struct prefix##_ws_array *retired;                                                                         \
+        _Atomic(T) storage_array[];                                                                                \
+    } prefix##_ws_array;                                                                                           \
+                                                                                                                   \
+    typedef struct prefix##_ws_deque                                                                               \
+    {                                                                                                              \
+        _Alignas(64) atomic_int_fast64_t top;                                                                      \
+        _Alignas(64) atomic_int_fast64_t bottom;                                                                   \
+        _Atomic(prefix##_ws_array *) array;                                                                        \
+    } prefix##_ws_deque;                                                                                           \
+                                                                                                                   \
+    prefix##_ws_array *ws_deque_##prefix##_array_create(int64_t capacity)                                          \
+    {                                                                                                              \
+        prefix##_ws_array *array = malloc(sizeof(*array) + capacity * sizeof(array->storage_array[0]));            \
+        assert(array);                                                                                             \
+        array->capacity = capacity;                                                                                \
+        array->retired = NULL;                                                                                     \
+        return array;                                                                                              \
+    }                                                                                                              \
+                                                                                                                   \
+    /* Return pointer to deque */                                                                                  \
+    prefix##_ws_deque *ws_deque_##prefix##_create(void)                                                            \
+    {                                                                                                              \
+        prefix##_ws_deque *deque = aligned_alloc(64, sizeof(*deque));                                              \
+        assert(deque);                                                                                             \
+        atomic_init(&deque->top, 0);                                                                               \
+        atomic_init(&deque->bottom, 0);                                                                            \
+        atomic_init(&deque->array, ws_deque_##prefix##_array_create(WS_DEQUE_MINIMUM_CAPACITY));                   \
+        return deque;                                                                                              \
+    }                                                                                                              \
+                                                                                                                   \
+    /* Free memory allocated for deque, including retired arrays.                                                  \
+     * No other thread may be using the deque anymore */                                                           \
+    void ws_deque_##prefix##_free(prefix##_ws_deque *deque)                                                        \
+    {                                                                                                              \
+        assert(deque);                                                                                             \
+        prefix##_ws_array *array = atomic_load_explicit(&deque->array, memory_order_relaxed);                      \
+        while (array)                                                                                              \
+        {                                                                                                          \
+            prefix##_ws_array *retired = array->retired;                                                           \
+            free(array);                                                                                           \
+            array = retired;                                                                                       \
+        }                                                                                                          \
+        free(deque);                                                                                               \
+        deque = NULL;                                                                                              \
+    }                                                                                                              \
+                                                                                                                   \
+    /* Copy items top..bottom into an array of twice the capacity (owner only) */                                  \
+    prefix##_ws_array *ws_deque_##prefix##_grow(prefix##_ws_deque *deque, prefix##_ws_array *array, int64_t top,   \
+                                                int64_t bottom)                                                    \
+    {                                                                                                              \
+        prefix##_ws_array *bigger = ws_deque_##prefix##_array_create(array->capacity * 2);                         \
+        for (int64_t i = top; i < bottom; i++)                                                                     \
+        {                                                                                                          \
+            T item = atomic_load_explicit(&array->storage_array[i & (array->capacity - 1)], memory_order_relaxed); \
+            atomic_store_explicit(&bigger->storage_array[i & (bigger->capacity - 1)], item, memory_order_relaxed); \
+        }                                                                                                          \
+        bigger->retired = array;                                                                                   \
+        atomic_store_explicit(&deque->array, bigger, memory_order_release);                                        \
+        return bigger;                                                                                             \
+    }                                                                                                              \
+                                                                                                                   \
+    /* Approximate number of items, exact when called by the owner without thieves */                              \
+    int64_t ws_deque_##prefix##_size(prefix##_ws_deque *deque)                                                     \
+    {                                                                                                              \
+        assert(deque);                                                                                             \
+        int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);                               \
+        int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);                                     \
+        return bottom > top ? bottom - top : 0;                                                                    \
+    }                                                                                                              \
+                                                                                                                   \
+    bool ws_deque_##prefix##_is_empty(prefix##_ws_deque *deque)                                                    \
+    {                                                                                                              \
+        return ws_deque_##prefix##_size(deque) == 0;                                                               \
+    }                                                                                                              \
+                                                                                                                   \
+    /* Push item at the bottom (owner only) */                                                                     \
+    void ws_deque_##prefix##_push(prefix##_ws_deque *deque, T item)                                                \
+    {                                                                                                              \
+        assert(deque);                                                                                             \
+        int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);                               \
+        int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);                                     \
+        prefix##_ws_array *array = atomic_load_explicit(&deque->array, memory_order_relaxed);                      \
+        if (bottom - top > array->capacity - 1)                                                                    \
+        {                                                                                                          \
+            array = ws_deque_##prefix##_grow(deque, array, top, bottom);                                           \
+        }                                                                                                          \
+        atomic_store_explicit(&array->storage_array[bottom & (array->capacity - 1)], item, memory_order_relaxed);  \
+        atomic_thread_fence(memory_order_release);                                                                 \
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);                                   \
+    }                                                                                                              \
+                                                                                                                   \
+    /* Pop item from the bottom into *item (owner only), returns false if the deque is empty */                    \
+    bool ws_deque_##prefix##_pop(prefix##_ws_deque *deque, T *item)                                                \
+    {                                                                                                              \
+        assert(deque);                                                                                             \
+        int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;                           \
+        prefix##_ws_array *array = atomic_load_explicit(&deque->array, memory_order_relaxed);                      \
+        atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);                                       \
+        atomic_thread_fence(memory_order_seq_cst);                                                                 \
+        int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);                                     \
+                                                                                                                   \
+        if (top > bottom)                                                                                          \
+        {                                                                                                          \
+            /* Deque was empty */                                                                                  \
+            atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);                               \
+            return false;                                                                                          \
+        }                                                                                                          \
+                                                                                                                   \
+        *item = atomic_load_explicit(&array->storage_array[bottom & (array->capacity - 1)], memory_order_relaxed); \
+        if (top == bottom)                                                                                         \
+        {                                                                                                          \
+            /* Last item: race against thieves for it */                                                           \
+            bool won = atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst,   \
+                                                               memory_order_relaxed);                              \
+            atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);                               \
+            return won;                                                                                            \
+        }                                                                                                          \
+        return true;                                                                                               \
+    }                                                                                                              \
+                                                                                                                   \
+    /* Steal item from the top into *item (any thread). Returns WS_DEQUE_ABORT if                                  \
+     * another thread took the item first, in which case stealing can be retried */                                \
+    ws_deque_result ws_deque_##prefix##_steal(prefix##_ws_deque *deque, T *item)                                   \
+    {                                                                                                              \
+        assert(deque);                                                                                             \
+        int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);                                     \
+        atomic_thread_fence(memory_order_seq_cst);                                                                 \
+        int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);                               \
+                                                                                                                   \
+        if (top >= bottom)                                                                                         \
+        {                                                                                                          \
+            return WS_DEQUE_EMPTY;                                                                                 \
+        }                                                                                                          \
+                                                                                                                   \
+        prefix##_ws_array *array = atomic_load_explicit(&deque->array, memory_order_acquire);                      \
+        T stolen = atomic_load_explicit(&array->storage_array[top & (array->capacity - 1)], memory_order_relaxed); \
+        if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst,             \
+                                                     memory_order_relaxed))                                        \
+        {                                                                                                          \
+            return WS_DEQUE_ABORT;                                                                                 \
+        }                                                                                                          \
+        *item = stolen;                                                                                            \
+        return WS_DEQUE_SUCCESS;                                                                                   \
+    }
+
+#endif
@@ -0,0 +1,126 @@
+/* Compares a binary heap against the 4-ary heap of DEFINE_PQ_TYPE on n random
+ * integers: heapify and drain, n pushes and n pops, and selecting the k largest
+ * with a bounded queue. Every drain is checked to come out in order.
+ * Usage: ./pq-benchmark [n] [k]
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "pq.h"
+
+#define INT_LESS(a, b) ((a) < (b))
+
+DEFINE_DARY_PQ_TYPE(int, binary, INT_LESS, 2);
+DEFINE_PQ_TYPE(int, quaternary, INT_LESS);
+
+double seconds_since(struct timespec start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+// Same benchmark for both layouts, prefix picks the heap type
+#define RUN_BENCHMARK(prefix, name)                                      \
+    {                                                                    \
+        struct timespec start;                                           \
+                                                                         \
+        clock_gettime(CLOCK_MONOTONIC, &start);                          \
+        prefix##_pq *pq = pq_##prefix##_create_from(items, n);           \
+        for (int i = 0, previous = 0; i < n; i++)                        \
+        {                                                                \
+            int item = pq_##prefix##_pop(pq);                            \
+            assert(i == 0 || previous <= item);                          \
+            previous = item;                                             \
+        }                                                                \
+        double heapified = seconds_since(start);                         \
+        pq_##prefix##_free(pq);                                          \
+                                                                         \
+        clock_gettime(CLOCK_MONOTONIC, &start);                          \
+        pq = pq_##prefix##_create();                                     \
+        for (int i = 0; i < n; i++)                                      \
+        {                                                                \
+            pq_##prefix##_push(pq, items[i]);                            \
+        }                                                                \
+        for (int i = 0, previous = 0; i < n; i++)                        \
+        {                                                                \
+            int item = pq_##prefix##_pop(pq);                            \
+            assert(i == 0 || previous <= item);                          \
+            previous = item;                                             \
+        }                                                                \
+        double pushed = seconds_since(start);                            \
+        pq_##prefix##_free(pq);                                          \
+                                                                         \
+        clock_gettime(CLOCK_MONOTONIC, &start);                          \
+        pq = pq_##prefix##_create_bounded(k);                            \
+        for (int i = 0; i < n; i++)                                      \
+        {                                                                \
+            pq_##prefix##_push(pq, items[i]);                            \
+        }                                                                \
+        long sum = 0;                                                    \
+        while (!pq_##prefix##_is_empty(pq))                              \
+        {                                                                \
+            sum += pq_##prefix##_pop(pq);                                \
+        }                                                                \
+        double selected = seconds_since(start);                          \
+        pq_##prefix##_free(pq);                                          \
+                                                                         \
+        assert(sum == top_k_sum);                                        \
+        printf("%-8s %14.2f %14.2f %14.2f\n", name, heapified * 1e9 / n, \
+               pushed * 1e9 / n, selected * 1e9 / n);                    \
+    }
+
+int compare_descending(const void *a, const void *b)
+{
+    int x = *(const int *)a;
+    int y = *(const int *)b;
+    return (x < y) - (x > y);
+}
+
+int main(int argc, char *argv[])
+{
+    int n = 5000000;
+    int k = 100;
+    if (argc > 1)
+    {
+        n = atoi(argv[1]);
+    }
+    if (argc > 2)
+    {
+        k = atoi(argv[2]);
+    }
+    if (n < 1 || k < 1 || k > n)
+    {
+        printf("Usage: ./pq-benchmark [n] [k], with 1 <= k <= n\n");
+        return 1;
+    }
+
+    int *items = malloc(n * sizeof(*items));
+    int *sorted = malloc(n * sizeof(*sorted));
+    assert(items && sorted);
+    srand(time(NULL));
+    for (int i = 0; i < n; i++)
+    {
+        items[i] = sorted[i] = rand();
+    }
+
+    // The bounded queues must end up with the k largest items
+    qsort(sorted, n, sizeof(*sorted), compare_descending);
+    long top_k_sum = 0;
+    for (int i = 0; i < k; i++)
+    {
+        top_k_sum += sorted[i];
+    }
+
+    printf("n = %i, k = %i, ns/item\n", n, k);
+    printf("%-8s %14s %14s %14s\n", "arity", "heapify+pop", "push+pop", "top-k");
+    RUN_BENCHMARK(binary, "2");
+    RUN_BENCHMARK(quaternary, "4");
+
+    free(items);
+    free(sorted);
+    return 0;
+}
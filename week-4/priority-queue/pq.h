@@ -0,0 +1,199 @@
+/* Generic PRIORITY QUEUE datastructure (using macro's)
+ * d-ary heap in one array: the children of item i are items d * i + 1 .. d * i + d.
+ * DEFINE_PQ_TYPE uses d = 4, which halves the height of the heap compared to a
+ * binary heap and keeps the children of an item next to each other in memory.
+ * 'less' is a function or macro taking two items; less(a, b) is true when a should
+ * come out before b, so with a < b the queue returns the smallest item first.
+ * Since the macro calls it directly, the compiler can inline the comparison.
+ *
+ * A bounded queue (pq_create_bounded) keeps at most k items: once full, a pushed
+ * item only gets in by replacing the top if the top comes before it, so the queue
+ * keeps the k items that come out LAST. With 'less' comparing counts ascending,
+ * it selects the k highest counts in O(n log k).
+ */
+
+#ifndef PQ_H
+#define PQ_H
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const int PQ_MINIMUM_CAPACITY = 8;
+
+#define DEFINE_PQ_TYPE(T, prefix, less) DEFINE_DARY_PQ_TYPE(T, prefix, less, 4)
+
+#define DEFINE_DARY_PQ_TYPE(T, prefix, less, D)                                                       \
+    typedef struct prefix##_pq                                                                        \
+    {                                                                                                 \
+        int capacity;                                                                                 \
+        int size;                                                                                     \
+        int bound;                                                                                    \
+        T *storage_array;                                                                             \
+    } prefix##_pq;                                                                                    \
+                                                                                                      \
+    /* Return pointer to empty priority queue */                                                      \
+    prefix##_pq *pq_##prefix##_create(void)                                                           \
+    {                                                                                                 \
+        prefix##_pq *pq = malloc(sizeof(*pq));                                                        \
+                                                                                                      \
+        assert(pq);                                                                                   \
+        pq->capacity = PQ_MINIMUM_CAPACITY;                                                           \
+        pq->size = 0;                                                                                 \
+        pq->bound = 0;                                                                                \
+        assert((pq->storage_array = malloc(sizeof(*pq->storage_array) * pq->capacity)));              \
+        return pq;                                                                                    \
+    }                                                                                                 \
+                                                                                                      \
+    /* Return pointer to priority queue that keeps the k items that come out last */                  \
+    prefix##_pq *pq_##prefix##_create_bounded(int k)                                                  \
+    {                                                                                                 \
+        assert(k > 0);                                                                                \
+        prefix##_pq *pq = malloc(sizeof(*pq));                                                        \
+                                                                                                      \
+        assert(pq);                                                                                   \
+        pq->capacity = k;                                                                             \
+        pq->size = 0;                                                                                 \
+        pq->bound = k;                                                                                \
+        assert((pq->storage_array = malloc(sizeof(*pq->storage_array) * pq->capacity)));              \
+        return pq;                                                                                    \
+    }                                                                                                 \
+                                                                                                      \
+    void pq_##prefix##_free(prefix##_pq *pq)                                                          \
+    {                                                                                                 \
+        assert(pq);                                                                                   \
+        free(pq->storage_array);                                                                      \
+        pq->storage_array = NULL;                                                                     \
+        free(pq);                                                                                     \
+        pq = NULL;                                                                                    \
+    }                                                                                                 \
+                                                                                                      \
+    bool pq_##prefix##_is_empty(const prefix##_pq *pq)                                                \
+    {                                                                                                 \
+        assert(pq);                                                                                   \
+        return pq->size == 0;                                                                         \
+    }                                                                                                 \
+                                                                                                      \
+    /* Return the item that comes out next, without removing it */                                    \
+    T pq_##prefix##_top(const prefix##_pq *pq)                                                        \
+    {                                                                                                 \
+        assert(pq);                                                                                   \
+        assert(pq->size > 0);                                                                         \
+        return pq->storage_array[0];                                                                  \
+    }                                                                                                 \
+                                                                                                      \
+    /* Move item up from the hole at index until its parent comes before it */                        \
+    void pq_##prefix##_sift_up(T *items, int index, T item)                                           \
+    {                                                                                                 \
+        while (index > 0)                                                                             \
+        {                                                                                             \
+            int parent = (index - 1) / D;                                                             \
+            if (!less(item, items[parent]))                                                           \
+            {                                                                                         \
+                break;                                                                                \
+            }                                                                                         \
+            items[index] = items[parent];                                                             \
+            index = parent;                                                                           \
+        }                                                                                             \
+        items[index] = item;                                                                          \
+    }                                                                                                 \
+                                                                                                      \
+    /* Move item down from the hole at index until none of its children comes before it */            \
+    void pq_##prefix##_sift_down(T *items, int size, int index, T item)                               \
+    {                                                                                                 \
+        while (true)                                                                                  \
+        {                                                                                             \
+            int first_child = D * index + 1;                                                          \
+            if (first_child >= size)                                                                  \
+            {                                                                                         \
+                break;                                                                                \
+            }                                                                                         \
+            int last_child = first_child + D <= size ? first_child + D : size;                        \
+            int best = first_child;                                                                   \
+            for (int child = first_child + 1; child < last_child; child++)                            \
+            {                                                                                         \
+                if (less(items[child], items[best]))                                                  \
+                {                                                                                     \
+                    best = child;                                                                     \
+                }                                                                                     \
+            }                                                                                         \
+            if (!less(items[best], item))                                                             \
+            {                                                                                         \
+                break;                                                                                \
+            }                                                                                         \
+            items[index] = items[best];                                                               \
+            index = best;                                                                             \
+        }                                                                                             \
+        items[index] = item;                                                                          \
+    }                                                                                                 \
+                                                                                                      \
+    /* Return pointer to priority queue holding a copy of the n items, heapified bottom-up in O(n) */ \
+    prefix##_pq *pq_##prefix##_create_from(const T *items, int n)                                     \
+    {                                                                                                 \
+        assert(n >= 0);                                                                               \
+        prefix##_pq *pq = pq_##prefix##_create();                                                     \
+        if (n > pq->capacity)                                                                         \
+        {                                                                                             \
+            T *tmp = realloc(pq->storage_array, sizeof(*pq->storage_array) * n);                      \
+            assert(tmp);                                                                              \
+            pq->storage_array = tmp;                                                                  \
+            pq->capacity = n;                                                                         \
+        }                                                                                             \
+        memcpy(pq->storage_array, items, sizeof(*items) * n);                                         \
+        pq->size = n;                                                                                 \
+        for (int i = (n - 2) / D; n > 1 && i >= 0; i--)                                               \
+        {                                                                                             \
+            pq_##prefix##_sift_down(pq->storage_array, n, i, pq->storage_array[i]);                   \
+        }                                                                                             \
+        return pq;                                                                                    \
+    }                                                                                                 \
+                                                                                                      \
+    /* Replace the top item by item and restore the heap, cheaper than a pop and a push */            \
+    T pq_##prefix##_replace_top(prefix##_pq *pq, T item)                                              \
+    {                                                                                                 \
+        assert(pq);                                                                                   \
+        assert(pq->size > 0);                                                                         \
+        T top = pq->storage_array[0];                                                                 \
+        pq_##prefix##_sift_down(pq->storage_array, pq->size, 0, item);                                \
+        return top;                                                                                   \
+    }                                                                                                 \
+                                                                                                      \
+    void pq_##prefix##_push(prefix##_pq *pq, T item)                                                  \
+    {                                                                                                 \
+        assert(pq);                                                                                   \
+        if (pq->bound > 0 && pq->size == pq->bound)                                                   \
+        {                                                                                             \
+            /* Full bounded queue: item replaces the top if it comes out later */                     \
+            if (less(pq->storage_array[0], item))                                                     \
+            {                                                                                         \
+                pq_##prefix##_replace_top(pq, item);                                                  \
+            }                                                                                         \
+            return;                                                                                   \
+        }                                                                                             \
+        if (pq->size == pq->capacity)                                                                 \
+        {                                                                                             \
+            pq->capacity *= 2;                                                                        \
+            T *tmp = realloc(pq->storage_array, sizeof(*pq->storage_array) * pq->capacity);           \
+            assert(tmp);                                                                              \
+            pq->storage_array = tmp;                                                                  \
+        }                                                                                             \
+        pq->size++;                                                                                   \
+        pq_##prefix##_sift_up(pq->storage_array, pq->size - 1, item);                                 \
+    }                                                                                                 \
+                                                                                                      \
+    /* Remove and return the item that comes first */                                                 \
+    T pq_##prefix##_pop(prefix##_pq *pq)                                                              \
+    {                                                                                                 \
+        assert(pq);                                                                                   \
+        assert(pq->size > 0);                                                                         \
+        T top = pq->storage_array[0];                                                                 \
+        pq->size--;                                                                                   \
+        if (pq->size > 0)                                                                             \
+        {                                                                                             \
+            pq_##prefix##_sift_down(pq->storage_array, pq->size, 0, pq->storage_array[pq->size]);     \
+        }                                                                                             \
+        return top;                                                                                   \
+    }
+
+#endif